@@ -0,0 +1,1028 @@
+/*-------------------------------------------------------------------------
+ *
+ * execGrouping.c
+ *	  Hash tables of groups for the vectorized hash aggregate.
+ *
+ * The stock TupleHashTable is looked up a tuple at a time: the keys of a
+ * row are copied into a slot, hashed through fmgr a column at a time and
+ * compared with those of the entry found through fmgr again.  Here a whole
+ * batch is looked up at once, in passes that each run one loop over its
+ * rows:
+ *
+ *	1. the hash of every row, a key column at a time, with loops typed by
+ *	   the width of the column for integers, dates and timestamps, and
+ *	   through the hash function of the type for the others;
+ *	2. the first bucket of every row with its hash, or an empty one, with
+ *	   the buckets of rows further on prefetched so that the cache misses
+ *	   of the probes overlap;
+ *	3. the keys of every row against those of the group found, a key
+ *	   column at a time;
+ *	4. the rows left, whose group is new or whose hash collided, one at a
+ *	   time, inserting the groups not found.
+ *
+ * Only the last pass inserts, so that rows of the same new group in a
+ * batch all find the group the first of them made.
+ *
+ * The sorted aggregate needs no table: VFindTupleRuns splits a batch into
+ * the runs of rows with equal keys, comparing each row with the one before
+ * it a key column at a time.
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "catalog/pg_type.h"
+#include "miscadmin.h"
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+#include "execGrouping.h"
+#include "vectorTupleSlot.h"
+#include "vtype/vtype.h"
+
+/*
+ * How many rows ahead of the one probing we prefetch its bucket.
+ */
+#define VGROUP_PREFETCH_DISTANCE	16
+
+#if defined(__GNUC__) || defined(__INTEL_COMPILER)
+#define vgroup_prefetch(addr)	__builtin_prefetch(addr)
+#else
+#define vgroup_prefetch(addr)	((void) 0)
+#endif
+
+/* the finalizer of MurmurHash3, for keys compared bitwise */
+static inline uint32
+vgroup_hash64(uint64 key)
+{
+	key ^= key >> 33;
+	key *= UINT64CONST(0xff51afd7ed558ccd);
+	key ^= key >> 33;
+	key *= UINT64CONST(0xc4ceb9fe1a85ec53);
+	key ^= key >> 33;
+	return (uint32) key;
+}
+
+/* the most slots of a direct map of small key domains */
+#define VGROUP_DIRECT_MAX	4096
+
+/* combine successive hashkeys by rotating, as TupleHashTableHash does */
+#define VGROUP_COMBINE(hashkey, colhash) \
+	((((hashkey) << 1) | ((hashkey) >> 31)) ^ (colhash))
+
+/*
+ * Whether the values of a key column of type typid are equal exactly when
+ * their bits are, and kept natively in a vtype.  Float keys are not: -0
+ * and 0 are equal, and so are NaNs.
+ */
+static bool
+vgroup_bitwise_type(Oid typid)
+{
+	switch (typid)
+	{
+		case BOOLOID:
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case DATEOID:
+		case TIMESTAMPOID:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* the native value of row i of a column compared bitwise */
+static inline int64
+vgroup_ivalue(vtype *column, int i)
+{
+	switch (column->elemlen)
+	{
+		case 1:
+			return VTYPE_VALUES(column, uint8)[i];
+		case 2:
+			return VTYPE_VALUES(column, int16)[i];
+		case 4:
+			return VTYPE_VALUES(column, int32)[i];
+		default:
+			return VTYPE_VALUES(column, int64)[i];
+	}
+}
+
+/*
+ * Construct an empty hash table of groups.
+ *
+ *	numCols, keyColIdx: identify the tuple fields to use as lookup key
+ *	keytypes: the plain types of the key columns
+ *	eqfunctions: equality comparison functions to use
+ *	hashfunctions: datatype-specific hashing functions to use
+ *	nbuckets: initial estimate of hashtable size
+ *	entrysize: size of the entry of a group
+ *	tablecxt: memory context in which to store table and table entries
+ *
+ * The eqfunctions and hashfunctions arrays are as prepared by
+ * execTuplesHashPrepare; they are only called for the keys that are not
+ * compared bitwise.
+ */
+VTupleHashTable
+VBuildTupleHashTable(int numCols, AttrNumber *keyColIdx, Oid *keytypes,
+					 FmgrInfo *eqfunctions, FmgrInfo *hashfunctions,
+					 long nbuckets, Size entrysize, MemoryContext tablecxt)
+{
+	VTupleHashTable hashtable;
+	MemoryContext oldcontext;
+	uint32		nslots;
+	uint32		slot;
+	bool		fewgroups;
+	int			i;
+
+	Assert(numCols > 0);
+	Assert(nbuckets > 0);
+
+	/* a direct map only pays if the planner expects few groups */
+	fewgroups = nbuckets <= VGROUP_DIRECT_MAX;
+
+	/* Limit initial table size request to not more than work_mem */
+	nbuckets = Min(nbuckets, (long) ((work_mem * 1024L) / entrysize));
+	nbuckets = Max(nbuckets, 64);
+
+	oldcontext = MemoryContextSwitchTo(tablecxt);
+
+	hashtable = (VTupleHashTable) palloc0(sizeof(VTupleHashTableData));
+	hashtable->numCols = numCols;
+	hashtable->keyColIdx = keyColIdx;
+	hashtable->eqfunctions = eqfunctions;
+	hashtable->hashfunctions = hashfunctions;
+	hashtable->entrysize = entrysize;
+	hashtable->tablecxt = tablecxt;
+	hashtable->directtried = !fewgroups;
+
+	hashtable->keybitwise = palloc(sizeof(bool) * numCols);
+	hashtable->keytyplen = palloc(sizeof(int16) * numCols);
+	hashtable->keytypbyval = palloc(sizeof(bool) * numCols);
+	hashtable->ikeys = palloc0(sizeof(int64 *) * numCols);
+	hashtable->dkeys = palloc0(sizeof(Datum *) * numCols);
+	hashtable->keynulls = palloc(sizeof(bool *) * numCols);
+
+	hashtable->maxgroups = (int) Min(nbuckets, MaxAllocSize / sizeof(Datum));
+	hashtable->entries = palloc(sizeof(char *) * hashtable->maxgroups);
+	for (i = 0; i < numCols; i++)
+	{
+		hashtable->keybitwise[i] = vgroup_bitwise_type(keytypes[i]);
+		get_typlenbyval(keytypes[i], &hashtable->keytyplen[i],
+						&hashtable->keytypbyval[i]);
+		if (hashtable->keybitwise[i])
+			hashtable->ikeys[i] = palloc(sizeof(int64) * hashtable->maxgroups);
+		else
+			hashtable->dkeys[i] = palloc(sizeof(Datum) * hashtable->maxgroups);
+		hashtable->keynulls[i] = palloc(sizeof(bool) * hashtable->maxgroups);
+	}
+
+	nslots = 1;
+	while (nslots < 2 * (uint32) hashtable->maxgroups)
+		nslots <<= 1;
+	hashtable->mask = nslots - 1;
+	hashtable->buckets = palloc(sizeof(VTupleHashBucket) * nslots);
+	for (slot = 0; slot < nslots; slot++)
+		hashtable->buckets[slot].group = -1;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return hashtable;
+}
+
+/*
+ * Pass 1: the hash of every active row of the batch.
+ */
+#define VGROUP_HASH_NATIVE(ctype) \
+	do { \
+		const ctype *_v = VTYPE_VALUES(column, ctype); \
+		VSEL_FOREACH(sel, dim, i, \
+		{ \
+			uint32		colhash = 0; \
+			if (!column->hasnull || !VTYPE_ISNULL(column, i)) \
+				colhash = vgroup_hash64((uint64) (int64) _v[i]); \
+			hashes[i] = VGROUP_COMBINE(hashes[i], colhash); \
+		}); \
+	} while (0)
+
+static void
+vgroup_hash_batch(VTupleHashTable hashtable, vtype **keycols,
+				  vselection *sel, int dim)
+{
+	uint32	   *hashes = hashtable->hashes;
+	int			col;
+	int			i;
+
+	VSEL_FOREACH(sel, dim, i, hashes[i] = 0;);
+
+	for (col = 0; col < hashtable->numCols; col++)
+	{
+		vtype	   *column = keycols[col];
+
+		if (hashtable->keybitwise[col])
+		{
+			switch (column->elemlen)
+			{
+				case 1:
+					VGROUP_HASH_NATIVE(uint8);
+					break;
+				case 2:
+					VGROUP_HASH_NATIVE(int16);
+					break;
+				case 4:
+					VGROUP_HASH_NATIVE(int32);
+					break;
+				default:
+					VGROUP_HASH_NATIVE(int64);
+					break;
+			}
+		}
+		else
+		{
+			FmgrInfo   *hashfn = &hashtable->hashfunctions[col];
+
+			VSEL_FOREACH(sel, dim, i,
+			{
+				uint32		colhash = 0;
+
+				if (!column->hasnull || !VTYPE_ISNULL(column, i))
+					colhash = DatumGetUInt32(FunctionCall1(hashfn,
+											vtype_getdatum(column, i)));
+				hashes[i] = VGROUP_COMBINE(hashes[i], colhash);
+			});
+		}
+	}
+}
+
+/*
+ * Whether key column col of row i is that of group; nulls are equal to
+ * each other, as in grouping.
+ */
+static inline bool
+vgroup_key_equal(VTupleHashTable hashtable, int col, vtype *column, int i,
+				 int group)
+{
+	bool		isnull = column->hasnull && VTYPE_ISNULL(column, i);
+
+	if (isnull || hashtable->keynulls[col][group])
+		return isnull == hashtable->keynulls[col][group];
+	if (hashtable->keybitwise[col])
+		return vgroup_ivalue(column, i) == hashtable->ikeys[col][group];
+	return DatumGetBool(FunctionCall2(&hashtable->eqfunctions[col],
+									  vtype_getdatum(column, i),
+									  hashtable->dkeys[col][group]));
+}
+
+/*
+ * Double the buckets once half of them are used.
+ */
+static void
+vgroup_grow_buckets(VTupleHashTable hashtable)
+{
+	VTupleHashBucket *oldbuckets = hashtable->buckets;
+	uint32		oldnslots = hashtable->mask + 1;
+	uint32		nslots = oldnslots * 2;
+	uint32		i;
+
+	if ((Size) nslots * sizeof(VTupleHashBucket) > MaxAllocSize)
+		elog(ERROR, "vectorized hash table of %d groups is too large",
+			 hashtable->ngroups);
+
+	hashtable->buckets = MemoryContextAlloc(hashtable->tablecxt,
+											sizeof(VTupleHashBucket) * nslots);
+	hashtable->mask = nslots - 1;
+	for (i = 0; i < nslots; i++)
+		hashtable->buckets[i].group = -1;
+
+	for (i = 0; i < oldnslots; i++)
+	{
+		uint32		slot;
+
+		if (oldbuckets[i].group < 0)
+			continue;
+		slot = oldbuckets[i].hash & hashtable->mask;
+		while (hashtable->buckets[slot].group >= 0)
+			slot = (slot + 1) & hashtable->mask;
+		hashtable->buckets[slot] = oldbuckets[i];
+	}
+
+	pfree(oldbuckets);
+}
+
+/*
+ * Add the group of row i, with a zeroed entry, and return its number.
+ */
+static int
+vgroup_add_group(VTupleHashTable hashtable, vtype **keycols, int i)
+{
+	MemoryContext oldcontext;
+	int			group = hashtable->ngroups;
+	int			col;
+
+	oldcontext = MemoryContextSwitchTo(hashtable->tablecxt);
+
+	if (group == hashtable->maxgroups)
+	{
+		int			maxgroups = hashtable->maxgroups * 2;
+
+		if ((Size) maxgroups * sizeof(Datum) > MaxAllocSize)
+			elog(ERROR, "vectorized hash table of %d groups is too large",
+				 group);
+
+		hashtable->entries = repalloc(hashtable->entries,
+									  sizeof(char *) * maxgroups);
+		for (col = 0; col < hashtable->numCols; col++)
+		{
+			if (hashtable->keybitwise[col])
+				hashtable->ikeys[col] = repalloc(hashtable->ikeys[col],
+												 sizeof(int64) * maxgroups);
+			else
+				hashtable->dkeys[col] = repalloc(hashtable->dkeys[col],
+												 sizeof(Datum) * maxgroups);
+			hashtable->keynulls[col] = repalloc(hashtable->keynulls[col],
+												sizeof(bool) * maxgroups);
+		}
+		hashtable->maxgroups = maxgroups;
+	}
+
+	for (col = 0; col < hashtable->numCols; col++)
+	{
+		vtype	   *column = keycols[col];
+		bool		isnull = column->hasnull && VTYPE_ISNULL(column, i);
+
+		hashtable->keynulls[col][group] = isnull;
+		if (hashtable->keybitwise[col])
+			hashtable->ikeys[col][group] = isnull ? 0 : vgroup_ivalue(column, i);
+		else if (isnull || hashtable->keytypbyval[col])
+			hashtable->dkeys[col][group] = isnull ? (Datum) 0 :
+				vtype_getdatum(column, i);
+		else
+		{
+			hashtable->dkeys[col][group] =
+				datumCopy(vtype_getdatum(column, i), false,
+						  hashtable->keytyplen[col]);
+			hashtable->groupmem +=
+				GetMemoryChunkSpace(DatumGetPointer(hashtable->dkeys[col][group]));
+		}
+	}
+
+	hashtable->entries[group] = palloc0(hashtable->entrysize);
+	hashtable->groupmem += GetMemoryChunkSpace(hashtable->entries[group]);
+	hashtable->ngroups++;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return group;
+}
+
+/*
+ * Pass 4: find the group of row i from scratch, adding it if there is
+ * none, unless the table is frozen: -1 then.
+ */
+static int
+vgroup_find_or_add(VTupleHashTable hashtable, vtype **keycols, int i,
+				   bool *isnew)
+{
+	uint32		hash = hashtable->hashes[i];
+	uint32		slot = hash & hashtable->mask;
+	int			group;
+	int			col;
+
+	while ((group = hashtable->buckets[slot].group) >= 0)
+	{
+		if (hashtable->buckets[slot].hash == hash)
+		{
+			for (col = 0; col < hashtable->numCols; col++)
+			{
+				if (!vgroup_key_equal(hashtable, col, keycols[col], i, group))
+					break;
+			}
+			if (col == hashtable->numCols)
+			{
+				*isnew = false;
+				return group;
+			}
+		}
+		slot = (slot + 1) & hashtable->mask;
+	}
+
+	if (hashtable->frozen)
+	{
+		*isnew = false;
+		return -1;
+	}
+
+	group = vgroup_add_group(hashtable, keycols, i);
+	hashtable->buckets[slot].hash = hash;
+	hashtable->buckets[slot].group = group;
+	if ((uint32) hashtable->ngroups * 2 > hashtable->mask + 1)
+		vgroup_grow_buckets(hashtable);
+
+	*isnew = true;
+	return group;
+}
+
+/*
+ * Passes 1 to 4 over the active rows of sel.
+ */
+static int
+vgroup_lookup_rows(VTupleHashTable hashtable, vtype **keycols,
+				   vselection *sel, int dim, int *groups, int *newrows)
+{
+	uint32	   *hashes = hashtable->hashes;
+	int		   *candidates = hashtable->candidates;
+	int			nrows = VSEL_NROWS(sel, dim);
+	int			nnew = 0;
+	int			col;
+	int			n;
+	int			i;
+
+	vgroup_hash_batch(hashtable, keycols, sel, dim);
+
+	/* pass 2: the first bucket of the hash of each row */
+	for (n = 0; n < nrows; n++)
+	{
+		uint32		bucket;
+		int			group;
+
+		if (n + VGROUP_PREFETCH_DISTANCE < nrows)
+			vgroup_prefetch(&hashtable->buckets[hashes[VSEL_ROW(sel,
+									n + VGROUP_PREFETCH_DISTANCE)] &
+												hashtable->mask]);
+
+		i = VSEL_ROW(sel, n);
+		bucket = hashes[i] & hashtable->mask;
+		while ((group = hashtable->buckets[bucket].group) >= 0 &&
+			   hashtable->buckets[bucket].hash != hashes[i])
+			bucket = (bucket + 1) & hashtable->mask;
+		candidates[i] = group;
+	}
+
+	/* pass 3: the keys of each row against its candidate */
+	for (col = 0; col < hashtable->numCols; col++)
+	{
+		vtype	   *column = keycols[col];
+
+		VSEL_FOREACH(sel, dim, i,
+		{
+			if (candidates[i] >= 0 &&
+				!vgroup_key_equal(hashtable, col, column, i, candidates[i]))
+				candidates[i] = -1;
+		});
+	}
+
+	/* pass 4: the rest */
+	VSEL_FOREACH(sel, dim, i,
+	{
+		if (candidates[i] < 0)
+		{
+			bool		isnew;
+
+			candidates[i] = vgroup_find_or_add(hashtable, keycols, i, &isnew);
+			if (isnew)
+				newrows[nnew++] = i;
+		}
+		groups[i] = candidates[i];
+	});
+
+	return nnew;
+}
+
+/*
+ * The value of key column col in row i that a direct map codes, false if
+ * it has none.  Values with the same code have the same bits, so they are
+ * equal whatever the type: native values and Datums by value code as
+ * themselves, and varlenas of a single byte, like the values of a char(1),
+ * as that byte.
+ */
+static inline bool
+vgroup_code_value(VTupleHashTable hashtable, int col, vtype *column, int i,
+				  int64 *value)
+{
+	Pointer		ptr;
+
+	if (column->elemlen > 0)
+		*value = vgroup_ivalue(column, i);
+	else if (hashtable->keytypbyval[col])
+		*value = (int64) vtype_getdatum(column, i);
+	else if (hashtable->keytyplen[col] == -1)
+	{
+		ptr = DatumGetPointer(vtype_getdatum(column, i));
+		if (VARATT_IS_EXTENDED(ptr) && !VARATT_IS_SHORT(ptr))
+			return false;
+		if (VARSIZE_ANY_EXHDR(ptr) != 1)
+			return false;
+		*value = (uint8) *VARDATA_ANY(ptr);
+	}
+	else
+		return false;
+	return true;
+}
+
+/*
+ * Set up a direct map from the first batch, if its keys all code to values
+ * in ranges small enough.  Each column takes the range of its first batch,
+ * widened to a whole byte for single byte varlenas when the map stays
+ * small; code 0 of a column is null.  Rows of later batches out of the
+ * ranges are looked up in the hash table only.
+ */
+static void
+vgroup_direct_setup(VTupleHashTable hashtable, vtype **keycols,
+					vselection *sel, int dim)
+{
+	int			numCols = hashtable->numCols;
+	int64	   *lo = palloc(sizeof(int64) * numCols);
+	int64	   *hi = palloc(sizeof(int64) * numCols);
+	bool	   *seen = palloc0(sizeof(bool) * numCols);
+	int64		size = 1;
+	int			col;
+	int			n;
+
+	for (col = 0; col < numCols; col++)
+	{
+		vtype	   *column = keycols[col];
+
+		for (n = 0; n < VSEL_NROWS(sel, dim); n++)
+		{
+			int			i = VSEL_ROW(sel, n);
+			int64		value;
+
+			if (column->hasnull && VTYPE_ISNULL(column, i))
+				continue;
+			if (!vgroup_code_value(hashtable, col, column, i, &value))
+				goto done;
+			if (!seen[col] || value < lo[col])
+				lo[col] = value;
+			if (!seen[col] || value > hi[col])
+				hi[col] = value;
+			seen[col] = true;
+		}
+
+		if (!seen[col])
+			lo[col] = hi[col] = 0;
+		/* range and null, guarding against overflow */
+		if ((uint64) hi[col] - (uint64) lo[col] >= VGROUP_DIRECT_MAX)
+			goto done;
+		size *= hi[col] - lo[col] + 2;
+		if (size > VGROUP_DIRECT_MAX)
+			goto done;
+	}
+
+	for (col = 0; col < numCols; col++)
+	{
+		if (keycols[col]->elemlen == 0 && hashtable->keytyplen[col] == -1 &&
+			size / (hi[col] - lo[col] + 2) * 257 <= VGROUP_DIRECT_MAX)
+		{
+			size = size / (hi[col] - lo[col] + 2) * 257;
+			lo[col] = 0;
+			hi[col] = 255;
+		}
+	}
+
+	hashtable->directlo = MemoryContextAlloc(hashtable->tablecxt,
+											 sizeof(int64) * numCols);
+	hashtable->directspan = MemoryContextAlloc(hashtable->tablecxt,
+											   sizeof(int) * numCols);
+	hashtable->directstride = MemoryContextAlloc(hashtable->tablecxt,
+												 sizeof(int) * numCols);
+	hashtable->directmap = MemoryContextAlloc(hashtable->tablecxt,
+											  sizeof(int) * size);
+	size = 1;
+	for (col = 0; col < numCols; col++)
+	{
+		hashtable->directlo[col] = lo[col];
+		hashtable->directspan[col] = (int) (hi[col] - lo[col] + 1);
+		hashtable->directstride[col] = (int) size;
+		size *= hashtable->directspan[col] + 1;
+	}
+	for (n = 0; n < size; n++)
+		hashtable->directmap[n] = -1;
+
+done:
+	pfree(lo);
+	pfree(hi);
+	pfree(seen);
+}
+
+/*
+ * The code of each active row in codes, -1 for rows out of the ranges.
+ */
+#define VGROUP_CODE_NATIVE(ctype) \
+	do { \
+		const ctype *_v = VTYPE_VALUES(column, ctype); \
+		VSEL_FOREACH(sel, dim, i, \
+		{ \
+			int64		offset = (int64) _v[i] - lo; \
+			int			code = (offset >= 0 && offset < span) ? \
+				(int) offset + 1 : -1; \
+			if (column->hasnull && VTYPE_ISNULL(column, i)) \
+				code = 0; \
+			if (code < 0) \
+				codes[i] = -1; \
+			else if (codes[i] >= 0) \
+				codes[i] += code * stride; \
+		}); \
+	} while (0)
+
+static void
+vgroup_direct_codes(VTupleHashTable hashtable, vtype **keycols,
+					vselection *sel, int dim)
+{
+	int		   *codes = hashtable->codes;
+	int			col;
+	int			i;
+
+	VSEL_FOREACH(sel, dim, i, codes[i] = 0;);
+
+	for (col = 0; col < hashtable->numCols; col++)
+	{
+		vtype	   *column = keycols[col];
+		int64		lo = hashtable->directlo[col];
+		int			span = hashtable->directspan[col];
+		int			stride = hashtable->directstride[col];
+
+		switch (column->elemlen)
+		{
+			case 1:
+				VGROUP_CODE_NATIVE(uint8);
+				break;
+			case 2:
+				VGROUP_CODE_NATIVE(int16);
+				break;
+			case 4:
+				VGROUP_CODE_NATIVE(int32);
+				break;
+			case 8:
+				VGROUP_CODE_NATIVE(int64);
+				break;
+			default:
+				VSEL_FOREACH(sel, dim, i,
+				{
+					int64		value;
+					int			code = -1;
+
+					if (column->hasnull && VTYPE_ISNULL(column, i))
+						code = 0;
+					else if (vgroup_code_value(hashtable, col, column, i,
+											   &value) &&
+							 value - lo >= 0 && value - lo < span)
+						code = (int) (value - lo) + 1;
+					if (code < 0)
+						codes[i] = -1;
+					else if (codes[i] >= 0)
+						codes[i] += code * stride;
+				});
+				break;
+		}
+	}
+}
+
+/*
+ * Find or create the group of every active row of the batch in slot,
+ * whose key columns must have been extracted.  groups[i] is set to the
+ * number of the group of row i.  The rows that made new groups, whose
+ * entries are zeroed, are stored in newrows, and their number returned.
+ *
+ * Once the table is frozen no group is added: the rows of the groups not
+ * in it get -1, and their hash is left in hashtable->hashes.
+ *
+ * With a direct map, the rows whose code maps to a group take it from
+ * there, and only the others go through the hash table, which then maps
+ * their codes.  Once the groups of a small domain have all been seen a
+ * batch costs a loop computing the codes and one reading the map.
+ */
+int
+VLookupTupleHashGroups(VTupleHashTable hashtable, TupleTableSlot *slot,
+					   int *groups, int *newrows)
+{
+	VectorTupleSlot *vslot = (VectorTupleSlot *) slot;
+	vselection *sel = &vslot->sel;
+	int			dim = vslot->dim;
+	vtype	  **keycols;
+	vselection	rest;
+	int		   *codes;
+	int			nnew;
+	int			nout;
+	int			col;
+	int			n;
+	int			i;
+
+	if (dim > hashtable->maxdim)
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(hashtable->tablecxt);
+
+		if (hashtable->hashes != NULL)
+		{
+			pfree(hashtable->hashes);
+			pfree(hashtable->candidates);
+			pfree(hashtable->codes);
+			pfree(hashtable->restrows);
+		}
+		hashtable->hashes = palloc(sizeof(uint32) * dim);
+		hashtable->candidates = palloc(sizeof(int) * dim);
+		hashtable->codes = palloc(sizeof(int) * dim);
+		hashtable->restrows = palloc(sizeof(int) * dim);
+		hashtable->maxdim = dim;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	keycols = palloc(sizeof(vtype *) * hashtable->numCols);
+	for (col = 0; col < hashtable->numCols; col++)
+		keycols[col] = (vtype *)
+			DatumGetPointer(slot->tts_values[hashtable->keyColIdx[col] - 1]);
+
+	if (!hashtable->directtried && VSEL_NROWS(sel, dim) > 0)
+	{
+		hashtable->directtried = true;
+		vgroup_direct_setup(hashtable, keycols, sel, dim);
+	}
+
+	if (hashtable->directmap == NULL)
+	{
+		nnew = vgroup_lookup_rows(hashtable, keycols, sel, dim, groups,
+								  newrows);
+		pfree(keycols);
+		return nnew;
+	}
+
+	codes = hashtable->codes;
+	vgroup_direct_codes(hashtable, keycols, sel, dim);
+
+	rest.dense = false;
+	rest.nrows = 0;
+	rest.rows = hashtable->restrows;
+	nout = 0;
+	VSEL_FOREACH(sel, dim, i,
+	{
+		int			group = codes[i] >= 0 ? hashtable->directmap[codes[i]] : -1;
+
+		if (group >= 0)
+			groups[i] = group;
+		else
+		{
+			rest.rows[rest.nrows++] = i;
+			if (codes[i] < 0)
+				nout++;
+		}
+	});
+
+	/* the ranges of the first batch were not those of the data after all */
+	if (nout * 2 > VSEL_NROWS(sel, dim))
+	{
+		pfree(hashtable->directmap);
+		hashtable->directmap = NULL;
+	}
+
+	nnew = 0;
+	if (rest.nrows > 0)
+	{
+		nnew = vgroup_lookup_rows(hashtable, keycols, &rest, dim, groups,
+								  newrows);
+		for (n = 0; n < rest.nrows; n++)
+		{
+			i = rest.rows[n];
+			if (codes[i] >= 0 && hashtable->directmap != NULL)
+				hashtable->directmap[codes[i]] = groups[i];
+		}
+	}
+
+	pfree(keycols);
+
+	return nnew;
+}
+
+/*
+ * The memory the groups of the table take: their entries and key copies,
+ * and the arrays holding them at their capacity rather than at the number
+ * of groups, with the buckets and the direct map.
+ */
+Size
+VTupleHashTableMemory(VTupleHashTable hashtable)
+{
+	Size		slotsize = sizeof(char *);
+	int			col;
+
+	for (col = 0; col < hashtable->numCols; col++)
+		slotsize += (hashtable->keybitwise[col] ? sizeof(int64) :
+					 sizeof(Datum)) + sizeof(bool);
+
+	return hashtable->groupmem +
+		(Size) hashtable->maxgroups * slotsize +
+		(Size) (hashtable->mask + 1) * sizeof(VTupleHashBucket) +
+		(hashtable->directmap != NULL ?
+		 GetMemoryChunkSpace(hashtable->directmap) : 0);
+}
+
+/*
+ * Set up the finding of the runs of equal keys in the batches of a sorted
+ * input.  The arguments are as for VBuildTupleHashTable; cxt holds the
+ * state and the keys of the last row seen.
+ */
+VTupleRuns
+VBuildTupleRuns(int numCols, AttrNumber *keyColIdx, Oid *keytypes,
+				FmgrInfo *eqfunctions, MemoryContext cxt)
+{
+	VTupleRuns	runs;
+	MemoryContext oldcontext;
+	int			i;
+
+	Assert(numCols > 0);
+
+	oldcontext = MemoryContextSwitchTo(cxt);
+
+	runs = (VTupleRuns) palloc0(sizeof(VTupleRunsData));
+	runs->numCols = numCols;
+	runs->keyColIdx = keyColIdx;
+	runs->eqfunctions = eqfunctions;
+	runs->cxt = cxt;
+
+	runs->keybitwise = palloc(sizeof(bool) * numCols);
+	runs->keytyplen = palloc(sizeof(int16) * numCols);
+	runs->keytypbyval = palloc(sizeof(bool) * numCols);
+	for (i = 0; i < numCols; i++)
+	{
+		runs->keybitwise[i] = vgroup_bitwise_type(keytypes[i]);
+		get_typlenbyval(keytypes[i], &runs->keytyplen[i],
+						&runs->keytypbyval[i]);
+	}
+
+	runs->lastikeys = palloc0(sizeof(int64) * numCols);
+	runs->lastdkeys = palloc0(sizeof(Datum) * numCols);
+	runs->lastnulls = palloc0(sizeof(bool) * numCols);
+	runs->lastcxt = AllocSetContextCreate(cxt,
+										  "VectorAgg last keys",
+										  ALLOCSET_SMALL_SIZES);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return runs;
+}
+
+/* whether key col of rows i and j of column are equal */
+static inline bool
+vgroup_rows_equal(VTupleRuns runs, int col, vtype *column, int i, int j)
+{
+	if (column->hasnull &&
+		(VTYPE_ISNULL(column, i) || VTYPE_ISNULL(column, j)))
+		return VTYPE_ISNULL(column, i) == VTYPE_ISNULL(column, j);
+	if (runs->keybitwise[col])
+		return vgroup_ivalue(column, i) == vgroup_ivalue(column, j);
+	return DatumGetBool(FunctionCall2(&runs->eqfunctions[col],
+									  vtype_getdatum(column, i),
+									  vtype_getdatum(column, j)));
+}
+
+/* whether key col of row i of column equals that of the last row seen */
+static inline bool
+vgroup_last_equal(VTupleRuns runs, int col, vtype *column, int i)
+{
+	bool		isnull = column->hasnull && VTYPE_ISNULL(column, i);
+
+	if (isnull || runs->lastnulls[col])
+		return isnull == runs->lastnulls[col];
+	if (runs->keybitwise[col])
+		return vgroup_ivalue(column, i) == runs->lastikeys[col];
+	return DatumGetBool(FunctionCall2(&runs->eqfunctions[col],
+									  vtype_getdatum(column, i),
+									  runs->lastdkeys[col]));
+}
+
+/*
+ * Mark the active rows whose keys differ from those of the active row
+ * before them, a key column at a time.  Native columns without nulls are
+ * compared in a plain loop over the values; the rows already found to
+ * start a run are not compared again through the equality function.
+ */
+#define VGROUP_BREAKS_NATIVE(ctype) \
+	do { \
+		const ctype *_v = VTYPE_VALUES(column, ctype); \
+		if (dense) \
+		{ \
+			for (n = 1; n < nrows; n++) \
+				breaks[n] |= _v[n] != _v[n - 1]; \
+		} \
+		else \
+		{ \
+			for (n = 1; n < nrows; n++) \
+				breaks[n] |= _v[rows[n]] != _v[rows[n - 1]]; \
+		} \
+	} while (0)
+
+/*
+ * Split the active rows of the batch in slot, whose key columns must have
+ * been extracted, into runs of equal keys.  groups[i] is set to the run of
+ * row i, numbered from 0, and starts[r] to the first row of run r.  The
+ * number of runs is returned, and *continued tells whether the first run
+ * goes on with the last one of the previous batch.
+ */
+int
+VFindTupleRuns(VTupleRuns runs, TupleTableSlot *slot, int *groups,
+			   int *starts, bool *continued)
+{
+	VectorTupleSlot *vslot = (VectorTupleSlot *) slot;
+	vselection *sel = &vslot->sel;
+	int			dim = vslot->dim;
+	int			nrows = VSEL_NROWS(sel, dim);
+	bool		dense = sel->dense;
+	const int  *rows = sel->rows;
+	bool	   *breaks;
+	MemoryContext oldcontext;
+	int			nruns;
+	int			col;
+	int			n;
+	int			i;
+
+	*continued = false;
+	if (nrows == 0)
+		return 0;
+
+	if (nrows > runs->maxdim)
+	{
+		if (runs->breaks != NULL)
+			pfree(runs->breaks);
+		runs->breaks = MemoryContextAlloc(runs->cxt, sizeof(bool) * nrows);
+		runs->maxdim = nrows;
+	}
+	breaks = runs->breaks;
+	memset(breaks, false, sizeof(bool) * nrows);
+	breaks[0] = !runs->haslast;
+
+	for (col = 0; col < runs->numCols; col++)
+	{
+		vtype	   *column = (vtype *)
+			DatumGetPointer(slot->tts_values[runs->keyColIdx[col] - 1]);
+
+		if (!breaks[0] &&
+			!vgroup_last_equal(runs, col, column, VSEL_ROW(sel, 0)))
+			breaks[0] = true;
+
+		if (runs->keybitwise[col] && !column->hasnull)
+		{
+			switch (column->elemlen)
+			{
+				case 1:
+					VGROUP_BREAKS_NATIVE(uint8);
+					continue;
+				case 2:
+					VGROUP_BREAKS_NATIVE(int16);
+					continue;
+				case 4:
+					VGROUP_BREAKS_NATIVE(int32);
+					continue;
+				case 8:
+					VGROUP_BREAKS_NATIVE(int64);
+					continue;
+				default:
+					break;
+			}
+		}
+
+		for (n = 1; n < nrows; n++)
+		{
+			if (!breaks[n] &&
+				!vgroup_rows_equal(runs, col, column,
+								   VSEL_ROW(sel, n - 1), VSEL_ROW(sel, n)))
+				breaks[n] = true;
+		}
+	}
+
+	*continued = !breaks[0];
+	nruns = 0;
+	for (n = 0; n < nrows; n++)
+	{
+		i = VSEL_ROW(sel, n);
+		if (n == 0 || breaks[n])
+			starts[nruns++] = i;
+		groups[i] = nruns - 1;
+	}
+
+	/* the keys of the last row, for the first one of the next batch */
+	MemoryContextReset(runs->lastcxt);
+	oldcontext = MemoryContextSwitchTo(runs->lastcxt);
+	i = VSEL_ROW(sel, nrows - 1);
+	for (col = 0; col < runs->numCols; col++)
+	{
+		vtype	   *column = (vtype *)
+			DatumGetPointer(slot->tts_values[runs->keyColIdx[col] - 1]);
+		bool		isnull = column->hasnull && VTYPE_ISNULL(column, i);
+
+		runs->lastnulls[col] = isnull;
+		if (isnull)
+			continue;
+		if (runs->keybitwise[col])
+			runs->lastikeys[col] = vgroup_ivalue(column, i);
+		else
+			runs->lastdkeys[col] =
+				datumCopy(vtype_getdatum(column, i),
+						  runs->keytypbyval[col], runs->keytyplen[col]);
+	}
+	MemoryContextSwitchTo(oldcontext);
+	runs->haslast = true;
+
+	return nruns;
+}
@@ -0,0 +1,131 @@
+/*-------------------------------------------------------------------------
+ *
+ * execGrouping.h
+ *	  hash tables of groups looked up a batch at a time, and runs of
+ *	  groups of sorted batches
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef VECTOR_ENGINE_EXEC_GROUPING_H
+#define VECTOR_ENGINE_EXEC_GROUPING_H
+
+#include "postgres.h"
+
+#include "executor/tuptable.h"
+#include "fmgr.h"
+
+/* a slot of the table, see VLookupTupleHashGroups */
+typedef struct VTupleHashBucket
+{
+	uint32		hash;
+	int			group;			/* -1 if empty */
+} VTupleHashBucket;
+
+/*
+ * The groups of a vectorized hash aggregate.  Groups are numbered in the
+ * order they are found, and their keys are kept a column at a time, so
+ * that a batch is compared with them a column at a time too.  Each group
+ * has an entry of entrysize bytes, zeroed, for the caller.
+ */
+typedef struct VTupleHashTableData
+{
+	int			numCols;		/* number of columns in lookup key */
+	AttrNumber *keyColIdx;		/* attr numbers of key columns */
+	FmgrInfo   *eqfunctions;	/* lookup data for comparison functions */
+	FmgrInfo   *hashfunctions;	/* lookup data for hash functions */
+	bool	   *keybitwise;		/* compared and hashed as native values */
+	int16	   *keytyplen;
+	bool	   *keytypbyval;
+	Size		entrysize;		/* actual size to make each hash entry */
+	MemoryContext tablecxt;		/* memory context containing table */
+
+	/* the groups, by number */
+	int			ngroups;
+	int			maxgroups;
+	char	  **entries;
+	int64	  **ikeys;			/* per column, the keys of keybitwise ones */
+	Datum	  **dkeys;			/* per column, the keys of the others */
+	bool	  **keynulls;
+	Size		groupmem;		/* space of the entries and key copies */
+
+	/*
+	 * No more groups are added once frozen: the rows of other groups are
+	 * left to the caller, see VLookupTupleHashGroups.
+	 */
+	bool		frozen;
+
+	/* open addressing, kept at most half full */
+	uint32		mask;			/* number of buckets less one */
+	VTupleHashBucket *buckets;
+
+	/*
+	 * A direct map of the groups of small key domains, by the code of their
+	 * keys, see VLookupTupleHashGroups.  NULL if not used.
+	 */
+	bool		directtried;	/* whether to set one up is decided */
+	int		   *directmap;		/* group of each code, or -1 */
+	int64	   *directlo;		/* per column, the value of code 1 */
+	int		   *directspan;		/* per column, how many values code */
+	int		   *directstride;	/* per column, what its code counts for */
+
+	/* work space of a batch, by row */
+	int			maxdim;
+	uint32	   *hashes;
+	int		   *candidates;
+	int		   *codes;
+	int		   *restrows;
+
+	int			scangroup;		/* next group of a scan */
+} VTupleHashTableData;
+
+typedef VTupleHashTableData *VTupleHashTable;
+
+/*
+ * The runs of rows with equal keys in the batches of a sorted input.  The
+ * keys of the last row seen are kept, to tell whether the next batch
+ * starts with a new run.
+ */
+typedef struct VTupleRunsData
+{
+	int			numCols;		/* number of columns in key */
+	AttrNumber *keyColIdx;		/* attr numbers of key columns */
+	FmgrInfo   *eqfunctions;	/* lookup data for comparison functions */
+	bool	   *keybitwise;		/* compared as native values */
+	int16	   *keytyplen;
+	bool	   *keytypbyval;
+	MemoryContext cxt;
+
+	/* the keys of the last row seen */
+	bool		haslast;
+	int64	   *lastikeys;		/* of keybitwise columns */
+	Datum	   *lastdkeys;		/* of the others */
+	bool	   *lastnulls;
+	MemoryContext lastcxt;		/* their pass-by-reference values */
+
+	/* work space of a batch, by position in its selection */
+	int			maxdim;
+	bool	   *breaks;
+} VTupleRunsData;
+
+typedef VTupleRunsData *VTupleRuns;
+
+extern VTupleHashTable VBuildTupleHashTable(int numCols, AttrNumber *keyColIdx,
+											Oid *keytypes,
+											FmgrInfo *eqfunctions,
+											FmgrInfo *hashfunctions,
+											long nbuckets, Size entrysize,
+											MemoryContext tablecxt);
+extern int	VLookupTupleHashGroups(VTupleHashTable hashtable,
+								   TupleTableSlot *slot, int *groups,
+								   int *newrows);
+extern Size VTupleHashTableMemory(VTupleHashTable hashtable);
+
+extern VTupleRuns VBuildTupleRuns(int numCols, AttrNumber *keyColIdx,
+								  Oid *keytypes, FmgrInfo *eqfunctions,
+								  MemoryContext cxt);
+extern int	VFindTupleRuns(VTupleRuns runs, TupleTableSlot *slot, int *groups,
+						   int *starts, bool *continued);
+
+#define VResetTupleHashIterator(hashtable)	((hashtable)->scangroup = 0)
+
+#endif
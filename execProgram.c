@@ -0,0 +1,1169 @@
+/*-------------------------------------------------------------------------
+ *
+ * execProgram.c
+ *	  Compile vectorized expressions into flat programs.
+ *
+ * The expressions left by the vectorizer in plan.c are trees of OpExprs
+ * over Vars and Consts, whose operator functions take and return vtypes.
+ * ExecEvalExpr walks such a tree through an ExprState per node and calls
+ * every operator through fmgr, evaluating its argument list each time.
+ * Per batch that is not much, but it is paid again for every batch, and
+ * batches get short once selective quals have dropped most of the rows.
+ *
+ * Here the tree is turned once, at executor startup, into a sequence of
+ * steps in evaluation order.  A step fetches a column from a slot or calls
+ * a kernel directly through its function pointer, with a call info set up
+ * beforehand: constant arguments are stored in it at compile time, and
+ * the others are copied from the registers of the steps that computed
+ * them.  Evaluation is then a single loop over the steps.
+ *
+ * Expressions with anything else in them are not compiled and are left
+ * to ExecEvalExpr.
+ *
+ * Trees of float8 arithmetic with at least vectorize_fuse_min_ops
+ * operators are not split into a call per operator but become a single
+ * fused step.  It runs the whole tree over a chunk of rows small enough
+ * for its intermediates to stay in L1 cache, so they never take a vtype
+ * of their own.
+ *
+ * A subexpression found in several expressions of a node, like the
+ * discounted price of TPC-H Q1 under two of its aggregates, is computed
+ * once: the programs of a node are compiled with a VExprCSE, and a later
+ * program copies the register of an earlier one instead of recomputing.
+ *
+ * The AND and OR calls plan.c makes of BoolExprs short-circuit per row: a
+ * narrow step between the two arms restricts the selection to the rows the
+ * first arm left undecided, and the second arm is computed for those only.
+ * Its steps are partial, so they are never shared or reused.  The calls of
+ * CASE and COALESCE work the same way: the THEN and ELSE arms of a WHEN
+ * clause are each computed for the rows they are picked for, and the
+ * second argument of COALESCE where the first is null.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "catalog/pg_type.h"
+#include "executor/executor.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/primnodes.h"
+#include "optimizer/clauses.h"
+#include "optimizer/var.h"
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+#include "execProgram.h"
+#include "utils.h"
+#include "vtype/vbool.h"
+#include "vtype/vcase.h"
+
+/* rows a fused step computes at a time */
+#define VFUSE_CHUNK		128
+
+/* fuse float8 arithmetic trees with this many operators, 0 never */
+int			vectorize_fuse_min_ops = 2;
+
+/* the state of compiling one program */
+typedef struct VExprCompiler
+{
+	VExprProgram *prog;
+	int			maxsteps;
+	VExprCSE   *cse;
+	int			narrowdepth;	/* inside the second arm of AND or OR */
+} VExprCompiler;
+
+typedef struct VExprCSEContext
+{
+	List	   *seen;
+	List	   *shared;
+} VExprCSEContext;
+
+static bool VExprCSEWalker(Node *node, VExprCSEContext *context);
+static bool VExprContainsParam(Node *node, void *context);
+static int VExprLookup(VExprCompiler *cc, Expr *node,
+					   VExprProgram **refprog, int *refreg);
+static bool VExprFuseBoundary(VExprCompiler *cc, Expr *node, Expr *root);
+static int VExprCompileNode(VExprCompiler *cc, Expr *node);
+static bool VExprArmMode(PGFunction fn, int argno, VNarrowMode *mode);
+static int VExprCompileArm(VExprCompiler *cc, Expr *arm, int reg,
+						   VNarrowMode mode, int *narrowreg);
+static int VExprAddCall(VExprCompiler *cc, Expr *node, Oid funcid,
+						Oid inputcollid, int nargs, int *argreg,
+						Datum *argval, bool *argnull, int narrowreg);
+static void VExprWiden(VExprStep *steps, int narrowreg);
+static void VExprNarrow(VExprStep *step, Datum *regs);
+static VExprStep *VExprNewStep(VExprCompiler *cc, VExprStepKind kind,
+							   Expr *node);
+static int VExprFuseOpcode(Expr *node);
+static int VExprFuseCount(VExprCompiler *cc, Expr *node, Expr *root,
+						  int *depth);
+static bool VExprFuseNode(VExprCompiler *cc, Expr *node, Expr *root,
+						  VFuseInstr *instrs, int *ninstrs);
+static int VExprCompileFused(VExprCompiler *cc, Expr *node, int nops);
+static Datum VExprEvalFused(VExprStep *step, Datum *regs);
+
+/*
+ * Collect the OpExprs occurring more than once.  A repeated subtree is not
+ * walked again, so what is only ever found inside it is not shared on its
+ * own account.
+ */
+static bool
+VExprCSEWalker(Node *node, VExprCSEContext *context)
+{
+	if (node == NULL)
+		return false;
+
+	if (IsA(node, OpExpr))
+	{
+		if (list_member(context->seen, node))
+		{
+			if (!list_member(context->shared, node))
+				context->shared = lappend(context->shared, node);
+			return false;
+		}
+		context->seen = lappend(context->seen, node);
+	}
+
+	return expression_tree_walker(node, VExprCSEWalker, (void *) context);
+}
+
+/*
+ * VExecInitCSE
+ *
+ *		Set up the sharing of subexpressions between the programs a node
+ *		compiles from 'exprs', a list of expressions or targetlists.
+ *
+ *		The subexpressions found more than once get a step of their own,
+ *		rather than disappearing into a fused step, and every program after
+ *		the first one reads the register of the program that computed it,
+ *		once that one has been published by VExecShareProgram.
+ */
+VExprCSE *
+VExecInitCSE(List *exprs)
+{
+	VExprCSEContext context;
+	VExprCSE   *cse;
+
+	context.seen = NIL;
+	context.shared = NIL;
+	VExprCSEWalker((Node *) exprs, &context);
+	list_free(context.seen);
+
+	cse = palloc0(sizeof(VExprCSE));
+	cse->shared = context.shared;
+	return cse;
+}
+
+/*
+ * VExecShareProgram
+ *
+ *		Make the calls of 'prog' available to the programs compiled after it
+ *		with the same cse.  The caller guarantees that 'prog' runs, for every
+ *		batch, before any of those.
+ */
+void
+VExecShareProgram(VExprCSE *cse, VExprProgram *prog)
+{
+	int			i;
+
+	for (i = 0; i < prog->nsteps; i++)
+	{
+		VExprStep  *step = &prog->steps[i];
+
+		if ((step->kind != VSTEP_CALL && step->kind != VSTEP_FUSED) ||
+			step->partial)
+			continue;
+
+		cse->exprs = lappend(cse->exprs, step->expr);
+		cse->progs = lappend(cse->progs, prog);
+		cse->regs = lappend_int(cse->regs, i);
+	}
+}
+
+/*
+ * Look for a step computing 'node' already.  Returns its register if it
+ * is in the program being compiled, otherwise -1, having set *refprog and
+ * *refreg if a published program computes it.
+ */
+static int
+VExprLookup(VExprCompiler *cc, Expr *node, VExprProgram **refprog,
+			int *refreg)
+{
+	VExprProgram *prog = cc->prog;
+	ListCell   *le;
+	ListCell   *lp;
+	ListCell   *lr;
+	int			i;
+
+	*refprog = NULL;
+
+	for (i = 0; i < prog->nsteps; i++)
+	{
+		if (!prog->steps[i].partial && equal(prog->steps[i].expr, node))
+			return i;
+	}
+
+	forthree(le, cc->cse->exprs, lp, cc->cse->progs, lr, cc->cse->regs)
+	{
+		if (equal(lfirst(le), node))
+		{
+			*refprog = (VExprProgram *) lfirst(lp);
+			*refreg = lfirst_int(lr);
+			break;
+		}
+	}
+
+	return -1;
+}
+
+/* true if 'node' reads a Param */
+static bool
+VExprContainsParam(Node *node, void *context)
+{
+	if (node == NULL)
+		return false;
+	if (IsA(node, Param))
+		return true;
+	return expression_tree_walker(node, VExprContainsParam, context);
+}
+
+/*
+ * VExecFoldConst
+ *
+ *		Evaluate a scalar subexpression without Vars, as the vectorizer
+ *		leaves them, into a Const, in the current memory context.  Returns
+ *		NULL if it is not one: it is vectorized, volatile, or reads a Param,
+ *		whose value may change at rescan and which an initPlan may not have
+ *		computed yet at executor startup.
+ */
+Const *
+VExecFoldConst(Expr *expr)
+{
+	Oid			type = exprType((Node *) expr);
+	ExprContext *econtext;
+	ExprState  *state;
+	MemoryContext oldcontext;
+	Datum		value;
+	bool		isnull;
+	int16		typlen;
+	bool		typbyval;
+
+	if (IsA(expr, Const))
+		return (Const *) expr;
+
+	if (GetNtype(type) != InvalidOid ||
+		contain_var_clause((Node *) expr) ||
+		contain_agg_clause((Node *) expr) ||
+		contain_volatile_functions((Node *) expr) ||
+		expression_returns_set((Node *) expr) ||
+		VExprContainsParam((Node *) expr, NULL))
+		return NULL;
+
+	get_typlenbyval(type, &typlen, &typbyval);
+
+	econtext = CreateStandaloneExprContext();
+	state = ExecInitExpr(expr, NULL);
+	oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+	value = ExecEvalExpr(state, econtext, &isnull, NULL);
+	MemoryContextSwitchTo(oldcontext);
+	if (!isnull)
+		value = datumCopy(value, typbyval, typlen);
+	FreeExprContext(econtext, true);
+
+	return makeConst(type, exprTypmod((Node *) expr),
+					 exprCollation((Node *) expr), typlen,
+					 value, isnull, typbyval);
+}
+
+/*
+ * Add a step at the end of the program.  The steps array may move, so
+ * the step must be filled in before compiling anything else.
+ */
+static VExprStep *
+VExprNewStep(VExprCompiler *cc, VExprStepKind kind, Expr *node)
+{
+	VExprProgram *prog = cc->prog;
+	VExprStep  *step;
+
+	if (prog->nsteps >= cc->maxsteps)
+	{
+		cc->maxsteps *= 2;
+		prog->steps = repalloc(prog->steps, sizeof(VExprStep) * cc->maxsteps);
+	}
+
+	step = &prog->steps[prog->nsteps++];
+	memset(step, 0, sizeof(VExprStep));
+	step->kind = kind;
+	step->expr = node;
+	step->partial = (cc->narrowdepth > 0);
+
+	return step;
+}
+
+/*
+ * The fused opcode of a float8 arithmetic OpExpr of the vectorizer, or -1
+ * if 'node' is something else.
+ */
+static int
+VExprFuseOpcode(Expr *node)
+{
+	OpExpr	   *op = (OpExpr *) node;
+	Oid			vfloat8 = GetVtype(FLOAT8OID);
+	bool		hasvector = false;
+	char	   *opname;
+	ListCell   *lc;
+
+	if (!IsA(node, OpExpr) || list_length(op->args) != 2 ||
+		op->opresulttype != vfloat8)
+		return -1;
+
+	foreach(lc, op->args)
+	{
+		Node	   *arg = (Node *) lfirst(lc);
+
+		if (IsA(arg, Const))
+		{
+			Const	   *con = (Const *) arg;
+
+			/* the constants the kernels cast to float8 */
+			if (con->constisnull ||
+				(con->consttype != FLOAT8OID && con->consttype != FLOAT4OID &&
+				 con->consttype != INT2OID && con->consttype != INT4OID &&
+				 con->consttype != INT8OID))
+				return -1;
+		}
+		else if (exprType(arg) != vfloat8)
+			return -1;
+		else
+			hasvector = true;
+	}
+	if (!hasvector)
+		return -1;
+
+	opname = get_opname(op->opno);
+	if (opname == NULL)
+		return -1;
+	if (strcmp(opname, "+") == 0)
+		return VFUSE_ADD;
+	if (strcmp(opname, "-") == 0)
+		return VFUSE_SUB;
+	if (strcmp(opname, "*") == 0)
+		return VFUSE_MUL;
+	if (strcmp(opname, "/") == 0)
+		return VFUSE_DIV;
+	return -1;
+}
+
+/*
+ * Whether 'node', in the fused tree at 'root', is a leaf of it all the
+ * same: it is not float8 arithmetic, or its vtype is wanted elsewhere.
+ */
+static bool
+VExprFuseBoundary(VExprCompiler *cc, Expr *node, Expr *root)
+{
+	VExprProgram *refprog;
+	int			refreg;
+
+	if (VExprFuseOpcode(node) < 0)
+		return true;
+	if (node == root)
+		return false;
+	if (list_member(cc->cse->shared, node))
+		return true;
+	return VExprLookup(cc, node, &refprog, &refreg) >= 0 || refprog != NULL;
+}
+
+/*
+ * Count the operators of the float8 arithmetic tree at 'node', and set
+ * *depth to the operand stack it needs.  Other subexpressions are leaves
+ * computed by steps of their own.
+ */
+static int
+VExprFuseCount(VExprCompiler *cc, Expr *node, Expr *root, int *depth)
+{
+	OpExpr	   *op = (OpExpr *) node;
+	int			ldepth;
+	int			rdepth;
+	int			nops;
+
+	if (VExprFuseBoundary(cc, node, root))
+	{
+		*depth = 1;
+		return 0;
+	}
+
+	nops = 1 + VExprFuseCount(cc, (Expr *) linitial(op->args), root, &ldepth) +
+		VExprFuseCount(cc, (Expr *) lsecond(op->args), root, &rdepth);
+	*depth = Max(ldepth, rdepth + 1);
+	return nops;
+}
+
+/*
+ * Append the postfix instructions of the float8 arithmetic tree at 'node'
+ * to instrs, compiling its leaves into steps.  False if a leaf cannot be
+ * compiled.
+ */
+static bool
+VExprFuseNode(VExprCompiler *cc, Expr *node, Expr *root,
+			  VFuseInstr *instrs, int *ninstrs)
+{
+	VFuseInstr *instr;
+
+	if (!VExprFuseBoundary(cc, node, root))
+	{
+		OpExpr	   *op = (OpExpr *) node;
+
+		if (!VExprFuseNode(cc, (Expr *) linitial(op->args), root,
+						   instrs, ninstrs) ||
+			!VExprFuseNode(cc, (Expr *) lsecond(op->args), root,
+						   instrs, ninstrs))
+			return false;
+
+		instrs[(*ninstrs)++].opcode = (VFuseOpcode) VExprFuseOpcode(node);
+		return true;
+	}
+
+	instr = &instrs[(*ninstrs)++];
+	if (IsA(node, Const))
+	{
+		Const	   *con = (Const *) node;
+
+		instr->opcode = VFUSE_CONST;
+		switch (con->consttype)
+		{
+			case INT2OID:
+				instr->constval = (float8) DatumGetInt16(con->constvalue);
+				break;
+			case INT4OID:
+				instr->constval = (float8) DatumGetInt32(con->constvalue);
+				break;
+			case INT8OID:
+				instr->constval = (float8) DatumGetInt64(con->constvalue);
+				break;
+			case FLOAT4OID:
+				instr->constval = (float8) DatumGetFloat4(con->constvalue);
+				break;
+			default:
+				instr->constval = DatumGetFloat8(con->constvalue);
+				break;
+		}
+		return true;
+	}
+
+	instr->opcode = VFUSE_REG;
+	instr->reg = VExprCompileNode(cc, node);
+	return instr->reg >= 0;
+}
+
+/*
+ * Compile the float8 arithmetic tree at 'node', of nops operators, into
+ * its leaves and a fused step.  Returns the register of the fused step.
+ */
+static int
+VExprCompileFused(VExprCompiler *cc, Expr *node, int nops)
+{
+	VExprStep  *step;
+	VFuseInstr *instrs;
+	int			ninstrs = 0;
+
+	/* a binary tree of nops operators has nops + 1 leaves */
+	instrs = palloc0(sizeof(VFuseInstr) * (2 * nops + 1));
+	if (!VExprFuseNode(cc, node, node, instrs, &ninstrs))
+		return -1;
+
+	step = VExprNewStep(cc, VSTEP_FUSED, node);
+	step->nfused = ninstrs;
+	step->fused = instrs;
+	step->fusedresult = NULL;
+	step->fusedcxt = CurrentMemoryContext;
+	return cc->prog->nsteps - 1;
+}
+
+/*
+ * Whether argument argno of a call of fn is only needed for some of the
+ * rows of its first argument, and for which.
+ */
+static bool
+VExprArmMode(PGFunction fn, int argno, VNarrowMode *mode)
+{
+	if (fn == vbool_and)
+		*mode = VNARROW_NOT_FALSE;
+	else if (fn == vbool_or)
+		*mode = VNARROW_NOT_TRUE;
+	else if (fn == vtype_case)
+		*mode = (argno == 1) ? VNARROW_TRUE : VNARROW_NOT_TRUE;
+	else if (fn == vtype_coalesce)
+		*mode = VNARROW_NULL;
+	else
+		return false;
+	return true;
+}
+
+/*
+ * Compile 'arm', an argument of a call needed for the rows of register
+ * 'reg' that 'mode' keeps, behind a narrow step to those rows.  The narrow
+ * step ends *narrowreg, that of an earlier arm of the call or -1, and is
+ * set there.  An arm computed already needs no narrow step.
+ */
+static int
+VExprCompileArm(VExprCompiler *cc, Expr *arm, int reg, VNarrowMode mode,
+				int *narrowreg)
+{
+	VExprStep  *narrow;
+	int			stepno;
+	int			armreg;
+
+	narrow = VExprNewStep(cc, VSTEP_NARROW, NULL);
+	narrow->argreg[0] = reg;
+	narrow->narrowmode = mode;
+	narrow->narrowreg = *narrowreg;
+	narrow->narrowcxt = CurrentMemoryContext;
+	stepno = cc->prog->nsteps - 1;
+
+	cc->narrowdepth++;
+	armreg = VExprCompileNode(cc, arm);
+	cc->narrowdepth--;
+
+	if (armreg >= 0 && cc->prog->nsteps == stepno + 1)
+		cc->prog->nsteps--;
+	else
+		*narrowreg = stepno;
+	return armreg;
+}
+
+/*
+ * Add a call of funcid on the registers argreg, or the constants argval
+ * and argnull where argreg is -1, and return its register.  narrowreg is
+ * the narrow step the call ends, -1 if none.
+ */
+static int
+VExprAddCall(VExprCompiler *cc, Expr *node, Oid funcid, Oid inputcollid,
+			 int nargs, int *argreg, Datum *argval, bool *argnull,
+			 int narrowreg)
+{
+	VExprStep  *step;
+	int			i;
+
+	step = VExprNewStep(cc, VSTEP_CALL, node);
+	fmgr_info(funcid, &step->flinfo);
+	fmgr_info_set_expr((Node *) node, &step->flinfo);
+	step->fn = step->flinfo.fn_addr;
+	/* flinfo is linked in once the steps stop moving */
+	InitFunctionCallInfoData(step->fcinfo, NULL, nargs,
+							 inputcollid, NULL, NULL);
+	step->nargs = nargs;
+	for (i = 0; i < nargs; i++)
+	{
+		step->argreg[i] = argreg[i];
+		step->fcinfo.arg[i] = argval[i];
+		step->fcinfo.argnull[i] = (argnull != NULL && argnull[i]);
+	}
+	step->narrowreg = narrowreg;
+	return cc->prog->nsteps - 1;
+}
+
+/*
+ * Append the steps computing 'node' and return the register holding its
+ * result, or -1 if the node cannot be compiled.  A node computed already,
+ * by this program or a published one, is not computed again.
+ */
+static int
+VExprCompileNode(VExprCompiler *cc, Expr *node)
+{
+	VExprStep  *step;
+	VExprProgram *refprog;
+	int			refreg;
+	int			reg;
+
+	reg = VExprLookup(cc, node, &refprog, &refreg);
+	if (reg >= 0)
+		return reg;
+	if (refprog != NULL)
+	{
+		step = VExprNewStep(cc, VSTEP_REF, node);
+		step->refprog = refprog;
+		step->refreg = refreg;
+		return cc->prog->nsteps - 1;
+	}
+
+	switch (nodeTag(node))
+	{
+		case T_Var:
+			{
+				Var		   *var = (Var *) node;
+
+				/* system columns and whole-row references are not in slots */
+				if (var->varattno <= 0 || var->varlevelsup != 0)
+					return -1;
+
+				step = VExprNewStep(cc, VSTEP_VAR, node);
+				step->varno = var->varno;
+				step->attnum = var->varattno;
+				return cc->prog->nsteps - 1;
+			}
+
+		case T_OpExpr:
+			{
+				OpExpr	   *op = (OpExpr *) node;
+				int			argreg[2];
+				Datum		argval[2];
+				bool		hasvector = false;
+				ListCell   *lc;
+				int			i = 0;
+				int			nops;
+				int			depth;
+
+				if (list_length(op->args) != 2 || op->opretset)
+					return -1;
+
+				if (vectorize_fuse_min_ops > 0)
+				{
+					nops = VExprFuseCount(cc, node, node, &depth);
+					if (nops >= vectorize_fuse_min_ops &&
+						depth <= VFUSE_MAXDEPTH)
+						return VExprCompileFused(cc, node, nops);
+				}
+
+				foreach(lc, op->args)
+				{
+					Expr	   *arg = (Expr *) lfirst(lc);
+					Const	   *con = VExecFoldConst(arg);
+
+					if (con != NULL)
+						arg = (Expr *) con;
+
+					if (IsA(arg, Const))
+					{
+						/* strict kernels are never called on nulls */
+						if (((Const *) arg)->constisnull)
+							return -1;
+						argreg[i] = -1;
+						argval[i] = ((Const *) arg)->constvalue;
+					}
+					else
+					{
+						argreg[i] = VExprCompileNode(cc, arg);
+						if (argreg[i] < 0)
+							return -1;
+						argval[i] = (Datum) 0;
+						hasvector = true;
+					}
+					i++;
+				}
+
+				/* on constants only, the operator is a scalar one */
+				if (!hasvector)
+					return -1;
+
+				return VExprAddCall(cc, node, op->opfuncid, op->inputcollid,
+									2, argreg, argval, NULL, -1);
+			}
+
+		case T_FuncExpr:
+			{
+				FuncExpr   *func = (FuncExpr *) node;
+				int			argreg[VEXPR_MAXARGS];
+				Datum		argval[VEXPR_MAXARGS];
+				bool		argnull[VEXPR_MAXARGS];
+				int			narrowreg = -1;
+				int			nargs = list_length(func->args);
+				bool		hasvector = false;
+				FmgrInfo	finfo;
+				VNarrowMode mode;
+				ListCell   *lc;
+				int			i = 0;
+
+				/* the calls of vector functions made by plan.c */
+				if (func->funcretset || nargs < 1 || nargs > VEXPR_MAXARGS ||
+					GetNtype(func->funcresulttype) == InvalidOid)
+					return -1;
+
+				fmgr_info(func->funcid, &finfo);
+				foreach(lc, func->args)
+				{
+					Expr	   *arg = (Expr *) lfirst(lc);
+					Const	   *con = VExecFoldConst(arg);
+
+					argval[i] = (Datum) 0;
+					argnull[i] = false;
+					if (con != NULL)
+					{
+						/* the scalar arguments of CASE and COALESCE */
+						if (con->constisnull && finfo.fn_strict)
+							return -1;
+						argreg[i] = -1;
+						argval[i] = con->constvalue;
+						argnull[i] = con->constisnull;
+						i++;
+						continue;
+					}
+
+					/*
+					 * The arms of AND, OR, CASE and COALESCE are only run on
+					 * the rows they decide.
+					 */
+					if (i > 0 && argreg[0] >= 0 &&
+						VExprArmMode(finfo.fn_addr, i, &mode))
+						argreg[i] = VExprCompileArm(cc, arg, argreg[0], mode,
+													&narrowreg);
+					else
+						argreg[i] = VExprCompileNode(cc, arg);
+					if (argreg[i] < 0)
+						return -1;
+					hasvector = true;
+					i++;
+				}
+
+				if (!hasvector)
+					return -1;
+
+				return VExprAddCall(cc, node, func->funcid, func->inputcollid,
+									nargs, argreg, argval, argnull, narrowreg);
+			}
+
+		default:
+			return -1;
+	}
+}
+
+/*
+ * VExecCompileExprs
+ *
+ *		Compile a list of vectorized expressions into one program, in the
+ *		current memory context, computing their common subexpressions once.
+ *		With a cse, the subexpressions of programs published into it are
+ *		not computed again either.  Returns NULL if an expression contains
+ *		a node a program cannot express.
+ */
+VExprProgram *
+VExecCompileExprs(List *exprs, VExprCSE *cse)
+{
+	VExprCompiler cc;
+	VExprProgram *prog;
+	ListCell   *lc;
+	int			i;
+
+	prog = palloc0(sizeof(VExprProgram));
+	prog->steps = palloc(sizeof(VExprStep) * 8);
+	prog->nresults = list_length(exprs);
+	prog->results = palloc(sizeof(int) * Max(prog->nresults, 1));
+
+	cc.prog = prog;
+	cc.maxsteps = 8;
+	cc.narrowdepth = 0;
+	cc.cse = cse != NULL ? cse : VExecInitCSE(exprs);
+
+	i = 0;
+	foreach(lc, exprs)
+	{
+		Expr	   *expr = (Expr *) lfirst(lc);
+
+		if (expr != NULL)
+			prog->results[i] = VExprCompileNode(&cc, expr);
+		if (expr == NULL || prog->results[i] < 0)
+		{
+			pfree(prog->results);
+			pfree(prog->steps);
+			pfree(prog);
+			return NULL;
+		}
+		i++;
+	}
+
+	for (i = 0; i < prog->nsteps; i++)
+	{
+		if (prog->steps[i].kind == VSTEP_CALL)
+			prog->steps[i].fcinfo.flinfo = &prog->steps[i].flinfo;
+	}
+	prog->regs = palloc0(sizeof(Datum) * Max(prog->nsteps, 1));
+
+	return prog;
+}
+
+/*
+ * VExecCompileExpr
+ *
+ *		VExecCompileExprs of a single expression.
+ */
+VExprProgram *
+VExecCompileExpr(Expr *expr, VExprCSE *cse)
+{
+	return VExecCompileExprs(list_make1(expr), cse);
+}
+
+/*
+ * The operation of a fused step over a chunk of n rows, whose operands
+ * are either arrays or a constant.
+ */
+#define VFUSE_APPLY(opsym, out, a, b, n) \
+	do { \
+		int			_j; \
+		if ((a)->isconst) \
+			for (_j = 0; _j < (n); _j++) \
+				(out)[_j] = (a)->c opsym (b)->p[_j]; \
+		else if ((b)->isconst) \
+			for (_j = 0; _j < (n); _j++) \
+				(out)[_j] = (a)->p[_j] opsym (b)->c; \
+		else \
+			for (_j = 0; _j < (n); _j++) \
+				(out)[_j] = (a)->p[_j] opsym (b)->p[_j]; \
+	} while (0)
+
+typedef struct VFuseOperand
+{
+	const float8 *p;			/* the chunk of rows, unless isconst */
+	float8		c;
+	bool		isconst;
+} VFuseOperand;
+
+/*
+ * Run a fused step.  The instructions are run over a chunk of rows at a
+ * time, with the intermediates in chunk sized buffers on the stack, and
+ * the last one writes straight into the result.  All the rows of the
+ * batch are computed, including inactive and null ones: float8 arithmetic
+ * raises no error, and a dense loop is faster than following the
+ * selection.  A row is null if any of the leaves is.
+ */
+static Datum
+VExprEvalFused(VExprStep *step, Datum *regs)
+{
+	VFuseOperand stack[VFUSE_MAXDEPTH];
+	float8		tmp[VFUSE_MAXDEPTH][VFUSE_CHUNK];
+	vtype	   *res = step->fusedresult;
+	vtype	   *first = NULL;
+	float8	   *rv;
+	int			dim;
+	int			base;
+	int			k;
+	int			w;
+
+	for (k = 0; k < step->nfused; k++)
+	{
+		if (step->fused[k].opcode == VFUSE_REG)
+		{
+			first = (vtype *) DatumGetPointer(regs[step->fused[k].reg]);
+			break;
+		}
+	}
+	Assert(first != NULL);
+	dim = first->dim;
+
+	if (res == NULL || res->maxdim < dim)
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(step->fusedcxt);
+
+		if (res != NULL)
+			pfree(res);
+		res = buildvtype(FLOAT8OID, dim, first->selref);
+		step->fusedresult = res;
+		MemoryContextSwitchTo(oldcontext);
+	}
+	else
+		vtype_clearnulls(res, res->maxdim);
+	res->dim = dim;
+	res->selref = first->selref;
+
+	for (k = 0; k < step->nfused; k++)
+	{
+		vtype	   *leaf;
+
+		if (step->fused[k].opcode != VFUSE_REG)
+			continue;
+		leaf = (vtype *) DatumGetPointer(regs[step->fused[k].reg]);
+		if (!leaf->hasnull)
+			continue;
+		for (w = 0; w < VTYPE_NULLWORDS(dim); w++)
+			res->nulls[w] |= leaf->nulls[w];
+		res->hasnull = true;
+	}
+
+	rv = VTYPE_VALUES(res, float8);
+	for (base = 0; base < dim; base += VFUSE_CHUNK)
+	{
+		int			n = Min(VFUSE_CHUNK, dim - base);
+		int			sp = 0;
+
+		for (k = 0; k < step->nfused; k++)
+		{
+			VFuseInstr *instr = &step->fused[k];
+			VFuseOperand *a;
+			VFuseOperand *b;
+			float8	   *out;
+
+			switch (instr->opcode)
+			{
+				case VFUSE_REG:
+					stack[sp].p = VTYPE_VALUES((vtype *) DatumGetPointer(regs[instr->reg]),
+											   float8) + base;
+					stack[sp].isconst = false;
+					sp++;
+					continue;
+				case VFUSE_CONST:
+					stack[sp].c = instr->constval;
+					stack[sp].isconst = true;
+					sp++;
+					continue;
+				default:
+					break;
+			}
+
+			a = &stack[sp - 2];
+			b = &stack[sp - 1];
+			out = (k == step->nfused - 1) ? rv + base : tmp[sp - 2];
+			switch (instr->opcode)
+			{
+				case VFUSE_ADD:
+					VFUSE_APPLY(+, out, a, b, n);
+					break;
+				case VFUSE_SUB:
+					VFUSE_APPLY(-, out, a, b, n);
+					break;
+				case VFUSE_MUL:
+					VFUSE_APPLY(*, out, a, b, n);
+					break;
+				case VFUSE_DIV:
+					VFUSE_APPLY(/, out, a, b, n);
+					break;
+				default:
+					elog(ERROR, "unrecognized fused opcode: %d",
+						 (int) instr->opcode);
+			}
+			a->p = out;
+			a->isconst = false;
+			sp--;
+		}
+	}
+
+	return PointerGetDatum(res);
+}
+
+/*
+ * End the narrow step narrowreg, if any: put back the selection it
+ * narrowed.
+ */
+static void
+VExprWiden(VExprStep *steps, int narrowreg)
+{
+	VExprStep  *narrow;
+
+	if (narrowreg < 0)
+		return;
+	narrow = &steps[narrowreg];
+	if (narrow->narrowed != NULL)
+		*narrow->narrowed = narrow->narrowsaved;
+}
+
+/* add the rows for which keep holds to narrowrows */
+#define VNARROW_ROWS(keep) \
+	VSEL_FOREACH(sel, arg->dim, i, \
+	{ \
+		bool		isnull = arg->hasnull && VTYPE_ISNULL(arg, i); \
+		\
+		if (keep) \
+			step->narrowrows[n++] = i; \
+	})
+
+/*
+ * Run a narrow step: restrict the selection of its argument to the rows
+ * its mode keeps, until the step ending it puts it back.  The steps in
+ * between see the batch through that selection, so the arm they compute
+ * is only computed for these rows.  Without a selection, every row stays.
+ */
+static void
+VExprNarrow(VExprStep *step, Datum *regs)
+{
+	vtype	   *arg = (vtype *) DatumGetPointer(regs[step->argreg[0]]);
+	vselection *sel = arg->selref;
+	bool	   *values = VTYPE_VALUES(arg, bool);
+	int			n = 0;
+	int			i;
+
+	step->narrowed = sel;
+	if (sel == NULL)
+		return;
+	step->narrowsaved = *sel;
+
+	if (step->narrowrows == NULL || step->narrowmax < arg->dim)
+	{
+		if (step->narrowrows != NULL)
+			pfree(step->narrowrows);
+		step->narrowrows = MemoryContextAlloc(step->narrowcxt,
+											  sizeof(int) * arg->dim);
+		step->narrowmax = arg->dim;
+	}
+
+	switch (step->narrowmode)
+	{
+		case VNARROW_NOT_FALSE:
+			VNARROW_ROWS(isnull || values[i]);
+			break;
+		case VNARROW_NOT_TRUE:
+			VNARROW_ROWS(isnull || !values[i]);
+			break;
+		case VNARROW_TRUE:
+			VNARROW_ROWS(!isnull && values[i]);
+			break;
+		case VNARROW_NULL:
+			VNARROW_ROWS(isnull);
+			break;
+	}
+
+	sel->dense = false;
+	sel->nrows = n;
+	sel->rows = step->narrowrows;
+}
+
+/*
+ * VExecRunProgram
+ *
+ *		Run a program on the slots of econtext, leaving the vtypes of its
+ *		expressions in its registers.  The columns it reads must have been
+ *		materialized.
+ */
+void
+VExecRunProgram(VExprProgram *prog, ExprContext *econtext)
+{
+	VExprStep  *step = prog->steps;
+	Datum	   *regs = prog->regs;
+	int			i;
+	int			a;
+
+	for (i = 0; i < prog->nsteps; i++, step++)
+	{
+		switch (step->kind)
+		{
+			case VSTEP_VAR:
+				{
+					TupleTableSlot *slot;
+
+					switch (step->varno)
+					{
+						case INNER_VAR:
+							slot = econtext->ecxt_innertuple;
+							break;
+						case OUTER_VAR:
+							slot = econtext->ecxt_outertuple;
+							break;
+						default:
+							slot = econtext->ecxt_scantuple;
+							break;
+					}
+					regs[i] = slot->tts_values[step->attnum - 1];
+					break;
+				}
+
+			case VSTEP_CALL:
+				{
+					FunctionCallInfo fcinfo = &step->fcinfo;
+
+					/* back to the rows of before the narrow step */
+					VExprWiden(prog->steps, step->narrowreg);
+
+					for (a = 0; a < step->nargs; a++)
+					{
+						if (step->argreg[a] >= 0)
+							fcinfo->arg[a] = regs[step->argreg[a]];
+					}
+					fcinfo->isnull = false;
+					regs[i] = step->fn(fcinfo);
+					break;
+				}
+
+			case VSTEP_FUSED:
+				regs[i] = VExprEvalFused(step, regs);
+				break;
+
+			case VSTEP_REF:
+				regs[i] = step->refprog->regs[step->refreg];
+				break;
+
+			case VSTEP_NARROW:
+				VExprWiden(prog->steps, step->narrowreg);
+				VExprNarrow(step, regs);
+				regs[i] = (Datum) 0;
+				break;
+		}
+	}
+}
+
+/*
+ * VExecEvalProgram
+ *
+ *		Run a program of a single expression and return its vtype.
+ */
+Datum
+VExecEvalProgram(VExprProgram *prog, ExprContext *econtext)
+{
+	VExecRunProgram(prog, econtext);
+	return VEXPR_RESULT(prog, 0);
+}
+
+/*
+ * VExecBuildProjection
+ *
+ *		Compile a targetlist into a program, to be projected into 'slot' by
+ *		VExecProjectPrograms.  Returns NULL unless all of its entries
+ *		compile, the caller then keeps to ExecProject.
+ */
+VExprProjection *
+VExecBuildProjection(List *targetList, ExprContext *econtext,
+					 TupleTableSlot *slot, VExprCSE *cse)
+{
+	VExprProjection *proj;
+	Expr	  **byresno;
+	List	   *exprs = NIL;
+	ListCell   *lc;
+	int			nexprs = list_length(targetList);
+	int			i;
+
+	byresno = palloc0(sizeof(Expr *) * Max(nexprs, 1));
+	foreach(lc, targetList)
+	{
+		TargetEntry *tle = (TargetEntry *) lfirst(lc);
+
+		Assert(IsA(tle, TargetEntry));
+		if (tle->resno < 1 || tle->resno > nexprs)
+			return NULL;
+		byresno[tle->resno - 1] = tle->expr;
+	}
+	for (i = 0; i < nexprs; i++)
+		exprs = lappend(exprs, byresno[i]);
+
+	proj = palloc0(sizeof(VExprProjection));
+	proj->prog = VExecCompileExprs(exprs, cse);
+	if (proj->prog == NULL)
+		return NULL;
+	proj->econtext = econtext;
+	proj->slot = slot;
+
+	return proj;
+}
+
+/*
+ * VExecProjectPrograms
+ *
+ *		The ExecProject of a compiled targetlist.
+ */
+TupleTableSlot *
+VExecProjectPrograms(VExprProjection *proj)
+{
+	ExprContext *econtext = proj->econtext;
+	TupleTableSlot *slot = proj->slot;
+	MemoryContext oldContext;
+	int			i;
+
+	ExecClearTuple(slot);
+
+	oldContext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+	VExecRunProgram(proj->prog, econtext);
+	for (i = 0; i < proj->prog->nresults; i++)
+	{
+		slot->tts_values[i] = VEXPR_RESULT(proj->prog, i);
+		slot->tts_isnull[i] = false;
+	}
+	MemoryContextSwitchTo(oldContext);
+
+	return ExecStoreVirtualTuple(slot);
+}
@@ -0,0 +1,162 @@
+/*-------------------------------------------------------------------------
+ *
+ * execProgram.h
+ *	  vectorized expressions compiled into flat programs
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef VECTOR_ENGINE_EXEC_PROGRAM_H
+#define VECTOR_ENGINE_EXEC_PROGRAM_H
+
+#include "postgres.h"
+
+#include "fmgr.h"
+#include "nodes/execnodes.h"
+
+#include "vtype/vtype.h"
+
+typedef enum VExprStepKind
+{
+	VSTEP_VAR,					/* fetch a column of a slot */
+	VSTEP_CALL,					/* call a vectorized operator function */
+	VSTEP_FUSED,				/* float8 arithmetic in one loop */
+	VSTEP_REF,					/* the register of another program */
+	VSTEP_NARROW				/* skip the rows an argument does not need */
+} VExprStepKind;
+
+/* the rows a narrow step keeps, by the value of its argument */
+typedef enum VNarrowMode
+{
+	VNARROW_NOT_FALSE,			/* second arm of AND */
+	VNARROW_NOT_TRUE,			/* second arm of OR, ELSE of CASE */
+	VNARROW_TRUE,				/* THEN of CASE */
+	VNARROW_NULL				/* second argument of COALESCE */
+} VNarrowMode;
+
+typedef enum VFuseOpcode
+{
+	VFUSE_REG,					/* push a register */
+	VFUSE_CONST,				/* push a constant */
+	VFUSE_ADD,
+	VFUSE_SUB,
+	VFUSE_MUL,
+	VFUSE_DIV
+} VFuseOpcode;
+
+/*
+ * An instruction of a fused step, which is a postfix program run a chunk
+ * of rows at a time, see VExprEvalFused.
+ */
+typedef struct VFuseInstr
+{
+	VFuseOpcode opcode;
+	int			reg;			/* VFUSE_REG */
+	float8		constval;		/* VFUSE_CONST */
+} VFuseInstr;
+
+/* the deepest operand stack of a fused step */
+#define VFUSE_MAXDEPTH	8
+
+/* the most arguments of a call */
+#define VEXPR_MAXARGS	3
+
+/*
+ * One step of a program.  Step i leaves its vtype in register i; the
+ * arguments of a call are registers of earlier steps or constants, which
+ * are preloaded in fcinfo once and for all.
+ */
+typedef struct VExprStep
+{
+	VExprStepKind kind;
+	Expr	   *expr;			/* what the step computes */
+	bool		partial;		/* only for the rows of a narrow step */
+
+	/* VSTEP_VAR */
+	Index		varno;			/* INNER_VAR, OUTER_VAR or the scan */
+	AttrNumber	attnum;
+
+	/* VSTEP_CALL */
+	PGFunction	fn;				/* kernel, called without fmgr */
+	FmgrInfo	flinfo;
+	FunctionCallInfoData fcinfo;
+	int			nargs;
+	int			argreg[VEXPR_MAXARGS];	/* register of each argument, -1 if
+										 * const */
+	int			narrowreg;		/* the narrow step it ends, or -1 */
+
+	/* VSTEP_FUSED */
+	int			nfused;
+	VFuseInstr *fused;
+	vtype	   *fusedresult;	/* reused for every batch */
+	MemoryContext fusedcxt;		/* where fusedresult is allocated */
+
+	/* VSTEP_REF */
+	struct VExprProgram *refprog;	/* run before this one */
+	int			refreg;
+
+	/*
+	 * VSTEP_NARROW, of the argument in argreg[0].  It ends the narrow step
+	 * in narrowreg, if any, before narrowing again.
+	 */
+	VNarrowMode narrowmode;
+	vselection *narrowed;		/* the selection narrowed, NULL if none */
+	vselection	narrowsaved;	/* what it was before */
+	int		   *narrowrows;
+	int			narrowmax;
+	MemoryContext narrowcxt;	/* where narrowrows is allocated */
+} VExprStep;
+
+/*
+ * One or more vectorized expressions as a linear sequence of steps.  The
+ * result of expression n is in register results[n].
+ */
+typedef struct VExprProgram
+{
+	int			nsteps;
+	VExprStep  *steps;
+	Datum	   *regs;			/* one per step */
+	int			nresults;
+	int		   *results;
+} VExprProgram;
+
+#define VEXPR_RESULT(prog, n)	((prog)->regs[(prog)->results[(n)]])
+
+/*
+ * The subexpressions a set of programs compiled by the same node may
+ * share, see VExecInitCSE.
+ */
+typedef struct VExprCSE
+{
+	List	   *shared;			/* OpExprs found more than once */
+	List	   *exprs;			/* computed by a published program ... */
+	List	   *progs;			/* ... this one ... */
+	List	   *regs;			/* ... in this register */
+} VExprCSE;
+
+/*
+ * A targetlist whose entries all compiled, evaluated into slot.  Result n
+ * of the program is the column of resno n + 1.
+ */
+typedef struct VExprProjection
+{
+	VExprProgram *prog;
+	ExprContext *econtext;
+	TupleTableSlot *slot;
+} VExprProjection;
+
+extern int vectorize_fuse_min_ops;
+
+extern Const *VExecFoldConst(Expr *expr);
+extern VExprCSE *VExecInitCSE(List *exprs);
+extern void VExecShareProgram(VExprCSE *cse, VExprProgram *prog);
+extern VExprProgram *VExecCompileExprs(List *exprs, VExprCSE *cse);
+extern VExprProgram *VExecCompileExpr(Expr *expr, VExprCSE *cse);
+extern void VExecRunProgram(VExprProgram *prog, ExprContext *econtext);
+extern Datum VExecEvalProgram(VExprProgram *prog, ExprContext *econtext);
+extern VExprProjection *VExecBuildProjection(List *targetList,
+											 ExprContext *econtext,
+											 TupleTableSlot *slot,
+											 VExprCSE *cse);
+extern TupleTableSlot *VExecProjectPrograms(VExprProjection *proj);
+
+#endif
@@ -23,6 +23,7 @@
 #include "utils/xml.h"
 
 #include "executor.h"
+#include "execProgram.h"
 #include "execTuples.h"
 #include "vectorTupleSlot.h"
 
@@ -52,23 +53,21 @@
  *	is being evaluated and we know that NULL can be treated the same
  *	as one boolean result or the other.
  *
+ *	The clauses are VectorScanClauses, each with the columns of the scan
+ *	slot it reads, which are materialized from the batch right before it
+ *	runs, and possibly a program to run it instead of ExecEvalExpr.  Each
+ *	clause only looks at the rows the clauses before it kept, and the
+ *	batch is given up as soon as none is left.  The list is reordered by
+ *	what was observed of the clauses on the batch, see VExecOrderClauses.
  * ----------------------------------------------------------------
  */
 bool
-VExecScanQual(List *qual, ExprContext *econtext, bool resultForNull)
+VExecScanQual(List *clauses, ExprContext *econtext, bool resultForNull)
 {
 	MemoryContext	oldContext;
 	TupleTableSlot	*slot;
 	VectorTupleSlot	*vslot;
 	ListCell		*l;
-	int				row;
-
-	/*
-	 * debugging stuff
-	 */
-	EV_printf("ExecQual: qual is ");
-	EV_nodeDisplay(qual);
-	EV_printf("\n");
 
 	/*
 	 * Run in short-lived per-tuple context while computing expressions.
@@ -90,34 +89,146 @@ VExecScanQual(List *qual, ExprContext *econtext, bool resultForNull)
 
 	slot = econtext->ecxt_scantuple;
 	vslot = (VectorTupleSlot *)slot;
-	foreach(l, qual)
+	foreach(l, clauses)
 	{
-		ExprState  *clause = (ExprState *) lfirst(l);
+		VectorScanClause *clause = (VectorScanClause *) lfirst(l);
 		Datum		expr_value;
 		bool		isNull;
 		vbool		*expr_val_bools;
+		instr_time	start;
+		int			rowsin = vslot->sel.nrows;
+		int			rowsout;
+
+		INSTR_TIME_SET_CURRENT(start);
+
+		/*
+		 * deform the columns of this clause, rows dropped by the clauses
+		 * before are left out.
+		 */
+		Vslot_getattrs(slot, clause->attrs);
 
 		/* take a batch as input to evaluate quals */
-		expr_value = ExecEvalExpr(clause, econtext, &isNull, NULL);
+		if (clause->prog != NULL)
+			expr_value = VExecEvalProgram(clause->prog, econtext);
+		else
+			expr_value = ExecEvalExpr(clause->clause, econtext, &isNull, NULL);
 		
 		expr_val_bools = (vbool *)DatumGetPointer(expr_value);
 		
-		/* using skip array to indicated row which didn't pass the qual */
-		for(row = 0; row < BATCHSIZE; row++)
-			if((!expr_val_bools->isnull[row] || !resultForNull) && 
-				!DatumGetBool(expr_val_bools->values[row]) &&
-				!vslot->skip[row])
-				vslot->skip[row] = true;
-		/* TODO: opt: add skipped count for vslot to support skipping the whole batch?*/
+		/*
+		 * drop the rows which didn't pass the qual, the next clauses are
+		 * only evaluated on the rows left.
+		 */
+		rowsout = Vslot_applyfilter(slot, expr_val_bools, resultForNull);
+		VExecCountClause(&clause->stats, rowsin, rowsout, &start);
+		if (rowsout == 0)
+			break;
 	}
 
 	MemoryContextSwitchTo(oldContext);
 
+	VExecOrderClauses(clauses);
+
 	/* return true if any tuple in batch pass the qual. */
-	for(row = 0; row < BATCHSIZE; row++)
-		if (!vslot->skip[row])
-			return true;
+	return vslot->sel.nrows > 0;
+}
+
+/* weight of the latest batch in the averages of VectorQualStats */
+#define VQUAL_SMOOTHING		0.1
 
-	return false;
+/*
+ * VExecCountClause
+ *
+ *		Account for a run of a clause, begun at *start, that kept rowsout
+ *		of rowsin active rows.  The averages lean towards recent batches,
+ *		so that the order follows the data as the scan moves on.
+ */
+void
+VExecCountClause(VectorQualStats *stats, int rowsin, int rowsout,
+				 instr_time *start)
+{
+	instr_time	elapsed;
+	double		selectivity;
+	double		rowcost;
+
+	if (rowsin <= 0)
+		return;
+
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, *start);
+	selectivity = (double) rowsout / rowsin;
+	rowcost = INSTR_TIME_GET_MICROSEC(elapsed) / rowsin;
+
+	if (stats->nbatches++ == 0)
+	{
+		stats->selectivity = selectivity;
+		stats->rowcost = rowcost;
+	}
+	else
+	{
+		stats->selectivity += (selectivity - stats->selectivity) * VQUAL_SMOOTHING;
+		stats->rowcost += (rowcost - stats->rowcost) * VQUAL_SMOOTHING;
+	}
+}
+
+/*
+ * Whether clause a should run before clause b: it costs less per row it
+ * drops.  Clauses that were never run cost nothing yet, so they move to
+ * the front and get measured.
+ */
+static bool
+VExecClauseBefore(VectorQualStats *a, VectorQualStats *b)
+{
+	return a->rowcost * (1.0 - b->selectivity) <
+		b->rowcost * (1.0 - a->selectivity);
 }
 
+/*
+ * VExecOrderClauses
+ *
+ *		Sort a list of clauses, VectorScanFilters or VectorScanClauses, in
+ *		place by their stats.  The order of a conjunction does not change
+ *		its result, but may change whether it raises an error: a clause
+ *		that may raise one, as "b / a > 1" after "a <> 0", is never moved
+ *		ahead of the clauses before it.  The sort is stable so that
+ *		clauses of equal rank keep the planner's order.
+ */
+void
+VExecOrderClauses(List *clauses)
+{
+	ListCell   *l;
+	ListCell   *prev = NULL;
+
+	/* an insertion sort, the lists are short and mostly sorted already */
+	foreach(l, clauses)
+	{
+		void	   *clause = lfirst(l);
+		ListCell   *m;
+		ListCell   *at = NULL;
+
+		if (prev != NULL && !((VectorQualStats *) clause)->fixed &&
+			VExecClauseBefore((VectorQualStats *) clause,
+							  (VectorQualStats *) lfirst(prev)))
+		{
+			/* find where it goes and shift the ones after it down */
+			foreach(m, clauses)
+			{
+				if (VExecClauseBefore((VectorQualStats *) clause,
+									  (VectorQualStats *) lfirst(m)))
+				{
+					at = m;
+					break;
+				}
+			}
+			for (m = at; m != l; m = lnext(m))
+			{
+				void	   *tmp = lfirst(m);
+
+				lfirst(m) = clause;
+				clause = tmp;
+			}
+			lfirst(l) = clause;
+		}
+		prev = l;
+	}
+}
@@ -211,7 +211,7 @@ VExecScan(VectorScanState *vss,
 		 * when the qual is nil ... saves only a few cycles, but they add up
 		 * ...
 		 */
-		if (!qual || VExecScanQual(qual, econtext, false))
+		if (!qual || VExecScanQual(vss->clauses, econtext, false))
 		{
 			/*
 			 * Found a satisfactory scan tuple.
@@ -223,8 +223,15 @@ VExecScan(VectorScanState *vss,
 				 * and return it --- unless we find we can project no tuples
 				 * from this scan tuple, in which case continue scan.
 				 */
-				resultSlot = ExecProject(projInfo, &isDone);
-				memcpy(((VectorTupleSlot*)resultSlot)->skip, ((VectorTupleSlot*)slot)->skip, sizeof(bool) * BATCHSIZE);
+				Vslot_getattrs(slot, vss->projattrs);
+				if (vss->projection)
+				{
+					resultSlot = VExecProjectPrograms(vss->projection);
+					isDone = ExprSingleResult;
+				}
+				else
+					resultSlot = ExecProject(projInfo, &isDone);
+				Vslot_copyselection(resultSlot, slot);
 				if (isDone != ExprEndResult)
 				{
 					node->ps.ps_TupFromTlist = (isDone == ExprMultipleResult);
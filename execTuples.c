@@ -105,9 +105,10 @@ static void VExecAssignResultType(PlanState *planstate, TupleDesc tupDesc);
  * ----------------
  */
 void
-VExecInitResultTupleSlot(EState *estate, PlanState *planstate)
+VExecInitResultTupleSlot(EState *estate, PlanState *planstate, int batchsize)
 {
-	planstate->ps_ResultTupleSlot = VExecAllocTableSlot(&estate->es_tupleTable);
+	planstate->ps_ResultTupleSlot = VExecAllocTableSlot(&estate->es_tupleTable,
+														batchsize);
 }
 
 /* ----------------
@@ -115,9 +116,10 @@ VExecInitResultTupleSlot(EState *estate, PlanState *planstate)
  * ----------------
  */
 void
-VExecInitScanTupleSlot(EState *estate, ScanState *scanstate)
+VExecInitScanTupleSlot(EState *estate, ScanState *scanstate, int batchsize)
 {
-	scanstate->ss_ScanTupleSlot = VExecAllocTableSlot(&estate->es_tupleTable);
+	scanstate->ss_ScanTupleSlot = VExecAllocTableSlot(&estate->es_tupleTable,
+													  batchsize);
 }
 
 /* ----------------
@@ -125,9 +127,9 @@ VExecInitScanTupleSlot(EState *estate, ScanState *scanstate)
  * ----------------
  */
 TupleTableSlot *
-VExecInitExtraTupleSlot(EState *estate)
+VExecInitExtraTupleSlot(EState *estate, int batchsize)
 {
-	return VExecAllocTableSlot(&estate->es_tupleTable);
+	return VExecAllocTableSlot(&estate->es_tupleTable, batchsize);
 }
 
 
@@ -12,8 +12,10 @@
 /*
  * prototypes from functions in execTuples.c
  */
-extern void VExecInitResultTupleSlot(EState *estate, PlanState *planstate);
-extern void VExecInitScanTupleSlot(EState *estate, ScanState *scanstate);
-extern TupleTableSlot *VExecInitExtraTupleSlot(EState *estate);
+extern void VExecInitResultTupleSlot(EState *estate, PlanState *planstate,
+									 int batchsize);
+extern void VExecInitScanTupleSlot(EState *estate, ScanState *scanstate,
+								   int batchsize);
+extern TupleTableSlot *VExecInitExtraTupleSlot(EState *estate, int batchsize);
 extern void VExecAssignResultTypeFromTL(PlanState *planstate);
 #endif
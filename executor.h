@@ -3,11 +3,16 @@
 
 #include "postgres.h"
 #include "executor/execdesc.h"
+#include "portability/instr_time.h"
 #include "nodes/parsenodes.h"
 
 #include "nodeSeqscan.h"
 
-extern bool VExecScanQual(List *qual, ExprContext *econtext, bool resultForNull);
+extern bool VExecScanQual(List *clauses, ExprContext *econtext,
+						  bool resultForNull);
+extern void VExecCountClause(VectorQualStats *stats, int rowsin, int rowsout,
+							 instr_time *start);
+extern void VExecOrderClauses(List *clauses);
 /*
  * prototypes from functions in execScan.c
  */
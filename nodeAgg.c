@@ -153,6 +153,7 @@
 #include "postgres.h"
 
 #include "access/htup_details.h"
+#include "access/sysattr.h"
 #include "catalog/objectaccess.h"
 #include "catalog/pg_aggregate.h"
 #include "catalog/pg_proc.h"
@@ -163,6 +164,7 @@
 #include "nodes/nodeFuncs.h"
 #include "optimizer/clauses.h"
 #include "optimizer/tlist.h"
+#include "optimizer/var.h"
 #include "parser/parse_agg.h"
 #include "parser/parse_coerce.h"
 #include "utils/acl.h"
@@ -298,6 +300,7 @@ typedef struct AggStatePerTransData
 	 */
 	TupleDesc	evaldesc;		/* descriptor of input tuples */
 	ProjectionInfo *evalproj;	/* projection machinery */
+	struct VExprProjection *evalprogs;	/* the same compiled, or NULL */
 
 	/*
 	 * Slots for holding the evaluated input arguments.  These are set up
@@ -439,9 +442,11 @@ typedef struct AggStatePerPhaseData
 
 /*
  * To implement hashed aggregation, we need a hashtable that stores a
- * representative tuple and an array of AggStatePerGroup structs for each
- * distinct set of GROUP BY column values.  We compute the hash key from
- * the GROUP BY columns.
+ * representative tuple for each distinct set of GROUP BY column values.
+ * We compute the hash key from the GROUP BY columns.  The transition
+ * values of the groups are not in the entries, but in a column per
+ * transition by group number (VectorAggState.transvalues), which the
+ * transition functions update a batch at a time; pergroup is left empty.
  */
 typedef struct AggHashEntryData *AggHashEntry;
 
@@ -452,6 +457,23 @@ typedef struct AggHashEntryData
 	AggStatePerGroupData pergroup[FLEXIBLE_ARRAY_MEMBER];
 }	AggHashEntryData;
 
+/*
+ * Once the groups of hashed aggregation take more than work_mem, the table
+ * takes no more groups, and the input rows of the others are spilled to
+ * VAGG_SPILL_PARTITIONS files, by VAGG_SPILL_BITS bits of their hash.
+ * Each file is then aggregated like the input, the next bits of the hash
+ * spilling it again if need be, until they run out at VAGG_SPILL_MAXDEPTH.
+ */
+#define VAGG_SPILL_BITS			5
+#define VAGG_SPILL_PARTITIONS	(1 << VAGG_SPILL_BITS)
+#define VAGG_SPILL_MAXDEPTH		(32 / VAGG_SPILL_BITS - 1)
+
+typedef struct VAggSpillPartition
+{
+	BufFile    *file;
+	int			depth;			/* how many times its rows were spilled */
+} VAggSpillPartition;
+
 static void initialize_phase(AggState *aggstate, int newphase);
 static TupleTableSlot *fetch_input_tuple(AggState *aggstate);
 static void initialize_aggregates(AggState *aggstate,
@@ -489,8 +511,6 @@ static void finalize_aggregates(AggState *aggstate,
 static TupleTableSlot *project_aggregates(AggState *aggstate);
 static Bitmapset *find_unaggregated_cols(AggState *aggstate);
 static bool find_unaggregated_cols_walker(Node *node, Bitmapset **colnos);
-static void build_hash_table(AggState *aggstate);
-static void agg_fill_hash_table(AggState *aggstate);
 static Datum GetAggInitVal(Datum textInitVal, Oid transtype);
 static void build_pertrans_for_aggref(AggStatePerTrans pertrans,
 						  AggState *aggstate, EState *estate,
@@ -514,6 +534,8 @@ static int find_compatible_pertrans(AggState *aggstate, Aggref *newagg,
 #include "utils.h"
 #include "nodes/extensible.h"
 #include "vectorTupleSlot.h"
+#include "execProgram.h"
+#include "vtype/vagg.h"
 
 /* CustomScanMethods */
 static Node *CreateVectorAggState(CustomScan *custom_plan);
@@ -522,21 +544,34 @@ static Node *CreateVectorAggState(CustomScan *custom_plan);
 static void BeginVectorAgg(CustomScanState *node, EState *estate, int eflags);
 static TupleTableSlot *ExecVectorAgg(CustomScanState *node);
 static void EndVectorAgg(CustomScanState *node);
+static void ReScanVectorAgg(CustomScanState *node);
 
-static AggState *VExecInitAgg(Agg *node, EState *estate, int eflags);
+static AggState *VExecInitAgg(Agg *node, EState *estate, int eflags,
+							  int batchsize);
 static TupleTableSlot *VExecAgg(VectorAggState *node);
 static void VExecEndAgg(VectorAggState *node);
+static void VExecReScanAgg(VectorAggState *vas);
 
-static void InitAggResultSlot(VectorAggState *vas, EState *estate);
-static void Vadvance_aggregates(AggState *aggstate, AggHashEntry *entries);
+static void InitAggResultSlot(VectorAggState *vas, EState *estate,
+							  int batchsize);
+static void Vadvance_aggregates(VectorAggState *vas, const int *groups);
 static void Vadvance_transition_function(AggState *aggstate,
 							AggStatePerTrans pertrans,
-							AggHashEntry *entries);
-
-/* lookup_hash_entry now return a batch of hash entries. */
-static AggHashEntry *lookup_hash_entry(AggState *aggstate,
+							VAggGroups *groups);
+
+static void build_hash_table(VectorAggState *vas, int batchsize);
+static void agg_fill_hash_table(VectorAggState *vas);
+static bool *find_spill_columns(AggState *aggstate, int natts);
+static void agg_spill_batch(VectorAggState *vas, TupleTableSlot *slot,
+				const int *groups);
+static bool agg_refill_hash_table(VectorAggState *vas);
+static void agg_close_spill(VectorAggState *vas);
+/* lookup_hash_entry now returns the groups of a batch. */
+static const int *lookup_hash_entry(VectorAggState *vas,
 									TupleTableSlot *inputslot);
 static TupleTableSlot *agg_retrieve_hash_table(VectorAggState *aggstate);
+static void build_sorted_runs(VectorAggState *vas, int batchsize);
+static TupleTableSlot *agg_retrieve_sorted(VectorAggState *vas);
 static TupleTableSlot *agg_retrieve_direct(VectorAggState *vas);
 
 static CustomScanMethods	vectoragg_scan_methods = {
@@ -549,7 +584,7 @@ static CustomExecMethods	vectoragg_exec_methods = {
 	BeginVectorAgg,			/* BeginCustomScan */
 	ExecVectorAgg,			/* ExecCustomScan */
 	EndVectorAgg,			/* EndCustomScan */
-	NULL,					/* ReScanCustomScan */
+	ReScanVectorAgg,		/* ReScanCustomScan */
 	NULL,					/* MarkPosCustomScan */
 	NULL,					/* RestrPosCustomScan */
 	NULL,					/* EstimateDSMCustomScan */
@@ -583,6 +618,7 @@ BeginVectorAgg(CustomScanState *css, EState *estate, int eflags)
 	VectorAggState *vas;
 	CustomScan  *cscan;
 	Agg		*node;
+	int		batchsize;
 
 	/* clear state initialized in ExecInitCustomScan */
 	ClearCustomScanState(css);
@@ -591,10 +627,21 @@ BeginVectorAgg(CustomScanState *css, EState *estate, int eflags)
 	cscan = (CustomScan *)css->ss.ps.plan;
 	node = (Agg *)linitial(cscan->custom_plans);
 
-	vas->aggstate = VExecInitAgg(node, estate, eflags);
+	batchsize = GetCustomScanBatchSize(cscan);
+	vas->aggstate = VExecInitAgg(node, estate, eflags, batchsize);
+	if (node->aggstrategy == AGG_HASHED)
+		build_hash_table(vas, batchsize);
+	else if (node->aggstrategy == AGG_SORTED)
+		build_sorted_runs(vas, batchsize);
 
-	InitAggResultSlot(vas, estate);
+	InitAggResultSlot(vas, estate, batchsize);
 	vas->css.ss.ps.ps_ResultTupleSlot = vas->aggstate->ss.ps.ps_ResultTupleSlot;
+
+	/*
+	 * The input of the Agg is ours, for EXPLAIN to show it and to find what
+	 * the Vars of custom_scan_tlist refer to.
+	 */
+	outerPlanState(vas) = outerPlanState(vas->aggstate);
 }
 
 static TupleTableSlot *
@@ -610,13 +657,19 @@ EndVectorAgg(CustomScanState *node)
 }
 
 static void
-InitAggResultSlot(VectorAggState *vas, EState *estate)
+ReScanVectorAgg(CustomScanState *node)
+{
+	VExecReScanAgg((VectorAggState *)node);
+}
+
+static void
+InitAggResultSlot(VectorAggState *vas, EState *estate, int batchsize)
 {
 	VectorTupleSlot	*vslot;
 	TupleDesc		vdesc;
 	int				i;
 
-	vas->resultSlot = VExecInitExtraTupleSlot(estate);
+	vas->resultSlot = VExecInitExtraTupleSlot(estate, batchsize);
 
 	vslot = (VectorTupleSlot *)vas->resultSlot;
 
@@ -629,8 +682,10 @@ InitAggResultSlot(VectorAggState *vas, EState *estate)
 		Oid			typid;
 		vtype		*column;
 
-		typid = vas->resultSlot->tts_tupleDescriptor->attrs[i]->atttypid;
-		column = buildvtype(typid, BATCHSIZE, vslot->skip);
+		typid = GetNtype(vdesc->attrs[i]->atttypid);
+		if (typid == InvalidOid)
+			typid = vdesc->attrs[i]->atttypid;
+		column = buildvtype(typid, batchsize, &vslot->sel);
 		vas->resultSlot->tts_values[i]  = PointerGetDatum(column);
 		/* tts_isnull not used yet */
 		vas->resultSlot->tts_isnull[i] = false;
@@ -638,21 +693,25 @@ InitAggResultSlot(VectorAggState *vas, EState *estate)
 }
 
 /*
- * Advance each aggregate transition state for one input tuple.  The input
- * tuple has been stored in tmpcontext->ecxt_outertuple, so that it is
- * accessible to ExecEvalExpr.  pergroup is the array of per-group structs to
- * use (this might be in a hashtable entry).
+ * Advance each aggregate transition state for one input batch.  The input
+ * batch has been stored in tmpcontext->ecxt_outertuple, so that it is
+ * accessible to ExecEvalExpr.  groups is the group number of each row of
+ * the batch, whose transition values are in vas->transvalues.
  *
  * When called, CurrentMemoryContext should be the per-query context.
  */
 static void
-Vadvance_aggregates(AggState *aggstate, AggHashEntry *entries)
+Vadvance_aggregates(VectorAggState *vas, const int *groups)
 {
+	AggState   *aggstate = vas->aggstate;
 	int			transno;
 	int			setno = 0;
 	int			numGroupingSets = Max(aggstate->phase->numsets, 1);
 	int			numTrans = aggstate->numtrans;
 
+	/* grouped aggregation has a single grouping set */
+	Assert(numGroupingSets == 1);
+
 	for (transno = 0; transno < numTrans; transno++)
 	{
 		AggStatePerTrans pertrans = &aggstate->pertrans[transno];
@@ -674,7 +733,10 @@ Vadvance_aggregates(AggState *aggstate, AggHashEntry *entries)
 		}
 
 		/* Evaluate the current input expressions for this aggregate */
-		slot = ExecProject(pertrans->evalproj, NULL);
+		if (pertrans->evalprogs != NULL)
+			slot = VExecProjectPrograms(pertrans->evalprogs);
+		else
+			slot = ExecProject(pertrans->evalproj, NULL);
 
 		if (pertrans->numSortCols > 0)
 		{
@@ -726,13 +788,18 @@ Vadvance_aggregates(AggState *aggstate, AggHashEntry *entries)
 
 			for (setno = 0; setno < numGroupingSets; setno++)
 			{
-				//AggStatePerGroup pergroupstate = &pergroup[transno + (setno * numTrans)];
-				int groupOffset = offsetof(AggHashEntryData, pergroup) + 2 * sizeof(AggStatePerGroup) * (transno + (setno * numTrans));
+				VAggGroups	transgroups;
+
+				transgroups.transValues =
+					vas->transvalues[transno + (setno * numTrans)];
+				transgroups.transNulls =
+					vas->transnulls[transno + (setno * numTrans)];
+				transgroups.groups = groups;
 				aggstate->current_set = setno;
 
-				fcinfo->arg[1] = Int32GetDatum(groupOffset);
+				fcinfo->arg[1] = Int32GetDatum(VAGG_GROUPED);
 				fcinfo->argnull[1] = false;
-				Vadvance_transition_function(aggstate, pertrans, entries);
+				Vadvance_transition_function(aggstate, pertrans, &transgroups);
 			}
 		}
 	}
@@ -752,7 +819,7 @@ Vadvance_aggregates(AggState *aggstate, AggHashEntry *entries)
 static void
 Vadvance_transition_function(AggState *aggstate,
 							AggStatePerTrans pertrans,
-							AggHashEntry *entries)
+							VAggGroups *groups)
 {
 	FunctionCallInfo fcinfo = &pertrans->transfn_fcinfo;
 	MemoryContext oldContext;
@@ -782,7 +849,7 @@ Vadvance_transition_function(AggState *aggstate,
 	/*
 	 * OK to call the transition function
 	 */
-	fcinfo->arg[0] = PointerGetDatum(entries);
+	fcinfo->arg[0] = PointerGetDatum(groups);
 	fcinfo->argnull[0] = false;
 	fcinfo->isnull = false;		/* just in case transfn doesn't set it */
 
@@ -903,8 +970,14 @@ fetch_input_tuple(AggState *aggstate)
 		slot = aggstate->sort_slot;
 	}
 	else
+	{
 		slot = ExecProcNode(outerPlanState(aggstate));
 
+		/* the input batch may still hold columns not deformed yet */
+		if (!TupIsNull(slot))
+			Vslot_getallattrs(slot);
+	}
+
 	if (!TupIsNull(slot) && aggstate->sort_out)
 		tuplesort_puttupleslot(aggstate->sort_out, slot);
 
@@ -1191,7 +1264,10 @@ advance_aggregates(AggState *aggstate, AggStatePerGroup pergroup)
 		}
 
 		/* Evaluate the current input expressions for this aggregate */
-		slot = ExecProject(pertrans->evalproj, NULL);
+		if (pertrans->evalprogs != NULL)
+			slot = VExecProjectPrograms(pertrans->evalprogs);
+		else
+			slot = ExecProject(pertrans->evalproj, NULL);
 
 		if (pertrans->numSortCols > 0)
 		{
@@ -1237,9 +1313,9 @@ advance_aggregates(AggState *aggstate, AggStatePerGroup pergroup)
 			Assert(slot->tts_nvalid >= numTransInputs);
 			/* 
 			 * vectorize specific function arg used to indicate
-			 * groupoffset. Using -1 to indicate it's plain agg.
+			 * what the 0th arg is, see vtype/vagg.h.
 			 */
-			fcinfo->arg[1] = Int32GetDatum(-1);
+			fcinfo->arg[1] = Int32GetDatum(VAGG_PLAIN);
 			fcinfo->argnull[1] = false;
 			for (i = 0; i < numTransInputs; i++)
 			{
@@ -2029,26 +2105,200 @@ find_unaggregated_cols_walker(Node *node, Bitmapset **colnos)
  * The hash table always lives in the aggcontext memory context.
  */
 static void
-build_hash_table(AggState *aggstate)
+build_hash_table(VectorAggState *vas, int batchsize)
 {
+	AggState   *aggstate = vas->aggstate;
 	Agg		   *node = (Agg *) aggstate->ss.ps.plan;
-	MemoryContext tmpmem = aggstate->tmpcontext->ecxt_per_tuple_memory;
+	TupleDesc	plain_desc = aggstate->hashslot->tts_tupleDescriptor;
+	MemoryContext tablecxt = aggstate->aggcontexts[0]->ecxt_per_tuple_memory;
+	Oid		   *keytypes;
 	Size		entrysize;
+	int			i;
 
 	Assert(node->aggstrategy == AGG_HASHED);
 	Assert(node->numGroups > 0);
 
-	entrysize = offsetof(AggHashEntryData, pergroup) +
-		aggstate->numaggs * sizeof(AggStatePerGroupData);
-
-	aggstate->hashtable = BuildTupleHashTable(node->numCols,
-											  node->grpColIdx,
-											  aggstate->phase->eqfunctions,
-											  aggstate->hashfunctions,
-											  node->numGroups,
-											  entrysize,
-							 aggstate->aggcontexts[0]->ecxt_per_tuple_memory,
-											  tmpmem);
+	/* the transition values are in vas->transvalues, not in the entries */
+	entrysize = offsetof(AggHashEntryData, pergroup);
+
+	keytypes = palloc(sizeof(Oid) * node->numCols);
+	for (i = 0; i < node->numCols; i++)
+		keytypes[i] = plain_desc->attrs[node->grpColIdx[i] - 1]->atttypid;
+
+	vas->hashtable = VBuildTupleHashTable(node->numCols,
+										  node->grpColIdx,
+										  keytypes,
+										  aggstate->phase->eqfunctions,
+										  aggstate->hashfunctions,
+										  node->numGroups,
+										  entrysize,
+										  tablecxt);
+	pfree(keytypes);
+
+	if (vas->hashgroups == NULL)
+	{
+		vas->hashgroups = palloc(sizeof(int) * batchsize);
+		vas->hashnewrows = palloc(sizeof(int) * batchsize);
+	}
+
+	vas->transvalues = MemoryContextAllocZero(tablecxt,
+											  sizeof(Datum *) *
+											  Max(aggstate->numtrans, 1));
+	vas->transnulls = MemoryContextAllocZero(tablecxt,
+											 sizeof(bool *) *
+											 Max(aggstate->numtrans, 1));
+	vas->transspace = MemoryContextAllocZero(tablecxt,
+											 sizeof(Size *) *
+											 Max(aggstate->numtrans, 1));
+	vas->maxgroups = 0;
+	vas->hashmem = 0;
+}
+
+/*
+ * Make room in the transition values of every transition for the groups
+ * of the hash table, a column of Datums by group number each.
+ */
+static void
+grow_transvalues(VectorAggState *vas)
+{
+	AggState   *aggstate = vas->aggstate;
+	VTupleHashTable hashtable = vas->hashtable;
+	int			maxgroups;
+	int			transno;
+
+	if (hashtable->ngroups <= vas->maxgroups)
+		return;
+
+	maxgroups = Max(vas->maxgroups, 64);
+	while (maxgroups < hashtable->ngroups)
+		maxgroups *= 2;
+
+	for (transno = 0; transno < aggstate->numtrans; transno++)
+	{
+		bool		byval = aggstate->pertrans[transno].transtypeByVal;
+
+		if (vas->transvalues[transno] == NULL)
+		{
+			vas->transvalues[transno] =
+				MemoryContextAlloc(hashtable->tablecxt,
+								   sizeof(Datum) * maxgroups);
+			vas->transnulls[transno] =
+				MemoryContextAlloc(hashtable->tablecxt,
+								   sizeof(bool) * maxgroups);
+			if (!byval)
+				vas->transspace[transno] =
+					MemoryContextAllocZero(hashtable->tablecxt,
+										   sizeof(Size) * maxgroups);
+		}
+		else
+		{
+			vas->transvalues[transno] =
+				repalloc(vas->transvalues[transno],
+						 sizeof(Datum) * maxgroups);
+			vas->transnulls[transno] =
+				repalloc(vas->transnulls[transno],
+						 sizeof(bool) * maxgroups);
+			if (!byval)
+			{
+				vas->transspace[transno] =
+					repalloc(vas->transspace[transno],
+							 sizeof(Size) * maxgroups);
+				memset(vas->transspace[transno] + vas->maxgroups, 0,
+					   sizeof(Size) * (maxgroups - vas->maxgroups));
+			}
+		}
+	}
+	vas->maxgroups = maxgroups;
+}
+
+/*
+ * Count again the space of the pass-by-reference transition values of the
+ * groups of the active rows of slot, which the transition functions may
+ * have grown or replaced.
+ */
+static void
+count_transvalues(VectorAggState *vas, TupleTableSlot *slot,
+				  const int *groups)
+{
+	AggState   *aggstate = vas->aggstate;
+	VectorTupleSlot *vslot = (VectorTupleSlot *) slot;
+	int			transno;
+	int			i;
+
+	for (transno = 0; transno < aggstate->numtrans; transno++)
+	{
+		Datum	   *values = vas->transvalues[transno];
+		bool	   *nulls = vas->transnulls[transno];
+		Size	   *space = vas->transspace[transno];
+
+		if (space == NULL)
+			continue;
+		VSEL_FOREACH(&vslot->sel, vslot->dim, i,
+		{
+			int			group = groups[i];
+
+			vas->hashmem -= space[group];
+			space[group] = nulls[group] ? 0 :
+				GetMemoryChunkSpace(DatumGetPointer(values[group]));
+			vas->hashmem += space[group];
+		});
+	}
+}
+
+/*
+ * What the groups of the hash table take: the table, the first tuples and
+ * the pass-by-reference transition values, and the arrays of transition
+ * values at their capacity.
+ */
+static Size
+hash_table_memory(VectorAggState *vas)
+{
+	AggState   *aggstate = vas->aggstate;
+	Size		slotsize = 0;
+	int			transno;
+
+	for (transno = 0; transno < aggstate->numtrans; transno++)
+	{
+		slotsize += sizeof(Datum) + sizeof(bool);
+		if (vas->transspace[transno] != NULL)
+			slotsize += sizeof(Size);
+	}
+
+	return VTupleHashTableMemory(vas->hashtable) + vas->hashmem +
+		(Size) vas->maxgroups * slotsize;
+}
+
+/*
+ * Start the transition values of a new group, as initialize_aggregate
+ * does, but in the columns of vas->transvalues.  Pass-by-reference values
+ * are copied into cxt.
+ */
+static void
+initialize_group_transvalues(VectorAggState *vas, int group,
+							 MemoryContext cxt)
+{
+	AggState   *aggstate = vas->aggstate;
+	int			transno;
+
+	for (transno = 0; transno < aggstate->numtrans; transno++)
+	{
+		AggStatePerTrans pertrans = &aggstate->pertrans[transno];
+
+		vas->transnulls[transno][group] = pertrans->initValueIsNull;
+		if (pertrans->initValueIsNull)
+			vas->transvalues[transno][group] = pertrans->initValue;
+		else
+		{
+			MemoryContext oldContext;
+
+			oldContext = MemoryContextSwitchTo(cxt);
+			vas->transvalues[transno][group] =
+				datumCopy(pertrans->initValue,
+						  pertrans->transtypeByVal,
+						  pertrans->transtypeLen);
+			MemoryContextSwitchTo(oldContext);
+		}
+	}
 }
 
 /*
@@ -2109,68 +2359,73 @@ hash_agg_entry_size(int numAggs)
 {
 	Size		entrysize;
 
-	/* This must match build_hash_table */
-	entrysize = offsetof(AggHashEntryData, pergroup) +
-		numAggs * sizeof(AggStatePerGroupData);
+	/* This must match build_hash_table, and grow_transvalues */
+	entrysize = offsetof(AggHashEntryData, pergroup);
 	entrysize = MAXALIGN(entrysize);
+	entrysize += numAggs * (sizeof(Datum) + sizeof(bool));
 	/* Account for hashtable overhead (assuming fill factor = 1) */
 	entrysize += 3 * sizeof(void *);
 	return entrysize;
 }
 
 /*
- * Find or create a hashtable entry for the tuple group containing the
- * given tuple.
+ * Find or create the hashtable entries for the tuple groups of the rows
+ * of the given batch, and return the group number of each row.  The
+ * entries of new groups get a copy of the first row of the group, from
+ * which the grouping columns are projected.
  *
  * When called, CurrentMemoryContext should be the per-query context.
  */
-static AggHashEntry*
-lookup_hash_entry(AggState *aggstate, TupleTableSlot *inputslot)
+static const int *
+lookup_hash_entry(VectorAggState *vas, TupleTableSlot *inputslot)
 {
+	AggState   *aggstate = vas->aggstate;
+	VTupleHashTable hashtable = vas->hashtable;
 	TupleTableSlot *hashslot = aggstate->hashslot;
-	VectorTupleSlot *vslot = (VectorTupleSlot *)inputslot;
 	ListCell   *l;
-	AggHashEntry *entries;
-	bool		isnew;
-	int			i;
+	int			nnew;
+	int			n;
 
 	/* hashslot's td should already be initialized */
 	Assert(hashslot->tts_tupleDescriptor != NULL);
 
-	entries = palloc(sizeof(AggHashEntry) * BATCHSIZE);
-	
 	/* transfer just the needed columns into hashslot */
 	Vslot_getsomeattrs(inputslot, linitial_int(aggstate->hash_needed));
 
 	/* probe and find hash entries for every tuples in vector slot. */
-	/* TODO: separate cal hashvalue and probe hash table */
-	for (i = 0; i < BATCHSIZE; i++)
+	nnew = VLookupTupleHashGroups(hashtable, inputslot, vas->hashgroups,
+								  vas->hashnewrows);
+	if (nnew > 0)
+		grow_transvalues(vas);
+
+	for (n = 0; n < nnew; n++)
 	{
-		if (vslot->skip[i])
-			continue;
+		int			i = vas->hashnewrows[n];
+		int			group = vas->hashgroups[i];
+		AggHashEntry entry = (AggHashEntry) hashtable->entries[group];
+		MemoryContext oldContext;
 
 		foreach(l, aggstate->hash_needed)
 		{
 			vtype *column;
 			int			varNumber = lfirst_int(l) - 1;
 			column = (vtype *)DatumGetPointer(inputslot->tts_values[varNumber]);
-			hashslot->tts_values[varNumber] = column->values[i];
-			hashslot->tts_isnull[varNumber] = column->isnull[i];
+			hashslot->tts_values[varNumber] = vtype_getdatum(column, i);
+			hashslot->tts_isnull[varNumber] =
+				column->hasnull && VTYPE_ISNULL(column, i);
 		}
 
-		/* find or create the hashtable entry using the filtered tuple */
-		entries[i] = (AggHashEntry) LookupTupleHashEntry(aggstate->hashtable,
-				hashslot,
-				&isnew);
+		/* copy the first tuple of the group into the table context */
+		oldContext = MemoryContextSwitchTo(hashtable->tablecxt);
+		entry->shared.firstTuple = ExecCopySlotMinimalTuple(hashslot);
+		MemoryContextSwitchTo(oldContext);
+		vas->hashmem += GetMemoryChunkSpace(entry->shared.firstTuple);
 
-		if (isnew)
-		{
-			/* initialize aggregates for new tuple group */
-			initialize_aggregates(aggstate, entries[i]->pergroup, 0);
-		}
+		/* initialize aggregates for new tuple group */
+		initialize_group_transvalues(vas, group, hashtable->tablecxt);
 	}
 
-	return entries;
+	return vas->hashgroups;
 }
 
 /*
@@ -2220,9 +2475,12 @@ VExecAgg(VectorAggState *vas)
 		{
 			case AGG_HASHED:
 				if (!node->table_filled)
-					agg_fill_hash_table(node);
+					agg_fill_hash_table(vas);
 				result = agg_retrieve_hash_table(vas);
 				break;
+			case AGG_SORTED:
+				result = agg_retrieve_sorted(vas);
+				break;
 			default:
 				result = agg_retrieve_direct(vas);
 				break;
@@ -2564,9 +2822,11 @@ agg_retrieve_direct(VectorAggState *vas)
 		for(i = 0; i < vdesc->natts; i++)
 		{
 			column = (vtype *)DatumGetPointer(vslot->tts.tts_values[i]);
-			column->values[0] = result->tts_values[i];
+			vtype_setdatum(column, 0, result->tts_values[i]);
+			column->dim = 1;
 		}
-		vslot->skip[0] = false;
+		vslot->dim = 1;
+		Vslot_selectall((TupleTableSlot *)vslot);
 		ExecStoreVirtualTuple((TupleTableSlot *)vslot);
 		return (TupleTableSlot *)vslot;
 	}
@@ -2579,10 +2839,11 @@ agg_retrieve_direct(VectorAggState *vas)
  * ExecAgg for hashed case: phase 1, read input and build hash table
  */
 static void
-agg_fill_hash_table(AggState *aggstate)
+agg_fill_hash_table(VectorAggState *vas)
 {
+	AggState   *aggstate = vas->aggstate;
 	ExprContext *tmpcontext;
-	AggHashEntry *entries;
+	const int  *groups;
 	TupleTableSlot *outerslot;
 
 	/*
@@ -2594,18 +2855,36 @@ agg_fill_hash_table(AggState *aggstate)
 
 	/*
 	 * Process each outer-plan tuple, and then fetch the next one, until we
-	 * exhaust the outer plan.
+	 * exhaust the outer plan, or the partition being aggregated.
 	 */
 	for (;;)
 	{
-		outerslot = fetch_input_tuple(aggstate);
-		if (TupIsNull(outerslot))
-			break;
+		VectorTupleSlot *vslot;
+
+		if (vas->spillinput != NULL)
+		{
+			MemoryContextReset(vas->spillcxt);
+			outerslot = vas->spillslot;
+			if (!Vslot_readbatch(outerslot, vas->spillinput, vas->spillcxt,
+								 vas->spillcols))
+				break;
+		}
+		else
+		{
+			outerslot = fetch_input_tuple(aggstate);
+			if (TupIsNull(outerslot))
+				break;
+		}
+		vslot = (VectorTupleSlot *) outerslot;
 		/* set up for advance_aggregates call */
 		tmpcontext->ecxt_outertuple = outerslot;
 
 		/* Find or build hashtable entry for this tuple's group */
-		entries = lookup_hash_entry(aggstate, outerslot);
+		groups = lookup_hash_entry(vas, outerslot);
+
+		/* the rows of the groups left out of the table are spilled */
+		if (vas->hashtable->frozen)
+			agg_spill_batch(vas, outerslot, groups);
 
 		/* Advance the aggregates */
 		if (DO_AGGSPLIT_COMBINE(aggstate->aggsplit))
@@ -2614,16 +2893,255 @@ agg_fill_hash_table(AggState *aggstate)
 			//combine_aggregates(aggstate, entry->pergroup);
 		}
 		/* TODO */
-		else
-			Vadvance_aggregates(aggstate, entries);
+		else if (VSEL_NROWS(&vslot->sel, vslot->dim) > 0)
+		{
+			Vadvance_aggregates(vas, groups);
+			count_transvalues(vas, outerslot, groups);
+		}
 
 		/* Reset per-input-tuple context after each tuple */
 		ResetExprContext(tmpcontext);
+
+		/* past work_mem, the groups in the table are all it gets */
+		if (!vas->hashtable->frozen &&
+			hash_table_memory(vas) > (Size) work_mem * 1024L &&
+			vas->spilldepth <= VAGG_SPILL_MAXDEPTH)
+			vas->hashtable->frozen = true;
+	}
+
+	/* the partitions spilled are aggregated once this table is returned */
+	if (vas->spillfiles != NULL)
+	{
+		MemoryContext oldContext;
+		int			partno;
+
+		oldContext = MemoryContextSwitchTo(aggstate->ss.ps.state->es_query_cxt);
+		for (partno = 0; partno < VAGG_SPILL_PARTITIONS; partno++)
+		{
+			VAggSpillPartition *part;
+
+			if (vas->spillfiles[partno] == NULL)
+				continue;
+			part = palloc(sizeof(VAggSpillPartition));
+			part->file = vas->spillfiles[partno];
+			part->depth = vas->spilldepth + 1;
+			vas->spillpending = lappend(vas->spillpending, part);
+			vas->spillfiles[partno] = NULL;
+		}
+		MemoryContextSwitchTo(oldContext);
 	}
 
 	aggstate->table_filled = true;
 	/* Initialize to walk the hash table */
-	ResetTupleHashIterator(aggstate->hashtable, &aggstate->hashiter);
+	VResetTupleHashIterator(vas->hashtable);
+}
+
+/*
+ * The input columns the aggregation reads: those of the targetlist and
+ * qual, the aggregate arguments included, and the grouping columns.  Only
+ * these are spilled, the others being never extracted from the input
+ * batches.  A whole-row reference needs every column.
+ */
+static bool *
+find_spill_columns(AggState *aggstate, int natts)
+{
+	Agg		   *node = (Agg *) aggstate->ss.ps.plan;
+	bool	   *cols = palloc0(sizeof(bool) * natts);
+	Bitmapset  *colnos = NULL;
+	int			attno;
+	int			i;
+
+	pull_varattnos((Node *) node->plan.targetlist, OUTER_VAR, &colnos);
+	pull_varattnos((Node *) node->plan.qual, OUTER_VAR, &colnos);
+	for (i = 0; i < node->numCols; i++)
+		colnos = bms_add_member(colnos,
+						node->grpColIdx[i] - FirstLowInvalidHeapAttributeNumber);
+
+	attno = -1;
+	while ((attno = bms_next_member(colnos, attno)) >= 0)
+	{
+		AttrNumber	attnum = attno + FirstLowInvalidHeapAttributeNumber;
+
+		if (attnum == InvalidAttrNumber)
+		{
+			for (i = 0; i < natts; i++)
+				cols[i] = true;
+			break;
+		}
+		if (attnum > 0 && attnum <= natts)
+			cols[attnum - 1] = true;
+	}
+	bms_free(colnos);
+
+	return cols;
+}
+
+/*
+ * Write the rows of the batch in slot whose groups are not in the frozen
+ * table to the partition files, by their hash, and drop them from the
+ * batch.
+ */
+static void
+agg_spill_batch(VectorAggState *vas, TupleTableSlot *slot, const int *groups)
+{
+	AggState   *aggstate = vas->aggstate;
+	VectorTupleSlot *vslot = (VectorTupleSlot *) slot;
+	vselection *sel = &vslot->sel;
+	uint32	   *hashes = vas->hashtable->hashes;
+	int			shift = 32 - VAGG_SPILL_BITS * (vas->spilldepth + 1);
+	int			counts[VAGG_SPILL_PARTITIONS];
+	int			ends[VAGG_SPILL_PARTITIONS];
+	int		   *partnos;
+	int		   *rows;
+	int			nspilled = 0;
+	int			nkept = 0;
+	int			partno;
+	int			i;
+	MemoryContext oldContext;
+
+	oldContext = MemoryContextSwitchTo(aggstate->ss.ps.state->es_query_cxt);
+	if (vas->spillslot == NULL)
+	{
+		/* batches are read back into a slot like the input's */
+		vas->spillslot = VExecInitExtraTupleSlot(aggstate->ss.ps.state,
+												 vslot->batchsize);
+		ExecSetSlotDescriptor(vas->spillslot, slot->tts_tupleDescriptor);
+		InitializeVectorSlotColumn((VectorTupleSlot *) vas->spillslot);
+		vas->spillcxt = AllocSetContextCreate(CurrentMemoryContext,
+											  "VectorAgg spill",
+											  ALLOCSET_DEFAULT_SIZES);
+		vas->spillfiles = palloc0(sizeof(BufFile *) * VAGG_SPILL_PARTITIONS);
+		vas->spillcols = find_spill_columns(aggstate,
+											slot->tts_tupleDescriptor->natts);
+	}
+
+	MemoryContextSwitchTo(aggstate->tmpcontext->ecxt_per_tuple_memory);
+	partnos = palloc(sizeof(int) * vslot->dim);
+	rows = palloc(sizeof(int) * vslot->dim);
+
+	memset(counts, 0, sizeof(counts));
+	VSEL_FOREACH(sel, vslot->dim, i,
+	{
+		if (groups[i] < 0)
+		{
+			partnos[i] = (hashes[i] >> shift) & (VAGG_SPILL_PARTITIONS - 1);
+			counts[partnos[i]]++;
+			nspilled++;
+		}
+	});
+
+	if (nspilled == 0)
+	{
+		MemoryContextSwitchTo(oldContext);
+		return;
+	}
+
+	/* extract the columns written while the rows are still active */
+	Vslot_getattrs(slot, vas->spillcols);
+
+	/* the rows spilled by partition, and the others left in the batch */
+	ends[0] = 0;
+	for (partno = 1; partno < VAGG_SPILL_PARTITIONS; partno++)
+		ends[partno] = ends[partno - 1] + counts[partno - 1];
+	VSEL_FOREACH(sel, vslot->dim, i,
+	{
+		if (groups[i] < 0)
+		{
+			rows[ends[partnos[i]]++] = i;
+			vslot->skip[i] = true;
+		}
+		else
+			sel->rows[nkept++] = i;
+	});
+	sel->nrows = nkept;
+	sel->dense = false;
+
+	for (partno = 0; partno < VAGG_SPILL_PARTITIONS; partno++)
+	{
+		if (counts[partno] == 0)
+			continue;
+		if (vas->spillfiles[partno] == NULL)
+		{
+			MemoryContextSwitchTo(aggstate->ss.ps.state->es_query_cxt);
+			vas->spillfiles[partno] = BufFileCreateTemp(false);
+			MemoryContextSwitchTo(aggstate->tmpcontext->ecxt_per_tuple_memory);
+		}
+		Vslot_writerows(slot, rows + ends[partno] - counts[partno],
+						counts[partno], vas->spillcols,
+						vas->spillfiles[partno]);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+/*
+ * Replace the groups of the table, all returned, by those of the next
+ * partition spilled, aggregated from its file.  Returns false if there is
+ * none left.
+ */
+static bool
+agg_refill_hash_table(VectorAggState *vas)
+{
+	AggState   *aggstate = vas->aggstate;
+	VAggSpillPartition *part;
+
+	if (vas->spillpending == NIL)
+		return false;
+	part = (VAggSpillPartition *) linitial(vas->spillpending);
+	vas->spillpending = list_delete_first(vas->spillpending);
+
+	/* the table is in the aggcontext, with the transition values */
+	ExecClearTuple(aggstate->ss.ss_ScanTupleSlot);
+	ReScanExprContext(aggstate->aggcontexts[0]);
+	build_hash_table(vas, ((VectorTupleSlot *) vas->resultSlot)->batchsize);
+
+	if (BufFileSeek(part->file, 0, 0L, SEEK_SET) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not rewind vectorized batch temporary file: %m")));
+	vas->spillinput = part->file;
+	vas->spilldepth = part->depth;
+	pfree(part);
+
+	agg_fill_hash_table(vas);
+
+	BufFileClose(vas->spillinput);
+	vas->spillinput = NULL;
+
+	return true;
+}
+
+/*
+ * Close the partition files of hashed aggregation left, if any.
+ */
+static void
+agg_close_spill(VectorAggState *vas)
+{
+	if (vas->spillfiles != NULL)
+	{
+		int			partno;
+
+		for (partno = 0; partno < VAGG_SPILL_PARTITIONS; partno++)
+		{
+			if (vas->spillfiles[partno] != NULL)
+				BufFileClose(vas->spillfiles[partno]);
+			vas->spillfiles[partno] = NULL;
+		}
+	}
+	while (vas->spillpending != NIL)
+	{
+		VAggSpillPartition *part = linitial(vas->spillpending);
+
+		BufFileClose(part->file);
+		pfree(part);
+		vas->spillpending = list_delete_first(vas->spillpending);
+	}
+	if (vas->spillinput != NULL)
+	{
+		BufFileClose(vas->spillinput);
+		vas->spillinput = NULL;
+	}
+	vas->spilldepth = 0;
 }
 
 /*
@@ -2637,6 +3155,8 @@ agg_retrieve_hash_table(VectorAggState *vas)
 	AggStatePerAgg peragg;
 	AggStatePerGroup pergroup;
 	AggHashEntry entry;
+	int			group;
+	int			transno;
 	TupleTableSlot *firstSlot;
 	TupleTableSlot *result;
 	VectorTupleSlot *vslot;
@@ -2656,6 +3176,9 @@ agg_retrieve_hash_table(VectorAggState *vas)
 	vslot = (VectorTupleSlot *)vas->resultSlot;
 	VExecClearTuple((TupleTableSlot *)vslot);
 	vdesc = aggstate->ss.ps.ps_ResultTupleSlot->tts_tupleDescriptor;
+	for (i = 0; i < vdesc->natts; i++)
+		vtype_clearnulls((vtype *) DatumGetPointer(vslot->tts.tts_values[i]),
+						 vslot->batchsize);
 	row = 0;
 
 	/*
@@ -2667,13 +3190,24 @@ agg_retrieve_hash_table(VectorAggState *vas)
 		/*
 		 * Find the next entry in the hash table
 		 */
-		entry = (AggHashEntry) ScanTupleHashTable(&aggstate->hashiter);
-		if (entry == NULL)
+		if (vas->hashtable->scangroup >= vas->hashtable->ngroups)
 		{
+			/*
+			 * The groups of a spilled partition replace those of the
+			 * table, whose first tuples the batch may point to: it is
+			 * returned first.
+			 */
+			if (vas->spillpending != NIL && row > 0)
+				break;
+			if (agg_refill_hash_table(vas))
+				continue;
+
 			/* No more entries in hashtable, so done */
 			aggstate->agg_done = TRUE;
 			break;
 		}
+		group = vas->hashtable->scangroup++;
+		entry = (AggHashEntry) vas->hashtable->entries[group];
 
 		/*
 		 * Clear the per-output-tuple context for each group
@@ -2692,7 +3226,14 @@ agg_retrieve_hash_table(VectorAggState *vas)
 							  firstSlot,
 							  false);
 
-		pergroup = entry->pergroup;
+		/* gather the transition values of the group */
+		pergroup = aggstate->pergroup;
+		for (transno = 0; transno < aggstate->numtrans; transno++)
+		{
+			pergroup[transno].transValue = vas->transvalues[transno][group];
+			pergroup[transno].transValueIsNull = vas->transnulls[transno][group];
+			pergroup[transno].noTransValue = vas->transnulls[transno][group];
+		}
 
 		finalize_aggregates(aggstate, peragg, pergroup, 0);
 
@@ -2703,21 +3244,33 @@ agg_retrieve_hash_table(VectorAggState *vas)
 		econtext->ecxt_outertuple = firstSlot;
 
 
+		/* the qual may drop the group */
 		result = project_aggregates(aggstate);
+		if (result == NULL)
+			continue;
 		for(i = 0; i < vdesc->natts; i++)
 		{
 			column = (vtype *)DatumGetPointer(vslot->tts.tts_values[i]);
-			column->values[row] = result->tts_values[i];
+			if (result->tts_isnull[i])
+				VTYPE_SETNULL(column, row);
+			else
+				vtype_setdatum(column, row, result->tts_values[i]);
 		}
 		row++;
 
-		if(row == BATCHSIZE)
+		if(row == vslot->batchsize)
 			break;
 	}
 
 	if (row > 0)
 	{
-		memset(vslot->skip, false, sizeof(bool) * row);
+		vslot->dim = row;
+		for(i = 0; i < vdesc->natts; i++)
+		{
+			column = (vtype *)DatumGetPointer(vslot->tts.tts_values[i]);
+			column->dim = row;
+		}
+		Vslot_selectall((TupleTableSlot *)vslot);
 		ExecStoreVirtualTuple((TupleTableSlot *)vslot);
 		return (TupleTableSlot *)vslot;
 	}
@@ -2726,6 +3279,271 @@ agg_retrieve_hash_table(VectorAggState *vas)
 	return NULL;
 }
 
+/*
+ * Set up the finding of the runs of equal keys of AGG_SORTED, and the
+ * transition values of the runs of a batch, at most one per row.
+ */
+static void
+build_sorted_runs(VectorAggState *vas, int batchsize)
+{
+	AggState   *aggstate = vas->aggstate;
+	Agg		   *node = (Agg *) aggstate->ss.ps.plan;
+	TupleDesc	plain_desc = aggstate->hashslot->tts_tupleDescriptor;
+	Oid		   *keytypes;
+	int			transno;
+	int			i;
+
+	Assert(node->aggstrategy == AGG_SORTED);
+	Assert(node->numCols > 0);
+
+	keytypes = palloc(sizeof(Oid) * node->numCols);
+	for (i = 0; i < node->numCols; i++)
+		keytypes[i] = plain_desc->attrs[node->grpColIdx[i] - 1]->atttypid;
+
+	vas->runs = VBuildTupleRuns(node->numCols,
+								node->grpColIdx,
+								keytypes,
+								aggstate->phase->eqfunctions,
+								CurrentMemoryContext);
+	pfree(keytypes);
+
+	vas->sortgroups = palloc(sizeof(int) * batchsize);
+	vas->sortstarts = palloc(sizeof(int) * batchsize);
+	vas->transvalues = palloc0(sizeof(Datum *) * Max(aggstate->numtrans, 1));
+	vas->transnulls = palloc0(sizeof(bool *) * Max(aggstate->numtrans, 1));
+	for (transno = 0; transno < aggstate->numtrans; transno++)
+	{
+		vas->transvalues[transno] = palloc(sizeof(Datum) * batchsize);
+		vas->transnulls[transno] = palloc(sizeof(bool) * batchsize);
+	}
+	vas->maxgroups = batchsize;
+
+	vas->sortcxt[0] = AllocSetContextCreate(CurrentMemoryContext,
+											"VectorAgg runs",
+											ALLOCSET_DEFAULT_SIZES);
+	vas->sortcxt[1] = AllocSetContextCreate(CurrentMemoryContext,
+											"VectorAgg runs",
+											ALLOCSET_DEFAULT_SIZES);
+	vas->sortcur = 0;
+	vas->sortcarried = false;
+	vas->sortfirst = NULL;
+}
+
+/*
+ * Copy row i of the batch in inputslot into cxt, as the first tuple of
+ * its run, as lookup_hash_entry does for a new group.
+ */
+static MinimalTuple
+sorted_run_first_tuple(VectorAggState *vas, TupleTableSlot *inputslot, int i,
+					   MemoryContext cxt)
+{
+	AggState   *aggstate = vas->aggstate;
+	TupleTableSlot *hashslot = aggstate->hashslot;
+	MemoryContext oldContext;
+	MinimalTuple tuple;
+	ListCell   *l;
+
+	foreach(l, aggstate->hash_needed)
+	{
+		int			varNumber = lfirst_int(l) - 1;
+		vtype	   *column;
+
+		column = (vtype *) DatumGetPointer(inputslot->tts_values[varNumber]);
+		hashslot->tts_values[varNumber] = vtype_getdatum(column, i);
+		hashslot->tts_isnull[varNumber] =
+			column->hasnull && VTYPE_ISNULL(column, i);
+	}
+
+	oldContext = MemoryContextSwitchTo(cxt);
+	tuple = ExecCopySlotMinimalTuple(hashslot);
+	MemoryContextSwitchTo(oldContext);
+
+	return tuple;
+}
+
+/*
+ * Finalize the run whose transition values are at index run, and whose
+ * first tuple is firstTuple, into the given row of the result batch.
+ * Returns the next row, which is the same one if the qual drops the run.
+ */
+static int
+project_sorted_run(VectorAggState *vas, int run, MinimalTuple firstTuple,
+				   int row)
+{
+	AggState   *aggstate = vas->aggstate;
+	ExprContext *econtext = aggstate->ss.ps.ps_ExprContext;
+	AggStatePerGroup pergroup = aggstate->pergroup;
+	TupleTableSlot *firstSlot = aggstate->ss.ss_ScanTupleSlot;
+	TupleTableSlot *result;
+	TupleDesc	vdesc;
+	int			transno;
+	int			i;
+
+	ExecStoreMinimalTuple(firstTuple, firstSlot, false);
+
+	for (transno = 0; transno < aggstate->numtrans; transno++)
+	{
+		pergroup[transno].transValue = vas->transvalues[transno][run];
+		pergroup[transno].transValueIsNull = vas->transnulls[transno][run];
+		pergroup[transno].noTransValue = vas->transnulls[transno][run];
+	}
+
+	finalize_aggregates(aggstate, aggstate->peragg, pergroup, 0);
+
+	/*
+	 * Use the representative input tuple for any references to
+	 * non-aggregated input columns in the qual and tlist.
+	 */
+	econtext->ecxt_outertuple = firstSlot;
+
+	result = project_aggregates(aggstate);
+	if (result == NULL)
+		return row;
+
+	vdesc = aggstate->ss.ps.ps_ResultTupleSlot->tts_tupleDescriptor;
+	for (i = 0; i < vdesc->natts; i++)
+	{
+		vtype	   *column = (vtype *) DatumGetPointer(vas->resultSlot->tts_values[i]);
+
+		if (result->tts_isnull[i])
+			VTYPE_SETNULL(column, row);
+		else
+			vtype_setdatum(column, row, result->tts_values[i]);
+	}
+
+	return row + 1;
+}
+
+/*
+ * ExecAgg for sorted case: the groups of a batch are its runs of equal
+ * keys, found by VFindTupleRuns, and aggregated together by
+ * Vadvance_aggregates with the run of each row as its group.  The runs a
+ * batch ends are returned as a batch, and its last run is carried over to
+ * the next one.  However many groups there are, only those of a batch are
+ * kept.
+ */
+static TupleTableSlot *
+agg_retrieve_sorted(VectorAggState *vas)
+{
+	AggState   *aggstate = vas->aggstate;
+	ExprContext *tmpcontext = aggstate->tmpcontext;
+	VectorTupleSlot *vslot = (VectorTupleSlot *) vas->resultSlot;
+	TupleDesc	vdesc;
+	TupleTableSlot *outerslot;
+	MemoryContext cxt;
+	bool		continued;
+	int			nruns;
+	int			run;
+	int			row;
+	int			transno;
+	int			i;
+
+	/* the batch returned last, and the results in it, are done with */
+	ResetExprContext(aggstate->ss.ps.ps_ExprContext);
+
+	vdesc = aggstate->ss.ps.ps_ResultTupleSlot->tts_tupleDescriptor;
+	VExecClearTuple((TupleTableSlot *) vslot);
+	for (i = 0; i < vdesc->natts; i++)
+		vtype_clearnulls((vtype *) DatumGetPointer(vslot->tts.tts_values[i]),
+						 vslot->batchsize);
+	row = 0;
+
+	while (!aggstate->agg_done)
+	{
+		outerslot = fetch_input_tuple(aggstate);
+		if (TupIsNull(outerslot))
+		{
+			/* the run carried over is the last group */
+			if (vas->sortcarried)
+				row = project_sorted_run(vas, 0, vas->sortfirst, row);
+			vas->sortcarried = false;
+			aggstate->agg_done = true;
+			break;
+		}
+
+		if (((VectorTupleSlot *) outerslot)->dim > vas->maxgroups)
+			elog(ERROR, "vectorized batch of %d rows does not fit in %d runs",
+				 ((VectorTupleSlot *) outerslot)->dim, vas->maxgroups);
+
+		/* the keys, and the columns of the first tuples of the runs */
+		Vslot_getsomeattrs(outerslot, linitial_int(aggstate->hash_needed));
+
+		nruns = VFindTupleRuns(vas->runs, outerslot, vas->sortgroups,
+							   vas->sortstarts, &continued);
+		if (nruns == 0)
+			continue;
+
+		if (DO_AGGSPLIT_COMBINE(aggstate->aggsplit))
+			elog(ERROR, "vectorize agg combine not supported.");
+
+		/* the run carried over ended with the previous batch */
+		if (vas->sortcarried && !continued)
+			row = project_sorted_run(vas, 0, vas->sortfirst, row);
+
+		/*
+		 * The runs the batch starts go in the sortcxt not holding the run
+		 * carried over, whose values the result batch may point to.
+		 */
+		cxt = vas->sortcxt[1 - vas->sortcur];
+		if (nruns > 1 || !continued)
+			MemoryContextReset(cxt);
+		for (run = continued ? 1 : 0; run < nruns; run++)
+			initialize_group_transvalues(vas, run, cxt);
+
+		/* set up for advance_aggregates call */
+		tmpcontext->ecxt_outertuple = outerslot;
+		Vadvance_aggregates(vas, vas->sortgroups);
+		ResetExprContext(tmpcontext);
+
+		/* all the runs but the last one are done */
+		for (run = 0; run < nruns - 1; run++)
+		{
+			MinimalTuple firstTuple;
+
+			if (run == 0 && continued)
+				firstTuple = vas->sortfirst;
+			else
+				firstTuple = sorted_run_first_tuple(vas, outerslot,
+													vas->sortstarts[run],
+													cxt);
+			row = project_sorted_run(vas, run, firstTuple, row);
+		}
+
+		/* carry the last run over, unless it is the one carried already */
+		if (nruns > 1 || !continued)
+		{
+			vas->sortfirst = sorted_run_first_tuple(vas, outerslot,
+													vas->sortstarts[nruns - 1],
+													cxt);
+			for (transno = 0; transno < aggstate->numtrans; transno++)
+			{
+				vas->transvalues[transno][0] =
+					vas->transvalues[transno][nruns - 1];
+				vas->transnulls[transno][0] =
+					vas->transnulls[transno][nruns - 1];
+			}
+			vas->sortcur = 1 - vas->sortcur;
+		}
+		vas->sortcarried = true;
+
+		if (row > 0)
+			break;
+	}
+
+	if (row > 0)
+	{
+		vslot->dim = row;
+		for (i = 0; i < vdesc->natts; i++)
+			((vtype *) DatumGetPointer(vslot->tts.tts_values[i]))->dim = row;
+		Vslot_selectall((TupleTableSlot *) vslot);
+		ExecStoreVirtualTuple((TupleTableSlot *) vslot);
+		return (TupleTableSlot *) vslot;
+	}
+
+	/* No more groups */
+	return NULL;
+}
+
 /* -----------------
  * ExecInitAgg
  *
@@ -2734,7 +3552,7 @@ agg_retrieve_hash_table(VectorAggState *vas)
  * -----------------
  */
 AggState *
-VExecInitAgg(Agg *node, EState *estate, int eflags)
+VExecInitAgg(Agg *node, EState *estate, int eflags, int batchsize)
 {
 	AggState   *aggstate;
 	AggStatePerAgg peraggs;
@@ -2834,10 +3652,10 @@ VExecInitAgg(Agg *node, EState *estate, int eflags)
 	/*
 	 * tuple table initialization
 	 */
-	VExecInitScanTupleSlot(estate, &aggstate->ss);
-	VExecInitResultTupleSlot(estate, &aggstate->ss.ps);
+	VExecInitScanTupleSlot(estate, &aggstate->ss, batchsize);
+	VExecInitResultTupleSlot(estate, &aggstate->ss.ps, batchsize);
 	aggstate->hashslot = ExecInitExtraTupleSlot(estate);
-	aggstate->sort_slot = VExecInitExtraTupleSlot(estate);
+	aggstate->sort_slot = VExecInitExtraTupleSlot(estate, batchsize);
 
 	/*
 	 * initialize child expressions
@@ -3034,12 +3852,22 @@ VExecInitAgg(Agg *node, EState *estate, int eflags)
 
 	if (node->aggstrategy == AGG_HASHED)
 	{
-		build_hash_table(aggstate);
+		/* the hash table is built by BeginVectorAgg */
 		aggstate->table_filled = false;
 		/* Compute the columns we actually need to hash on */
 		aggstate->hash_needed = find_hash_columns(aggstate);
 	}
-	else
+	else if (node->aggstrategy == AGG_SORTED)
+	{
+		/* the same columns make the first tuples of the runs */
+		aggstate->hash_needed = find_hash_columns(aggstate);
+	}
+
+	/*
+	 * The per-group state of AGG_PLAIN, or that of the group being
+	 * finalized for AGG_HASHED and AGG_SORTED, whose transition values are
+	 * kept by group number in VectorAggState.
+	 */
 	{
 		AggStatePerGroup pergroup;
 
@@ -3353,6 +4181,33 @@ VExecInitAgg(Agg *node, EState *estate, int eflags)
 	aggstate->numaggs = aggno + 1;
 	aggstate->numtrans = transno + 1;
 
+	/*
+	 * Compile the inputs of the transition states into vector programs.  The
+	 * states are advanced in transno order, so a program may read what an
+	 * earlier one computed; not if that one is behind a FILTER, though,
+	 * since it is then skipped for some batches.
+	 */
+	{
+		List	   *allargs = NIL;
+		VExprCSE   *cse;
+
+		for (i = 0; i < aggstate->numtrans; i++)
+			allargs = lappend(allargs, pertransstates[i].aggref->args);
+		cse = VExecInitCSE(allargs);
+
+		for (i = 0; i < aggstate->numtrans; i++)
+		{
+			AggStatePerTrans pertrans = &pertransstates[i];
+
+			pertrans->evalprogs = VExecBuildProjection(pertrans->aggref->args,
+													   aggstate->tmpcontext,
+													   pertrans->evalslot,
+													   cse);
+			if (pertrans->evalprogs != NULL && pertrans->aggfilter == NULL)
+				VExecShareProgram(cse, pertrans->evalprogs->prog);
+		}
+	}
+
 	return aggstate;
 }
 
@@ -3856,6 +4711,8 @@ VExecEndAgg(VectorAggState *vas)
 	for (setno = 0; setno < numGroupingSets; setno++)
 		ReScanExprContext(node->aggcontexts[setno]);
 
+	agg_close_spill(vas);
+
 	/*
 	 * We don't actually free any ExprContexts here (see comment in
 	 * ExecFreeExprContext), just unlinking the output one from the plan node
@@ -3870,9 +4727,10 @@ VExecEndAgg(VectorAggState *vas)
 	ExecEndNode(outerPlan);
 }
 
-void
-ExecReScanAgg(AggState *node)
+static void
+VExecReScanAgg(VectorAggState *vas)
 {
+	AggState   *node = vas->aggstate;
 	ExprContext *econtext = node->ss.ps.ps_ExprContext;
 	PlanState  *outerPlan = outerPlanState(node);
 	Agg		   *aggnode = (Agg *) node->ss.ps.plan;
@@ -3896,15 +4754,16 @@ ExecReScanAgg(AggState *node)
 			return;
 
 		/*
-		 * If we do have the hash table, and the subplan does not have any
-		 * parameter changes, and none of our own parameter changes affect
-		 * input expressions of the aggregated functions, then we can just
-		 * rescan the existing hash table; no need to build it again.
+		 * If we do have the hash table, it holds all the groups, none having
+		 * been spilled, and the subplan does not have any parameter changes,
+		 * then we can just rescan the existing hash table; no need to build
+		 * it again.  The parameters changed are those of the vectoragg: the
+		 * Agg is not in the plan tree.
 		 */
-		if (outerPlan->chgParam == NULL &&
-			!bms_overlap(node->ss.ps.chgParam, aggnode->aggParams))
+		if (outerPlan->chgParam == NULL && vas->spillslot == NULL &&
+			!bms_overlap(vas->css.ss.ps.chgParam, aggnode->aggParams))
 		{
-			ResetTupleHashIterator(node->hashtable, &node->hashiter);
+			VResetTupleHashIterator(vas->hashtable);
 			return;
 		}
 	}
@@ -3925,21 +4784,22 @@ ExecReScanAgg(AggState *node)
 	}
 
 	/*
-	 * We don't need to ReScanExprContext the output tuple context here;
-	 * ExecReScan already did it. But we do need to reset our per-grouping-set
-	 * contexts, which may have transvalues stored in them. (We use rescan
-	 * rather than just reset because transfns may have registered callbacks
-	 * that need to be run now.)
+	 * ExecReScan reset the output tuple context of the vectoragg, not that
+	 * of the Agg, which the batches returned were projected in.  We also
+	 * need to reset our per-grouping-set contexts, which may have transvalues
+	 * stored in them. (We use rescan rather than just reset because transfns
+	 * may have registered callbacks that need to be run now.)
 	 *
 	 * Note that with AGG_HASHED, the hash table is allocated in a sub-context
 	 * of the aggcontext. This used to be an issue, but now, resetting a
 	 * context automatically deletes sub-contexts too.
 	 */
-
+	ReScanExprContext(econtext);
 	for (setno = 0; setno < numGroupingSets; setno++)
 	{
 		ReScanExprContext(node->aggcontexts[setno]);
 	}
+	VExecClearTuple(vas->resultSlot);
 
 	/* Release first tuple of group, if we have made a copy */
 	if (node->grp_firstTuple != NULL)
@@ -3955,8 +4815,10 @@ ExecReScanAgg(AggState *node)
 
 	if (aggnode->aggstrategy == AGG_HASHED)
 	{
-		/* Rebuild an empty hash table */
-		build_hash_table(node);
+		/* the partitions spilled are left unread, the table is refilled */
+		agg_close_spill(vas);
+		build_hash_table(vas,
+						 ((VectorTupleSlot *) vas->resultSlot)->batchsize);
 		node->table_filled = false;
 	}
 	else
@@ -3972,6 +4834,16 @@ ExecReScanAgg(AggState *node)
 
 		node->input_done = false;
 		node->projected_set = -1;
+
+		/* the run carried over, and the keys of the last row, are gone */
+		if (aggnode->aggstrategy == AGG_SORTED)
+		{
+			vas->runs->haslast = false;
+			vas->sortcarried = false;
+			vas->sortfirst = NULL;
+			MemoryContextReset(vas->sortcxt[0]);
+			MemoryContextReset(vas->sortcxt[1]);
+		}
 	}
 
 	if (outerPlan->chgParam == NULL)
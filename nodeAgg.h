@@ -14,6 +14,9 @@
 #define VECTOR_ENGINE_NODE_AGG_H
 
 #include "nodes/plannodes.h"
+#include "storage/buffile.h"
+
+#include "execGrouping.h"
 
 /*
  * VectorAggState - state object of vectoragg on executor.
@@ -25,6 +28,48 @@ typedef struct VectorAggState
 	/* Attributes for vectorization */
 	AggState		*aggstate;
 	TupleTableSlot	*resultSlot;
+
+	/* AGG_HASHED: the groups, and the group of each row of a batch */
+	VTupleHashTable	hashtable;
+	int				*hashgroups;
+	int				*hashnewrows;
+
+	/*
+	 * AGG_HASHED and AGG_SORTED: per transition, the values of the groups
+	 * by number, and whether they are still null, see VAggGroups
+	 */
+	Datum			**transvalues;
+	bool			**transnulls;
+	int				maxgroups;
+
+	/*
+	 * AGG_HASHED: spilling of the input of the groups beyond work_mem to
+	 * partition files, aggregated once the table in memory is done with.
+	 */
+	Size			hashmem;		/* first tuples and by-ref trans values */
+	Size			**transspace;	/* per by-ref transition, by group */
+	int				spilldepth;		/* of the input being aggregated */
+	BufFile			**spillfiles;	/* by partition, of spilldepth + 1 */
+	bool			*spillcols;		/* the input columns written to them */
+	List			*spillpending;	/* partitions left to aggregate */
+	BufFile			*spillinput;	/* the partition being aggregated */
+	TupleTableSlot	*spillslot;		/* batches read from spillinput */
+	MemoryContext	spillcxt;		/* their pass-by-reference values */
+
+	/*
+	 * AGG_SORTED: the groups of a batch are its runs of equal keys, with
+	 * their transition values in transvalues by run number.  The last run
+	 * is carried over to the next batch, as its run 0 if it goes on.  The
+	 * runs a batch starts keep their values and first tuples in one of
+	 * sortcxt, the other one holding those of the carried run.
+	 */
+	VTupleRuns		runs;
+	int				*sortgroups;	/* run of each row of a batch */
+	int				*sortstarts;	/* first row of each run */
+	bool			sortcarried;	/* whether a run is carried over */
+	MinimalTuple	sortfirst;		/* first tuple of the carried run */
+	MemoryContext	sortcxt[2];
+	int				sortcur;		/* sortcxt of the carried run */
 } VectorAggState;
 
 extern CustomScan *MakeCustomScanForAgg(void);
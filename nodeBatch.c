@@ -0,0 +1,225 @@
+/*-------------------------------------------------------------------------
+ *
+ * nodeBatch.c
+ *	  The reverse of unbatch: gather the rows of a row based plan, such as
+ *	  a Sort, into batches for the vectorized nodes above it.
+ *
+ * Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "executor/executor.h"
+#include "executor/nodeCustom.h"
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+#include "nodeBatch.h"
+#include "execTuples.h"
+#include "vtype/vtype.h"
+#include "utils.h"
+#include "vectorTupleSlot.h"
+
+
+/*
+ * BatchState - state object of batch on executor.
+ */
+typedef struct BatchState
+{
+	CustomScanState	css;
+
+	/* per column of the batch, whether its values are copied */
+	bool		   *copyvalue;
+	int16		   *typlen;
+	MemoryContext	batchcxt;	/* pass-by-reference values of a batch */
+} BatchState;
+
+static Node *CreateBatchState(CustomScan *custom_plan);
+/* CustomScanExecMethods */
+static void BeginBatch(CustomScanState *node, EState *estate, int eflags);
+static TupleTableSlot *ExecBatch(CustomScanState *node);
+static void EndBatch(CustomScanState *node);
+static void ReScanBatch(CustomScanState *node);
+
+static CustomScanMethods	batch_methods = {
+	"batch",			/* CustomName */
+	CreateBatchState,	/* CreateCustomScanState */
+};
+
+static CustomExecMethods	batch_exec_methods = {
+	"batch",			/* CustomName */
+	BeginBatch,			/* BeginCustomScan */
+	ExecBatch,			/* ExecCustomScan */
+	EndBatch,			/* EndCustomScan */
+	ReScanBatch,		/* ReScanCustomScan */
+	NULL,				/* MarkPosCustomScan */
+	NULL,				/* RestrPosCustomScan */
+	NULL,				/* EstimateDSMCustomScan */
+	NULL,				/* InitializeDSMCustomScan */
+	NULL,				/* InitializeWorkerCustomScan */
+	NULL,				/* ExplainCustomScan */
+};
+
+static void
+BeginBatch(CustomScanState *node, EState *estate, int eflags)
+{
+	BatchState *bs = (BatchState *) node;
+	CustomScan *cscan = (CustomScan *) node->ss.ps.plan;
+	TupleTableSlot *slot;
+	TupleDesc	tupdesc;
+	int			i;
+
+	outerPlanState(bs) = ExecInitNode(outerPlan(cscan), estate, eflags);
+
+	/* Convert Ntype in tupdesc to Vtype in batch Node */
+	tupdesc = CreateTupleDescCopy(outerPlanState(bs)->ps_ResultTupleSlot->tts_tupleDescriptor);
+	bs->copyvalue = palloc(sizeof(bool) * tupdesc->natts);
+	bs->typlen = palloc(sizeof(int16) * tupdesc->natts);
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = tupdesc->attrs[i];
+		Oid			typid = GetVtype(attr->atttypid);
+
+		/* the values of the native columns are stored, not pointed to */
+		bs->copyvalue[i] = !attr->attbyval && vtype_elemlen(attr->atttypid) == 0;
+		bs->typlen[i] = attr->attlen;
+		if (typid != InvalidOid)
+			attr->atttypid = typid;
+	}
+
+	slot = VExecInitExtraTupleSlot(estate, GetCustomScanBatchSize(cscan));
+	ExecSetSlotDescriptor(slot, tupdesc);
+	InitializeVectorSlotColumn((VectorTupleSlot *) slot);
+	node->ss.ps.ps_ResultTupleSlot = slot;
+
+	bs->batchcxt = AllocSetContextCreate(CurrentMemoryContext,
+										 "Batch values",
+										 ALLOCSET_DEFAULT_SIZES);
+}
+
+/*
+ * Fill the result slot with the next batchsize rows of the outer plan.
+ * The pass-by-reference values are copied, the row they are in being
+ * gone once the next one is fetched; they last until the next batch.
+ */
+static TupleTableSlot *
+ExecBatch(CustomScanState *node)
+{
+	BatchState *bs = (BatchState *) node;
+	TupleTableSlot *slot = node->ss.ps.ps_ResultTupleSlot;
+	VectorTupleSlot *vslot = (VectorTupleSlot *) slot;
+	int			natts = slot->tts_tupleDescriptor->natts;
+	MemoryContext oldcontext;
+	int			row;
+	int			i;
+
+	VExecClearTuple(slot);
+	MemoryContextReset(bs->batchcxt);
+	for (i = 0; i < natts; i++)
+		vtype_clearnulls((vtype *) DatumGetPointer(slot->tts_values[i]),
+						 vslot->batchsize);
+
+	oldcontext = MemoryContextSwitchTo(bs->batchcxt);
+	for (row = 0; row < vslot->batchsize; row++)
+	{
+		TupleTableSlot *rowslot = ExecProcNode(outerPlanState(bs));
+
+		if (TupIsNull(rowslot))
+			break;
+		slot_getallattrs(rowslot);
+
+		for (i = 0; i < natts; i++)
+		{
+			vtype	   *column = (vtype *) DatumGetPointer(slot->tts_values[i]);
+
+			if (rowslot->tts_isnull[i])
+				VTYPE_SETNULL(column, row);
+			else if (bs->copyvalue[i])
+				vtype_setdatum(column, row,
+							   datumCopy(rowslot->tts_values[i], false,
+										 bs->typlen[i]));
+			else
+				vtype_setdatum(column, row, rowslot->tts_values[i]);
+		}
+	}
+	MemoryContextSwitchTo(oldcontext);
+
+	if (row == 0)
+		return NULL;
+
+	for (i = 0; i < natts; i++)
+		((vtype *) DatumGetPointer(slot->tts_values[i]))->dim = row;
+	vslot->dim = row;
+	Vslot_selectall(slot);
+	slot->tts_isempty = false;
+	slot->tts_nvalid = natts;
+
+	return slot;
+}
+
+static void
+EndBatch(CustomScanState *node)
+{
+	BatchState *bs = (BatchState *) node;
+
+	ExecEndNode(outerPlanState(bs));
+	MemoryContextDelete(bs->batchcxt);
+}
+
+static void
+ReScanBatch(CustomScanState *node)
+{
+	BatchState *bs = (BatchState *) node;
+	PlanState  *outerPlan = outerPlanState(bs);
+
+	VExecClearTuple(node->ss.ps.ps_ResultTupleSlot);
+	MemoryContextReset(bs->batchcxt);
+
+	/*
+	 * if chgParam of subnode is not null then plan will be re-scanned by
+	 * first ExecProcNode.
+	 */
+	if (outerPlan->chgParam == NULL)
+		ExecReScan(outerPlan);
+}
+
+
+static Node *
+CreateBatchState(CustomScan *custom_plan)
+{
+	BatchState *bs = palloc0(sizeof(BatchState));
+
+	NodeSetTag(bs, T_CustomScanState);
+	bs->css.methods = &batch_exec_methods;
+
+	return (Node *) &bs->css;
+}
+
+
+/*
+ * Add batch Node at top to make tuples to batch
+ */
+Plan *
+AddBatchNodeAtTop(Plan *node)
+{
+	CustomScan *convert = makeNode(CustomScan);
+
+	convert->methods = &batch_methods;
+	convert->scan.plan.targetlist = BuildVarTargetList(node->targetlist,
+													   OUTER_VAR);
+	convert->scan.plan.lefttree = node;
+	convert->scan.plan.righttree = NULL;
+	return &convert->scan.plan;
+}
+
+/*
+ * Initialize batch CustomScan node.
+ */
+void
+InitBatch(void)
+{
+	RegisterCustomScanMethods(&batch_methods);
+}
@@ -0,0 +1,21 @@
+/*-------------------------------------------------------------------------
+ *
+ * nodeBatch.h
+ *	  gather the rows of a row based plan into batches
+ *
+ *
+ * Copyright (c) 2019-Present Pivotal Software, Inc.
+ *
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef VECTOR_ENGINE_NODE_BATCH_H
+#define VECTOR_ENGINE_NODE_BATCH_H
+
+#include "nodes/plannodes.h"
+
+extern Plan *AddBatchNodeAtTop(Plan *node);
+extern void InitBatch(void);
+
+#endif   /* VECTOR_ENGINE_NODE_BATCH_H */
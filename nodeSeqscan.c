@@ -26,15 +26,22 @@
  */
 #include "postgres.h"
 
+#include "access/parallel.h"
 #include "access/relscan.h"
+#include "access/sysattr.h"
 #include "executor/execdebug.h"
 #include "executor/nodeSeqscan.h"
+#include "pgstat.h"
+#include "storage/bufmgr.h"
 #include "utils/rel.h"
 
 /*-------------------------- Vectorize part of nodeSeqScan ---------------------------------*/
 #include "nodes/extensible.h"
 #include "executor/nodeCustom.h"
+#include "optimizer/clauses.h"
+#include "optimizer/var.h"
 #include "utils/memutils.h"
+#include "catalog/pg_type.h"
 
 #include "executor.h"
 #include "execTuples.h"
@@ -52,15 +59,30 @@ static void BeginVectorScan(CustomScanState *node, EState *estate, int eflags);
 static void ReScanVectorScan(CustomScanState *node);
 static TupleTableSlot *ExecVectorScan(CustomScanState *node);
 static void EndVectorScan(CustomScanState *node);
-
-static SeqScanState *VExecInitSeqScan(SeqScan *node, EState *estate, int eflags);
+static Size EstimateDSMVectorScan(CustomScanState *node,
+								  ParallelContext *pcxt);
+static void InitializeDSMVectorScan(CustomScanState *node,
+									ParallelContext *pcxt,
+									void *coordinate);
+static void InitializeWorkerVectorScan(CustomScanState *node,
+									   shm_toc *toc,
+									   void *coordinate);
+
+static SeqScanState *VExecInitSeqScan(SeqScan *node, EState *estate, int eflags,
+									  int batchsize);
 static TupleTableSlot *VExecSeqScan(VectorScanState *vss);
 static void VExecEndSeqScan(VectorScanState *vss);
 static void VExecReScanSeqScan(VectorScanState *vss);
 
 static void VInitScanRelation(SeqScanState *node, EState *estate, int eflags);
 static TupleTableSlot *VSeqNext(VectorScanState *vss);
+static void VSeqFillFromPage(HeapScanDesc scan, VectorTupleSlot *vslot);
 static bool VSeqRecheck(VectorScanState *node, TupleTableSlot *slot);
+static bool *VSeqNeededAttrs(CustomScan *cscan, SeqScan *node, int natts);
+static bool *VSeqExprAttrs(Node *expr, Index scanrelid, int natts);
+static VectorScanFilter *VSeqMakeFilter(Expr *clause, Index scanrelid,
+										int natts);
+static bool VSeqFilter(VectorScanState *vss, TupleTableSlot *slot);
 
 static CustomScanMethods	vectorscan_scan_methods = {
 	"vectorscan",			/* CustomName */
@@ -75,9 +97,9 @@ static CustomExecMethods	vectorscan_exec_methods = {
 	ReScanVectorScan,		/* ReScanCustomScan */
 	NULL,					/* MarkPosCustomScan */
 	NULL,					/* RestrPosCustomScan */
-	NULL,					/* EstimateDSMCustomScan */
-	NULL,					/* InitializeDSMCustomScan */
-	NULL,					/* InitializeWorkerCustomScan */
+	EstimateDSMVectorScan,	/* EstimateDSMCustomScan */
+	InitializeDSMVectorScan,	/* InitializeDSMCustomScan */
+	InitializeWorkerVectorScan,	/* InitializeWorkerCustomScan */
 	NULL,					/* ExplainCustomScan */
 };
 
@@ -112,6 +134,11 @@ BeginVectorScan(CustomScanState *css, EState *estate, int eflags)
 	VectorScanState *vss;
 	CustomScan  *cscan;
 	SeqScan		*node;
+	List		*quals;
+	List		*qualexprs = NIL;
+	VExprCSE	*cse;
+	ListCell	*lc;
+	int			natts;
 	
 	/* clear state initialized in ExecInitCustomScan */
 	ClearCustomScanState(css);
@@ -122,7 +149,72 @@ BeginVectorScan(CustomScanState *css, EState *estate, int eflags)
 	vss = (VectorScanState*)css;
 	vss->scanFinish = false;
 
-	vss->seqstate = VExecInitSeqScan(node, estate, eflags);
+	vss->seqstate = VExecInitSeqScan(node, estate, eflags,
+									 GetCustomScanBatchSize(cscan));
+	natts = RelationGetDescr(vss->seqstate->ss.ss_currentRelation)->natts;
+	vss->attrneeded = VSeqNeededAttrs(cscan, node, natts);
+
+	/*
+	 * Simple comparisons are taken out of the qual and evaluated by
+	 * VSeqNext itself, see VSeqFilter.
+	 */
+	vss->filters = NIL;
+	quals = NIL;
+	foreach(lc, vss->seqstate->ss.ps.qual)
+	{
+		ExprState		 *clause = (ExprState *) lfirst(lc);
+		VectorScanFilter *filter;
+
+		filter = VSeqMakeFilter(clause->expr, node->scanrelid, natts);
+		if (filter != NULL)
+			vss->filters = lappend(vss->filters, filter);
+		else
+			quals = lappend(quals, clause);
+	}
+	vss->seqstate->ss.ps.qual = quals;
+
+	/* columns each operator materializes before reading the batch */
+	vss->projattrs = VSeqExprAttrs((Node *) node->plan.targetlist,
+								   node->scanrelid, natts);
+
+	/*
+	 * The clauses and targetlist that can be run as vector programs.  A
+	 * batch that reaches the projection went through every clause, so the
+	 * projection may read what they computed; the clauses themselves share
+	 * nothing with each other, as they are run in any order and stop at
+	 * the first one that drops the whole batch.
+	 */
+	foreach(lc, quals)
+		qualexprs = lappend(qualexprs, ((ExprState *) lfirst(lc))->expr);
+	cse = VExecInitCSE(lappend(list_copy(qualexprs), node->plan.targetlist));
+	vss->clauses = NIL;
+	foreach(lc, quals)
+	{
+		ExprState		 *clause = (ExprState *) lfirst(lc);
+		VectorScanClause *vclause = palloc0(sizeof(VectorScanClause));
+
+		vclause->clause = clause;
+		/* a division by a column may be guarded by a clause before it */
+		vclause->stats.fixed = contain_leaked_vars((Node *) clause->expr);
+		vclause->prog = VExecCompileExpr(clause->expr, cse);
+		vclause->attrs = VSeqExprAttrs((Node *) clause->expr,
+									   node->scanrelid, natts);
+		vss->clauses = lappend(vss->clauses, vclause);
+	}
+	foreach(lc, vss->clauses)
+	{
+		VectorScanClause *vclause = (VectorScanClause *) lfirst(lc);
+
+		if (vclause->prog != NULL)
+			VExecShareProgram(cse, vclause->prog);
+	}
+	vss->projection = NULL;
+	if (vss->seqstate->ss.ps.ps_ProjInfo != NULL)
+		vss->projection =
+			VExecBuildProjection(node->plan.targetlist,
+								 vss->seqstate->ss.ps.ps_ExprContext,
+								 vss->seqstate->ss.ps.ps_ProjInfo->pi_slot,
+								 cse);
 
 	vss->css.ss.ps.ps_ResultTupleSlot = vss->seqstate->ss.ps.ps_ResultTupleSlot;
 }
@@ -165,6 +257,64 @@ EndVectorScan(CustomScanState *node)
 	VExecEndSeqScan((VectorScanState *)node);
 }
 
+/*
+ * EstimateDSMVectorScan - A method of CustomScanState; that estimates the
+ * amount of dynamic shared memory the parallel heap scan needs.
+ *
+ * Derived from ExecSeqScanEstimate().
+ */
+static Size
+EstimateDSMVectorScan(CustomScanState *node, ParallelContext *pcxt)
+{
+	EState	   *estate = node->ss.ps.state;
+
+	return heap_parallelscan_estimate(estate->es_snapshot);
+}
+
+/*
+ * InitializeDSMVectorScan - A method of CustomScanState; that sets up the
+ * shared parallel heap scan descriptor in the leader.  Workers and leader
+ * then hand out heap blocks from the same descriptor, so every VSeqNext
+ * fills its batch from the blocks this process was given.
+ *
+ * Derived from ExecSeqScanInitializeDSM().
+ */
+static void
+InitializeDSMVectorScan(CustomScanState *node,
+						ParallelContext *pcxt,
+						void *coordinate)
+{
+	VectorScanState		*vss = (VectorScanState *) node;
+	SeqScanState		*seqstate = vss->seqstate;
+	EState				*estate = node->ss.ps.state;
+	ParallelHeapScanDesc pscan = (ParallelHeapScanDesc) coordinate;
+
+	heap_parallelscan_initialize(pscan,
+								 seqstate->ss.ss_currentRelation,
+								 estate->es_snapshot);
+	seqstate->ss.ss_currentScanDesc =
+		heap_beginscan_parallel(seqstate->ss.ss_currentRelation, pscan);
+}
+
+/*
+ * InitializeWorkerVectorScan - A method of CustomScanState; that attaches
+ * a parallel worker to the shared heap scan descriptor.
+ *
+ * Derived from ExecSeqScanInitializeWorker().
+ */
+static void
+InitializeWorkerVectorScan(CustomScanState *node,
+						   shm_toc *toc,
+						   void *coordinate)
+{
+	VectorScanState		*vss = (VectorScanState *) node;
+	SeqScanState		*seqstate = vss->seqstate;
+	ParallelHeapScanDesc pscan = (ParallelHeapScanDesc) coordinate;
+
+	seqstate->ss.ss_currentScanDesc =
+		heap_beginscan_parallel(seqstate->ss.ss_currentRelation, pscan);
+}
+
 /*
  * Interface to get the custom scan plan for vector scan
  */
@@ -241,53 +391,306 @@ VSeqNext(VectorScanState *vss)
 		VExecClearTuple(slot);
 		return slot;
 	}
-	VExecClearTuple(slot);
 
-	/* fetch a batch of rows and fill them into VectorTupleSlot */
-	for (row = 0 ; row < BATCHSIZE; row++)
+	for (;;)
 	{
-		/*
-		 * get the next tuple from the table
-		 */
-		tuple = heap_getnext(scandesc, direction);
+		VExecClearTuple(slot);
+
+		/* fetch a batch of rows and fill them into VectorTupleSlot */
+		while (vslot->dim < vslot->batchsize)
+		{
+			/*
+			 * get the next tuple from the table
+			 */
+			tuple = heap_getnext(scandesc, direction);
+
+			/*
+			 * save the tuple and the buffer returned to us by the access methods in
+			 * our scan tuple slot and return the slot.  Note: we pass 'false' because
+			 * tuples returned by heap_getnext() are pointers onto disk pages and were
+			 * not created with palloc() and so should not be pfree()'d.  Note also
+			 * that ExecStoreTuple will increment the refcount of the buffer; the
+			 * refcount will not be dropped until the tuple table slot is cleared.
+			 */
+			if (tuple)
+				VExecStoreTuple(tuple,	/* tuple to store */
+						slot,	/* slot to store in */
+						scandesc->rs_cbuf,		/* buffer associated with this
+												 * tuple */
+						false);	/* don't pfree this pointer */
+			else
+			{
+				/* scan finish, but we still need to emit current vslot */
+				vss->scanFinish = true;
+				break;
+			}
+
+			/*
+			 * heap_getnext() has just made the page current, so take the rest of
+			 * its visible tuples in one step.  The buffer pin taken above covers
+			 * all of them.
+			 */
+			if (scandesc->rs_pageatatime &&
+				scandesc->rs_nkeys == 0 &&
+				ScanDirectionIsForward(direction))
+				VSeqFillFromPage(scandesc, vslot);
+		}
+		row = vslot->dim;
+
+		if (row == 0)
+			break;
 
 		/*
-		 * save the tuple and the buffer returned to us by the access methods in
-		 * our scan tuple slot and return the slot.  Note: we pass 'false' because
-		 * tuples returned by heap_getnext() are pointers onto disk pages and were
-		 * not created with palloc() and so should not be pfree()'d.  Note also
-		 * that ExecStoreTuple will increment the refcount of the buffer; the
-		 * refcount will not be dropped until the tuple table slot is cleared.
+		 * generate virtual tuple.  Columns are not deformed here, each one is
+		 * extracted when an operator first reads it, and only for the rows
+		 * not filtered out by then.
 		 */
-		if (tuple)
-			VExecStoreTuple(tuple,	/* tuple to store */
-					slot,	/* slot to store in */
-					scandesc->rs_cbuf,		/* buffer associated with this
-											 * tuple */
-					false);	/* don't pfree this pointer */
-		else
-		{
-			/* scan finish, but we still need to emit current vslot */
-			vss->scanFinish = true;
+		vslot->dim = row;
+		Vslot_selectall(slot);
+
+		Vslot_setlazy(slot, vss->attrneeded);
+		ExecStoreVirtualTuple(slot);
+
+		if (vss->filters == NIL || VSeqFilter(vss, slot) || vss->scanFinish)
 			break;
-		}
+
+		/* the filters dropped the whole batch, go on with the next one */
 	}
 
+	return slot;
+}
+
+/*
+ * VSeqFilter
+ *
+ *		Evaluate the simple comparisons taken out of the qual on the batch
+ *		just fetched.  Each one deforms only its own column, for the rows
+ *		the filters before it kept, and drops the failing rows from the
+ *		selection.  Null results are failures as in VExecScanQual.
+ *
+ *		Returns false if no row of the batch survived.
+ */
+static bool
+VSeqFilter(VectorScanState *vss, TupleTableSlot *slot)
+{
+	ExprContext		*econtext = vss->seqstate->ss.ps.ps_ExprContext;
+	MemoryContext	oldContext;
+	ListCell		*lc;
+	bool			found = true;
+
 	/*
-	 * deform and generate virtual tuple
-	 * TODO: late deform to avoid deform unneccessary columns.
+	 * The kernel results live in per-tuple memory.  Nothing of the batch
+	 * has been evaluated yet, so free what the dropped batches left.
 	 */
-	if (row > 0)
+	ResetExprContext(econtext);
+	oldContext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+
+	foreach(lc, vss->filters)
 	{
-		vslot->dim = row;
-		memset(vslot->skip, false, sizeof(bool) * row);
-		
-		/* deform the vector slot now */
-		Vslot_getallattrs(slot);
-		ExecStoreVirtualTuple(slot);
+		VectorScanFilter *filter = (VectorScanFilter *) lfirst(lc);
+		FunctionCallInfo fcinfo = &filter->fcinfo;
+		vbool		   *result;
+		instr_time		start;
+		int				rowsin = ((VectorTupleSlot *) slot)->sel.nrows;
+		int				rowsout;
+
+		INSTR_TIME_SET_CURRENT(start);
+
+		Vslot_getattrs(slot, filter->attrs);
+
+		fcinfo->arg[0] = slot->tts_values[filter->attnum - 1];
+		fcinfo->isnull = false;
+		result = (vbool *) DatumGetPointer(FunctionCallInvoke(fcinfo));
+
+		rowsout = Vslot_applyfilter(slot, result, false);
+		VExecCountClause(&filter->stats, rowsin, rowsout, &start);
+		found = (rowsout > 0);
+		if (!found)
+			break;
 	}
 
-	return slot;
+	MemoryContextSwitchTo(oldContext);
+
+	/* the filters that drop the most rows for their cost go first */
+	VExecOrderClauses(vss->filters);
+
+	return found;
+}
+
+/*
+ * VSeqFillFromPage
+ *
+ *		Move the remaining visible tuples of the scan's current page into
+ *		the vector slot, until the page or the batch is exhausted.
+ *
+ *		This relies on page-at-a-time mode: heapgetpage() has already
+ *		checked visibility of the whole page and saved the offsets of the
+ *		visible tuples in rs_vistuples, so we just read the line pointers.
+ *		rs_cindex is advanced past the tuples we took, and the next call of
+ *		heap_getnext() continues from there as if it had returned them.
+ */
+static void
+VSeqFillFromPage(HeapScanDesc scan, VectorTupleSlot *vslot)
+{
+	Page		dp;
+	BlockNumber	page;
+	Oid			relid;
+	int			lineindex;
+	int			ntup;
+	int			i;
+
+	dp = BufferGetPage(scan->rs_cbuf);
+	page = scan->rs_cblock;
+	relid = RelationGetRelid(scan->rs_rd);
+	lineindex = scan->rs_cindex + 1;
+	ntup = Min(scan->rs_ntuples - lineindex, vslot->batchsize - vslot->dim);
+
+	for (i = 0; i < ntup; i++, lineindex++)
+	{
+		OffsetNumber	lineoff = scan->rs_vistuples[lineindex];
+		ItemId			lpp = PageGetItemId(dp, lineoff);
+		HeapTuple		tuple = &vslot->tts_tuples[vslot->dim++];
+
+		tuple->t_data = (HeapTupleHeader) PageGetItem(dp, lpp);
+		tuple->t_len = ItemIdGetLength(lpp);
+		ItemPointerSet(&tuple->t_self, page, lineoff);
+		tuple->t_tableOid = relid;
+	}
+
+	if (ntup > 0)
+	{
+		scan->rs_cindex = lineindex - 1;
+
+		/* heap_getnext() counts every tuple it returns, so do we */
+		if (scan->rs_rd->pgstat_info != NULL)
+			scan->rs_rd->pgstat_info->t_counts.t_tuples_returned += ntup;
+	}
+}
+
+/*
+ * VSeqNeededAttrs
+ *
+ *		Work out which columns of the relation the batch must carry.  The
+ *		planner leaves the attributes read by the parent node in
+ *		custom_private, after the batch size; otherwise it is whatever our
+ *		own targetlist and qual reference.
+ */
+static bool *
+VSeqNeededAttrs(CustomScan *cscan, SeqScan *node, int natts)
+{
+	bool	   *needed;
+	ListCell   *lc;
+	int			i;
+
+	if (list_length(cscan->custom_private) < 2)
+	{
+		List	   *exprs = list_concat(list_copy(node->plan.targetlist),
+										list_copy(node->plan.qual));
+
+		return VSeqExprAttrs((Node *) exprs, node->scanrelid, natts);
+	}
+
+	needed = palloc0(sizeof(bool) * natts);
+	foreach(lc, (List *) lsecond(cscan->custom_private))
+	{
+		AttrNumber	attnum = lfirst_int(lc);
+
+		if (attnum == InvalidAttrNumber)
+		{
+			for (i = 0; i < natts; i++)
+				needed[i] = true;
+			break;
+		}
+		if (attnum > 0 && attnum <= natts)
+			needed[attnum - 1] = true;
+	}
+
+	return needed;
+}
+
+/*
+ * VSeqExprAttrs
+ *
+ *		Return the columns of the scanned relation referenced by 'expr',
+ *		as an array of natts flags.  A whole-row reference needs every
+ *		column.
+ */
+static bool *
+VSeqExprAttrs(Node *expr, Index scanrelid, int natts)
+{
+	bool	   *attrs = palloc0(sizeof(bool) * natts);
+	Bitmapset  *varattnos = NULL;
+	int			attno;
+	int			i;
+
+	pull_varattnos(expr, scanrelid, &varattnos);
+
+	attno = -1;
+	while ((attno = bms_next_member(varattnos, attno)) >= 0)
+	{
+		AttrNumber	attnum = attno + FirstLowInvalidHeapAttributeNumber;
+
+		if (attnum == InvalidAttrNumber)
+		{
+			for (i = 0; i < natts; i++)
+				attrs[i] = true;
+			break;
+		}
+		if (attnum > 0 && attnum <= natts)
+			attrs[attnum - 1] = true;
+	}
+
+	return attrs;
+}
+
+/*
+ * VSeqMakeFilter
+ *
+ *		If the qual clause is a comparison of one of our columns with a
+ *		non-null constant, set up its vectorized operator function to be
+ *		called by VSeqFilter.  Otherwise return NULL and the clause stays
+ *		in the qual.  The constant may be a scalar expression, which is
+ *		evaluated here once for the scan.
+ */
+static VectorScanFilter *
+VSeqMakeFilter(Expr *clause, Index scanrelid, int natts)
+{
+	VectorScanFilter *filter;
+	OpExpr	   *op;
+	Var		   *var;
+	Const	   *con;
+
+	if (!IsA(clause, OpExpr))
+		return NULL;
+
+	op = (OpExpr *) clause;
+	if (list_length(op->args) != 2 || op->opresulttype != GetVtype(BOOLOID))
+		return NULL;
+
+	var = (Var *) linitial(op->args);
+	if (!IsA(var, Var))
+		return NULL;
+	con = VExecFoldConst((Expr *) lsecond(op->args));
+	if (con == NULL || con->constisnull)
+		return NULL;
+	if (var->varno != scanrelid || var->varlevelsup != 0 ||
+		var->varattno <= 0 || var->varattno > natts)
+		return NULL;
+
+	filter = palloc0(sizeof(VectorScanFilter));
+	filter->attnum = var->varattno;
+	filter->attrs = palloc0(sizeof(bool) * natts);
+	filter->attrs[var->varattno - 1] = true;
+
+	fmgr_info(op->opfuncid, &filter->flinfo);
+	fmgr_info_set_expr((Node *) op, &filter->flinfo);
+	InitFunctionCallInfoData(filter->fcinfo, &filter->flinfo, 2,
+							 op->inputcollid, NULL, NULL);
+	filter->fcinfo.arg[1] = con->constvalue;
+	filter->fcinfo.argnull[0] = false;
+	filter->fcinfo.argnull[1] = false;
+
+	return filter;
 }
 
 /*
@@ -374,7 +777,7 @@ VInitScanRelation(SeqScanState *node, EState *estate, int eflags)
  * ----------------------------------------------------------------
  */
 static SeqScanState *
-VExecInitSeqScan(SeqScan *node, EState *estate, int eflags)
+VExecInitSeqScan(SeqScan *node, EState *estate, int eflags, int batchsize)
 {
 	SeqScanState *scanstate;
 
@@ -412,8 +815,8 @@ VExecInitSeqScan(SeqScan *node, EState *estate, int eflags)
 	/*
 	 * tuple table initialization
 	 */
-	VExecInitResultTupleSlot(estate, &scanstate->ss.ps);
-	VExecInitScanTupleSlot(estate, &scanstate->ss);
+	VExecInitResultTupleSlot(estate, &scanstate->ss.ps, batchsize);
+	VExecInitScanTupleSlot(estate, &scanstate->ss, batchsize);
 
 	/*
 	 * initialize scan relation
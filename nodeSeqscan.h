@@ -8,9 +8,51 @@
 #ifndef VECTOR_ENGINE_NODE_SCAN_H
 #define VECTOR_ENGINE_NODE_SCAN_H
 
+#include "fmgr.h"
 #include "nodes/execnodes.h"
 #include "nodes/plannodes.h"
 
+#include "execProgram.h"
+
+/*
+ * VectorQualStats - what was observed of a qual clause on the batches it
+ * ran on, to run first the clauses that drop the most rows for the least
+ * time.  It is the first field of the clauses of both kinds below, see
+ * VExecOrderClauses.
+ */
+typedef struct VectorQualStats
+{
+	int			nbatches;		/* batches it was run on */
+	double		selectivity;	/* average fraction of active rows kept */
+	double		rowcost;		/* average time per active row, in usecs */
+	bool		fixed;			/* may raise an error, so not moved ahead */
+} VectorQualStats;
+
+/*
+ * VectorScanFilter - a simple "Var op Const" qual clause evaluated by the
+ * scan itself as soon as the column it compares is deformed, before any
+ * other column of the batch is touched.
+ */
+typedef struct VectorScanFilter
+{
+	VectorQualStats stats;
+	AttrNumber	attnum;			/* column compared */
+	bool	   *attrs;			/* the same, as Vslot_getattrs argument */
+	FmgrInfo	flinfo;			/* vectorized comparison function */
+	FunctionCallInfoData fcinfo;	/* call info, the constant preloaded */
+} VectorScanFilter;
+
+/*
+ * VectorScanClause - any other qual clause, see VExecScanQual.
+ */
+typedef struct VectorScanClause
+{
+	VectorQualStats stats;
+	ExprState  *clause;
+	VExprProgram *prog;			/* the clause compiled, or NULL */
+	bool	   *attrs;			/* columns it reads */
+} VectorScanClause;
+
 /*
  * VectorScanState - state object of vectorscan on executor.
  */
@@ -21,6 +63,11 @@ typedef struct VectorScanState
 	/* Attributes for vectorization */
 	SeqScanState	*seqstate;
 	bool		scanFinish;
+	bool	   *attrneeded;		/* columns deformed into the batch */
+	List	   *filters;		/* quals evaluated while deforming */
+	List	   *clauses;		/* the rest of the qual, VectorScanClauses */
+	bool	   *projattrs;		/* columns read by the projection */
+	VExprProjection *projection;	/* compiled targetlist, or NULL */
 } VectorScanState;
 
 extern CustomScan *MakeCustomScanForSeqScan(void);
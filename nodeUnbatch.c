@@ -9,6 +9,8 @@
 
 #include "postgres.h"
 
+#include <limits.h>
+
 #include "fmgr.h"
 #include "optimizer/planner.h"
 #include "executor/nodeCustom.h"
@@ -40,6 +42,7 @@ static bool ReadNextVectorSlot(UnbatchState *ubs);
 static void BeginUnbatch(CustomScanState *node, EState *estate, int eflags);
 static TupleTableSlot *ExecUnbatch(CustomScanState *node);
 static void EndUnbatch(CustomScanState *node);
+static void ReScanUnbatch(CustomScanState *node);
 
 static CustomScanMethods	unbatch_methods = {
 	"unbatch",			/* CustomName */
@@ -51,7 +54,7 @@ static CustomExecMethods	unbatch_exec_methods = {
 	BeginUnbatch,		/* BeginCustomScan */
 	ExecUnbatch,			/* ExecCustomScan */
 	EndUnbatch,			/* EndCustomScan */
-	NULL,					/* ReScanCustomScan */
+	ReScanUnbatch,		/* ReScanCustomScan */
 	NULL,					/* MarkPosCustomScan */
 	NULL,					/* RestrPosCustomScan */
 	NULL,					/* EstimateDSMCustomScan */
@@ -84,7 +87,8 @@ BeginUnbatch(CustomScanState *node, EState *estate, int eflags)
 		ExecSetSlotDescriptor(node->ss.ps.ps_ResultTupleSlot, tupdesc);
 	}
 
-	vcs->ps_ResultVTupleSlot = VExecInitExtraTupleSlot(estate);
+	vcs->ps_ResultVTupleSlot = VExecInitExtraTupleSlot(estate,
+												GetCustomScanBatchSize(cscan));
 	vcs->ps_ResultVTupleSlot->tts_tupleDescriptor = CreateTupleDescCopy(outerPlanState(vcs)->ps_ResultTupleSlot->tts_tupleDescriptor);
 }
 
@@ -94,26 +98,34 @@ FetchRowFromBatch(UnbatchState *ubs)
 	VectorTupleSlot    *vslot;
 	TupleTableSlot	   *slot;
 	int					iter;
+	int					row;
 	int					natts;
 	int					i;
 
 	
 	slot = ubs->css.ss.ps.ps_ResultTupleSlot;
 	vslot = (VectorTupleSlot *)ubs->ps_ResultVTupleSlot;
+	/* iter walks the selection, not the rows of the batch */
 	iter = ubs->iter;
 
-	while(iter < BATCHSIZE && vslot->skip[iter])
-		iter++;
-	
-	/* we have checked that natts is greater than zero */
-	if (iter == BATCHSIZE)
+	if (iter >= VSEL_NROWS(&vslot->sel, vslot->dim))
 		return NULL;
+	row = VSEL_ROW(&vslot->sel, iter);
 
 	ExecClearTuple(slot);
 	natts = slot->tts_tupleDescriptor->natts;
 	for(i = 0; i < natts; i++)
 	{
-		slot->tts_values[i] = ((vtype*)(vslot->tts.tts_values[i]))->values[iter];
+		vtype	   *column = (vtype *) DatumGetPointer(vslot->tts.tts_values[i]);
+
+		/* the value of a null row is whatever the buffer held before */
+		if (column->hasnull && VTYPE_ISNULL(column, row))
+		{
+			slot->tts_values[i] = (Datum) 0;
+			slot->tts_isnull[i] = true;
+			continue;
+		}
+		slot->tts_values[i] = vtype_getdatum(column, row);
 		slot->tts_isnull[i] = false;
 	}
 
@@ -159,8 +171,8 @@ ReadNextVectorSlot(UnbatchState *ubs)
 	if(TupIsNull(slot))
 		return false;
 
-	/* Make sure the tuple is fully deconstructed */
-	slot_getallattrs(slot);
+	/* Make sure the batch is fully deconstructed */
+	Vslot_getallattrs(slot);
 
 	ubs->ps_ResultVTupleSlot = slot;
 	ubs->iter = 0;
@@ -177,6 +189,24 @@ EndUnbatch(CustomScanState *node)
 	ExecEndNode(outerPlan);
 }
 
+static void
+ReScanUnbatch(CustomScanState *node)
+{
+	UnbatchState *ubs = (UnbatchState *) node;
+	PlanState  *outerPlan = outerPlanState(ubs);
+
+	/* the rows left of the batch held are not returned */
+	ExecClearTuple(node->ss.ps.ps_ResultTupleSlot);
+	ubs->iter = INT_MAX;
+
+	/*
+	 * if chgParam of subnode is not null then plan will be re-scanned by
+	 * first ExecProcNode.
+	 */
+	if (outerPlan->chgParam == NULL)
+		ExecReScan(outerPlan);
+}
+
 
 static Node *
 CreateUnbatchState(CustomScan *custom_plan)
@@ -198,11 +228,23 @@ AddUnbatchNodeAtTop(Plan *node)
 {
     CustomScan *convert = makeNode(CustomScan);
     convert->methods = &unbatch_methods;
+	convert->scan.plan.targetlist = BuildVarTargetList(node->targetlist,
+													   OUTER_VAR);
 	convert->scan.plan.lefttree = node;
     convert->scan.plan.righttree = NULL;
 	return &convert->scan.plan;
 }
 
+/*
+ * Is node an unbatch node, returning rows
+ */
+bool
+IsUnbatchNode(Plan *node)
+{
+	return IsA(node, CustomScan) &&
+		((CustomScan *) node)->methods == &unbatch_methods;
+}
+
 /*
  * Initialize vectorscan CustomScan node.
  */
@@ -14,6 +14,7 @@
 #define VCONVERT_H
 
 extern Plan *AddUnbatchNodeAtTop(Plan *node);
+extern bool IsUnbatchNode(Plan *node);
 extern void InitUnbatch(void);
 
 #endif   /* GPVECTOR_H */
@@ -8,6 +8,7 @@
  */
 #include "postgres.h"
 #include "access/htup.h"
+#include "access/sysattr.h"
 #include "catalog/pg_collation.h"
 #include "catalog/pg_operator.h"
 #include "catalog/pg_type.h"
@@ -15,10 +16,12 @@
 #include "miscadmin.h"
 #include "access/htup_details.h"
 #include "nodes/nodeFuncs.h"
+#include "optimizer/clauses.h"
 #include "optimizer/var.h"
 #include "parser/parse_oper.h"
 #include "parser/parse_func.h"
 #include "parser/parse_coerce.h"
+#include "parser/parsetree.h"
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
 #include "nodes/primnodes.h"
@@ -26,17 +29,86 @@
 #include "nodes/relation.h"
 #include "nodes/nodes.h"
 #include "nodes/parsenodes.h"
+#include "storage/buf.h"
 #include "utils/acl.h"
 #include "utils/lsyscache.h"
 #include "utils/syscache.h"
+#include "utils/typcache.h"
 
 #include "plan.h"
 #include "nodeSeqscan.h"
 #include "nodeAgg.h"
+#include "nodeUnbatch.h"
+#include "nodeBatch.h"
 #include "utils.h"
+#include "vtype/vtype.h"
 
 static void mutate_plan_fields(Plan *newplan, Plan *oldplan, Node *(*mutator) (), void *context);
 static Node * plan_tree_mutator(Node *node, Node *(*mutator) (), void *context);
+static Plan *ReplaceRowPlanNode(Plan *plan);
+static void PushDownNeededAttrs(Plan *parent, Plan *child,
+								int numCols, AttrNumber *colIdx);
+
+/*
+ * Tell the vectorscan below 'parent' which relation attributes feed the
+ * columns the parent reads, so that the scan only deforms those.  Without
+ * this the scan falls back to the Vars of its own targetlist and qual,
+ * which for a physical tlist means every column.
+ *
+ * The result is saved in custom_private of the vectorscan as the integer
+ * list of attribute numbers.  SetPlanBatchSize later puts the batch size
+ * in front of it.
+ */
+static void
+PushDownNeededAttrs(Plan *parent, Plan *child, int numCols, AttrNumber *colIdx)
+{
+	CustomScan	*cscan;
+	SeqScan		*scan;
+	Bitmapset	*outerattrs = NULL;
+	Bitmapset	*scanattrs = NULL;
+	List		*attrs = NIL;
+	int			attno;
+	int			i;
+
+	if (child == NULL || !IsA(child, CustomScan))
+		return;
+
+	cscan = (CustomScan *) child;
+	if (cscan->custom_plans == NIL)
+		return;
+	scan = (SeqScan *) linitial(cscan->custom_plans);
+	if (!IsA(scan, SeqScan))
+		return;
+
+	pull_varattnos((Node *) parent->targetlist, OUTER_VAR, &outerattrs);
+	pull_varattnos((Node *) parent->qual, OUTER_VAR, &outerattrs);
+	for (i = 0; i < numCols; i++)
+		outerattrs = bms_add_member(outerattrs,
+						colIdx[i] - FirstLowInvalidHeapAttributeNumber);
+
+	attno = -1;
+	while ((attno = bms_next_member(outerattrs, attno)) >= 0)
+	{
+		AttrNumber	resno = attno + FirstLowInvalidHeapAttributeNumber;
+		TargetEntry	*tle;
+
+		/* whole-row reference of the scan output, keep the default */
+		if (resno <= 0)
+			return;
+
+		tle = get_tle_by_resno(scan->plan.targetlist, resno);
+		if (tle == NULL)
+			elog(ERROR, "could not find scan column %d", resno);
+		pull_varattnos((Node *) tle->expr, scan->scanrelid, &scanattrs);
+	}
+	pull_varattnos((Node *) scan->plan.qual, scan->scanrelid, &scanattrs);
+
+	attno = -1;
+	while ((attno = bms_next_member(scanattrs, attno)) >= 0)
+		attrs = lappend_int(attrs, attno + FirstLowInvalidHeapAttributeNumber);
+
+	cscan->custom_private = list_make1(attrs);
+}
 
 /*
  * We check the expressions tree recursively becuase the args can be a sub expression,
@@ -50,7 +122,148 @@ typedef struct VectorizedContext
 }VectorizedContext;
 
 static Oid getNodeReturnType(Node *node);
+static bool IsConstantSubexpr(Node *node);
+static Expr *MakeVectorBoolCall(const char *name, Oid argtype, List *args);
+static Expr *MakeVectorCondCall(const char *name, Oid type, Oid collid,
+								List *args);
+static Node *ReplaceCaseTestMutator(Node *node, Expr *arg);
+static bool PlanReturnsBatches(Plan *plan);
+
+/*
+ * Whether 'node' is an expression without Vars, so of the same value for
+ * every row of a batch.  Such a subtree is not vectorized but left to the
+ * scalar functions: the vectorized operator above it takes the value as
+ * its constant argument, like with a Const, and the executor evaluates it
+ * once at startup, see VExecFoldConst.
+ */
+static bool
+IsConstantSubexpr(Node *node)
+{
+	switch (nodeTag(node))
+	{
+		case T_OpExpr:
+		case T_FuncExpr:
+		case T_RelabelType:
+		case T_CoerceViaIO:
+		case T_Param:
+		case T_BoolExpr:
+		case T_NullTest:
+		case T_BooleanTest:
+		case T_CaseExpr:
+		case T_CoalesceExpr:
+		case T_NullIfExpr:
+		case T_ScalarArrayOpExpr:
+			break;
+		default:
+			return false;
+	}
+
+	return !contain_var_clause(node) &&
+		   !contain_agg_clause(node) &&
+		   !contain_volatile_functions(node) &&
+		   !expression_returns_set(node);
+}
+
+
+/*
+ * A call of the vectorized function 'name', declared with argtype for each
+ * of its arguments, for a BoolExpr, BooleanTest or NullTest.  These have
+ * no operator to look up, and the executor's own nodes for them expect
+ * scalar bools, so they become calls of the functions in vtype/vbool.c.
+ */
+static Expr *
+MakeVectorBoolCall(const char *name, Oid argtype, List *args)
+{
+	Oid			argtypes[2];
+	Oid			funcid;
+	ListCell   *lc;
+	int			nargs = 0;
+
+	Assert(list_length(args) <= 2);
+	foreach(lc, args)
+	{
+		Oid			type = exprType((Node *) lfirst(lc));
+
+		if (GetNtype(type) == InvalidOid ||
+			(argtype != GetVtype(ANYOID) && type != argtype))
+			elog(ERROR, "Cannot vectorize %s of type %d", name, type);
+		argtypes[nargs++] = argtype;
+	}
+
+	funcid = LookupFuncName(list_make1(makeString((char *) name)),
+							nargs, argtypes, false);
+
+	return (Expr *) makeFuncExpr(funcid, GetVtype(BOOLOID), args,
+								 InvalidOid, InvalidOid,
+								 COERCE_EXPLICIT_CALL);
+}
+
+/*
+ * A call of vtype_case or vtype_coalesce of vtype/vcase.c, for a CaseExpr,
+ * CoalesceExpr or NullIfExpr of 'type'.  Their value arguments are vtypes
+ * or scalars of 'type', the first argument of vtype_case is a vbool.
+ */
+static Expr *
+MakeVectorCondCall(const char *name, Oid type, Oid collid, List *args)
+{
+	Oid			vtype = GetVtype(type);
+	Oid			argtypes[3];
+	Oid			funcid;
+	ListCell   *lc;
+	int			nargs = 0;
+
+	if (InvalidOid == vtype)
+		elog(ERROR, "Cannot find vtype for type %d", type);
+
+	Assert(list_length(args) <= 3);
+	foreach(lc, args)
+	{
+		Oid			argtype = exprType((Node *) lfirst(lc));
+
+		if (nargs == 0 && strcmp(name, "vtype_case") == 0)
+		{
+			if (argtype != GetVtype(BOOLOID))
+				elog(ERROR, "Cannot vectorize CASE condition of type %d", argtype);
+			argtypes[nargs++] = argtype;
+			continue;
+		}
+		if (argtype != type && argtype != vtype)
+			elog(ERROR, "Cannot vectorize %s of type %d", name, argtype);
+		argtypes[nargs++] = GetVtype(ANYOID);
+	}
+
+	funcid = LookupFuncName(list_make1(makeString((char *) name)),
+							nargs, argtypes, false);
+
+	return (Expr *) makeFuncExpr(funcid, vtype, args, collid, InvalidOid,
+								 COERCE_EXPLICIT_CALL);
+}
+
+/*
+ * Put 'arg' of a CASE arg WHEN ... in place of the CaseTestExprs standing
+ * for it in its WHEN clauses.  Those under a nested CASE are the nested
+ * one's, except in its own arg.
+ */
+static Node *
+ReplaceCaseTestMutator(Node *node, Expr *arg)
+{
+	if (node == NULL)
+		return NULL;
+
+	if (IsA(node, CaseTestExpr))
+		return (Node *) copyObject(arg);
+
+	if (IsA(node, CaseExpr))
+	{
+		CaseExpr   *newnode = (CaseExpr *) copyObject(node);
 
+		newnode->arg = (Expr *) ReplaceCaseTestMutator((Node *) newnode->arg,
+													   arg);
+		return (Node *) newnode;
+	}
+
+	return expression_tree_mutator(node, ReplaceCaseTestMutator, (void *) arg);
+}
 
 static Oid
 getNodeReturnType(Node *node)
@@ -63,8 +276,15 @@ getNodeReturnType(Node *node)
 			return ((Const*)node)->consttype;
 		case T_OpExpr:
 			return ((OpExpr*)node)->opresulttype;
+		case T_FuncExpr:
+			/* one of MakeVectorBoolCall or MakeVectorCondCall */
+			if (GetNtype(((FuncExpr *) node)->funcresulttype) != InvalidOid)
+				return ((FuncExpr *) node)->funcresulttype;
+			/* fall through */
 		default:
 		{
+			if (IsConstantSubexpr(node))
+				return exprType(node);
 			elog(ERROR, "Node return type %d not supported", nodeTag(node));
 		}
 	}
@@ -82,6 +302,9 @@ VectorizeMutator(Node *node, VectorizedContext *ctx)
 	if(NULL == node)
 		return NULL;
 
+	if (IsConstantSubexpr(node))
+		return (Node *) copyObject(node);
+
 	//check the type of Var if it can be vectorized
 	switch (nodeTag(node))
 	{
@@ -189,6 +412,239 @@ VectorizeMutator(Node *node, VectorizedContext *ctx)
 				return (Node *)newnode;
 			}
 
+		case T_BoolExpr:
+			{
+				BoolExpr   *newnode;
+				Oid			vbool = GetVtype(BOOLOID);
+				const char *fname;
+				Expr	   *result;
+				ListCell   *lc;
+
+				newnode = (BoolExpr *) plan_tree_mutator(node, VectorizeMutator, ctx);
+				if (newnode->boolop == NOT_EXPR)
+					return (Node *) MakeVectorBoolCall("vbool_not", vbool,
+													   newnode->args);
+
+				/* AND and OR become a chain of binary calls, left to right */
+				fname = (newnode->boolop == AND_EXPR) ? "vbool_and" : "vbool_or";
+				result = (Expr *) linitial(newnode->args);
+				for_each_cell(lc, lnext(list_head(newnode->args)))
+					result = MakeVectorBoolCall(fname, vbool,
+												list_make2(result, lfirst(lc)));
+				return (Node *) result;
+			}
+
+		case T_NullTest:
+			{
+				NullTest   *newnode;
+
+				newnode = (NullTest *) plan_tree_mutator(node, VectorizeMutator, ctx);
+				if (newnode->argisrow)
+					elog(ERROR, "Row NullTest not supported");
+
+				return (Node *) MakeVectorBoolCall(newnode->nulltesttype == IS_NULL ?
+												   "vtype_is_null" : "vtype_is_not_null",
+												   GetVtype(ANYOID),
+												   list_make1(newnode->arg));
+			}
+
+		case T_BooleanTest:
+			{
+				BooleanTest *newnode;
+				const char *fname = NULL;
+
+				newnode = (BooleanTest *) plan_tree_mutator(node, VectorizeMutator, ctx);
+				switch (newnode->booltesttype)
+				{
+					case IS_TRUE:
+						fname = "vbool_is_true";
+						break;
+					case IS_NOT_TRUE:
+						fname = "vbool_is_not_true";
+						break;
+					case IS_FALSE:
+						fname = "vbool_is_false";
+						break;
+					case IS_NOT_FALSE:
+						fname = "vbool_is_not_false";
+						break;
+					case IS_UNKNOWN:
+						fname = "vbool_is_unknown";
+						break;
+					case IS_NOT_UNKNOWN:
+						fname = "vbool_is_not_unknown";
+						break;
+				}
+				if (fname == NULL)
+					elog(ERROR, "BooleanTest type %d not supported",
+						 (int) newnode->booltesttype);
+
+				return (Node *) MakeVectorBoolCall(fname, GetVtype(BOOLOID),
+												   list_make1(newnode->arg));
+			}
+
+		case T_CaseExpr:
+			{
+				CaseExpr   *caseexpr = (CaseExpr *) node;
+				CaseExpr   *newnode;
+				Expr	   *result;
+				ListCell   *lc;
+				int			i;
+
+				/* CASE arg WHEN v tests arg = v, arg being a CaseTestExpr */
+				if (caseexpr->arg != NULL)
+				{
+					if (contain_volatile_functions((Node *) caseexpr->arg))
+						elog(ERROR, "CASE of a volatile expression not supported");
+
+					caseexpr = (CaseExpr *) copyObject(caseexpr);
+					foreach(lc, caseexpr->args)
+					{
+						CaseWhen   *when = (CaseWhen *) lfirst(lc);
+
+						when->expr = (Expr *)
+							ReplaceCaseTestMutator((Node *) when->expr,
+												   caseexpr->arg);
+					}
+					caseexpr->arg = NULL;
+				}
+
+				newnode = (CaseExpr *) plan_tree_mutator((Node *) caseexpr,
+														 VectorizeMutator, ctx);
+
+				/*
+				 * A chain of calls, one per WHEN clause, the first one
+				 * outermost, so that the rows a WHEN clause matches are not
+				 * looked at by those after it.
+				 */
+				result = newnode->defresult;
+				if (result == NULL)
+					result = (Expr *) makeNullConst(newnode->casetype, -1,
+													newnode->casecollid);
+				for (i = list_length(newnode->args) - 1; i >= 0; i--)
+				{
+					CaseWhen   *when = (CaseWhen *) list_nth(newnode->args, i);
+
+					result = MakeVectorCondCall("vtype_case", newnode->casetype,
+												newnode->casecollid,
+												list_make3(when->expr,
+														   when->result,
+														   result));
+				}
+				return (Node *) result;
+			}
+
+		case T_CoalesceExpr:
+			{
+				CoalesceExpr *newnode;
+				Expr	   *result;
+				int			i;
+
+				newnode = (CoalesceExpr *) plan_tree_mutator(node, VectorizeMutator, ctx);
+
+				/* a chain of binary calls, nested to the right */
+				result = (Expr *) llast(newnode->args);
+				for (i = list_length(newnode->args) - 2; i >= 0; i--)
+				{
+					Expr	   *arg = (Expr *) list_nth(newnode->args, i);
+
+					/* the scalar tail of the arguments stays a scalar COALESCE */
+					if (GetNtype(exprType((Node *) arg)) == InvalidOid &&
+						GetNtype(exprType((Node *) result)) == InvalidOid)
+					{
+						CoalesceExpr *tail = makeNode(CoalesceExpr);
+
+						tail->coalescetype = newnode->coalescetype;
+						tail->coalescecollid = newnode->coalescecollid;
+						tail->args = list_make2(arg, result);
+						tail->location = -1;
+						result = (Expr *) tail;
+						continue;
+					}
+					result = MakeVectorCondCall("vtype_coalesce",
+												newnode->coalescetype,
+												newnode->coalescecollid,
+												list_make2(arg, result));
+				}
+				return (Node *) result;
+			}
+
+		case T_NullIfExpr:
+			{
+				NullIfExpr *nullif = (NullIfExpr *) node;
+				OpExpr	   *eq;
+
+				/* NULLIF(a, b) is CASE WHEN a = b THEN NULL ELSE a END */
+				eq = (OpExpr *) make_opclause(nullif->opno, BOOLOID, false,
+											  (Expr *) copyObject(linitial(nullif->args)),
+											  (Expr *) copyObject(lsecond(nullif->args)),
+											  InvalidOid, nullif->inputcollid);
+				eq->opfuncid = nullif->opfuncid;
+				eq = (OpExpr *) VectorizeMutator((Node *) eq, ctx);
+
+				return (Node *) MakeVectorCondCall("vtype_case",
+												   nullif->opresulttype,
+												   nullif->opcollid,
+												   list_make3(eq,
+															  makeNullConst(nullif->opresulttype,
+																			-1,
+																			nullif->opcollid),
+															  copyObject(linitial(eq->args))));
+			}
+
+		case T_ScalarArrayOpExpr:
+			{
+				ScalarArrayOpExpr *newnode;
+				Expr	   *arg;
+				Const	   *array;
+				Oid			ltype;
+				Oid			rtype;
+				Oid			eqop;
+				Oid			argtypes[2];
+				Oid			funcid;
+				Expr	   *result;
+
+				newnode = (ScalarArrayOpExpr *) plan_tree_mutator(node, VectorizeMutator, ctx);
+				arg = (Expr *) linitial(newnode->args);
+				array = (Const *) lsecond(newnode->args);
+
+				/*
+				 * x IN (...) and x NOT IN (...), on a list of constants of
+				 * a type equal when its values are, see vtype/vin.c.  The
+				 * operator must be the equality of the default btree opclass
+				 * of the type, or its negator, whatever its name.
+				 */
+				op_input_types(newnode->opno, &ltype, &rtype);
+				eqop = lookup_type_cache(ltype, TYPECACHE_EQ_OPR)->eq_opr;
+				if (ltype != rtype ||
+					(ltype != INT2OID && ltype != INT4OID && ltype != INT8OID &&
+					 ltype != DATEOID && ltype != TIMESTAMPOID) ||
+					!OidIsValid(eqop) ||
+					newnode->opno != (newnode->useOr ? eqop : get_negator(eqop)))
+					elog(ERROR, "ScalarArrayOpExpr operator %d not supported",
+						 newnode->opno);
+				if (!IsA(array, Const) || array->constisnull)
+					elog(ERROR, "ScalarArrayOpExpr on a non constant array not supported");
+				if (exprType((Node *) arg) != GetVtype(ltype))
+					elog(ERROR, "Cannot vectorize ScalarArrayOpExpr of type %d",
+						 exprType((Node *) arg));
+
+				argtypes[0] = GetVtype(ANYOID);
+				argtypes[1] = ANYARRAYOID;
+				funcid = LookupFuncName(list_make1(makeString("vtype_in_array")),
+										2, argtypes, false);
+				result = (Expr *) makeFuncExpr(funcid, GetVtype(BOOLOID),
+											   list_make2(arg, array),
+											   InvalidOid, newnode->inputcollid,
+											   COERCE_EXPLICIT_CALL);
+
+				/* x <> ALL(...) is NOT (x = ANY(...)), nulls included */
+				if (!newnode->useOr)
+					result = MakeVectorBoolCall("vbool_not", GetVtype(BOOLOID),
+												list_make1(result));
+				return (Node *) result;
+			}
+
 		default:
 			return plan_tree_mutator(node, VectorizeMutator, ctx);
 	}
@@ -260,6 +716,21 @@ plan_tree_mutator(Node *node,
 				FLATCOPY(vscan, node, SeqScan);
 				cscan->custom_plans = lappend(cscan->custom_plans, vscan);
 
+				/* what EXPLAIN shows the node scans and returns */
+				cscan->custom_relids = bms_make_singleton(vscan->scanrelid);
+				cscan->custom_scan_tlist =
+					(List *) copyObject(((Plan *) node)->targetlist);
+				cscan->scan.plan.targetlist =
+					BuildVarTargetList(cscan->custom_scan_tlist, INDEX_VAR);
+
+				/*
+				 * A partial seqscan below Gather must stay parallel aware;
+				 * the executor looks the shared scan descriptor up by the
+				 * plan node id.
+				 */
+				cscan->scan.plan.parallel_aware = vscan->plan.parallel_aware;
+				cscan->scan.plan.plan_node_id = vscan->plan.plan_node_id;
+
 				SCANMUTATE(vscan, node);
 				return (Node *)cscan;
 			}
@@ -269,16 +740,86 @@ plan_tree_mutator(Node *node,
 				CustomScan	*cscan;
 				Agg			*vagg;
 	
-				if (((Agg *)node)->aggstrategy != AGG_PLAIN && ((Agg *)node)->aggstrategy != AGG_HASHED)
+				if (((Agg *)node)->aggstrategy != AGG_PLAIN &&
+					((Agg *)node)->aggstrategy != AGG_HASHED &&
+					((Agg *)node)->aggstrategy != AGG_SORTED)
 					elog(ERROR, "Non plain agg is not supported");
+				/*
+				 * The vectorized transition states are not those of the
+				 * rows, which the other half of a split aggregation reads:
+				 * it is left to the row engine, over a vectorized input.
+				 */
+				if (((Agg *)node)->aggsplit != AGGSPLIT_SIMPLE)
+				{
+					Agg		   *newnode;
+					Plan	   *vplan;
+
+					FLATCOPY(newnode, node, Agg);
+					MUTATE(vplan, outerPlan(node), Plan *);
+					outerPlan(newnode) = UnbatchPlan(vplan);
+					return (Node *) newnode;
+				}
+				if (((Agg *)node)->aggstrategy == AGG_SORTED &&
+					((Agg *)node)->groupingSets != NIL)
+					elog(ERROR, "sorted agg of grouping sets is not supported");
 
 				cscan = MakeCustomScanForAgg();
 				FLATCOPY(vagg, node, Agg);
 				cscan->custom_plans = lappend(cscan->custom_plans, vagg);
 
+				/* what EXPLAIN shows the node returns */
+				cscan->custom_scan_tlist =
+					(List *) copyObject(((Plan *) node)->targetlist);
+				cscan->scan.plan.targetlist =
+					BuildVarTargetList(cscan->custom_scan_tlist, INDEX_VAR);
+
 				SCANMUTATE(vagg, node);
+
+				/*
+				 * An input left to the row engine, as the Sort below a
+				 * sorted aggregate, is gathered into batches.
+				 */
+				if (!PlanReturnsBatches(vagg->plan.lefttree))
+					vagg->plan.lefttree = AddBatchNodeAtTop(vagg->plan.lefttree);
+				PushDownNeededAttrs((Plan *) vagg, vagg->plan.lefttree,
+									vagg->numCols, vagg->grpColIdx);
 				return (Node *)cscan;
 			}
+
+		case T_Gather:
+			{
+				Gather	   *gather = (Gather *) node;
+				Gather	   *newnode;
+				Plan	   *vplan;
+
+				/*
+				 * Workers return rows to the leader through tuple queues,
+				 * so the vectorized subtree is ended by an unbatch node.
+				 * Gather itself keeps its row based targetlist and qual.
+				 */
+				FLATCOPY(newnode, gather, Gather);
+				MUTATE(vplan, outerPlan(gather), Plan *);
+				outerPlan(newnode) = UnbatchPlan(vplan);
+				return (Node *) newnode;
+			}
+
+		case T_Sort:
+			{
+				Sort	   *sort = (Sort *) node;
+				Sort	   *newnode;
+				Plan	   *vplan;
+
+				/*
+				 * Sorting is left to the row engine, over an unbatch node.
+				 * A sorted aggregate above it puts its rows back into
+				 * batches.
+				 */
+				FLATCOPY(newnode, sort, Sort);
+				MUTATE(vplan, outerPlan(sort), Plan *);
+				outerPlan(newnode) = UnbatchPlan(vplan);
+				return (Node *) newnode;
+			}
+
 		case T_Const:
 			{
 				Const	   *oldnode = (Const *) node;
@@ -317,6 +858,79 @@ plan_tree_mutator(Node *node,
 				return (Node *)newnode;
 			}
 
+		case T_BoolExpr:
+			{
+				BoolExpr   *expr = (BoolExpr *) node;
+				BoolExpr   *newnode;
+
+				FLATCOPY(newnode, expr, BoolExpr);
+				MUTATE(newnode->args, expr->args, List *);
+				return (Node *) newnode;
+			}
+
+		case T_NullTest:
+			{
+				NullTest   *ntest = (NullTest *) node;
+				NullTest   *newnode;
+
+				FLATCOPY(newnode, ntest, NullTest);
+				MUTATE(newnode->arg, ntest->arg, Expr *);
+				return (Node *) newnode;
+			}
+
+		case T_BooleanTest:
+			{
+				BooleanTest *btest = (BooleanTest *) node;
+				BooleanTest *newnode;
+
+				FLATCOPY(newnode, btest, BooleanTest);
+				MUTATE(newnode->arg, btest->arg, Expr *);
+				return (Node *) newnode;
+			}
+
+		case T_ScalarArrayOpExpr:
+			{
+				ScalarArrayOpExpr *expr = (ScalarArrayOpExpr *) node;
+				ScalarArrayOpExpr *newnode;
+
+				FLATCOPY(newnode, expr, ScalarArrayOpExpr);
+				MUTATE(newnode->args, expr->args, List *);
+				return (Node *) newnode;
+			}
+
+		case T_CaseExpr:
+			{
+				CaseExpr   *caseexpr = (CaseExpr *) node;
+				CaseExpr   *newnode;
+
+				FLATCOPY(newnode, caseexpr, CaseExpr);
+				MUTATE(newnode->arg, caseexpr->arg, Expr *);
+				MUTATE(newnode->args, caseexpr->args, List *);
+				MUTATE(newnode->defresult, caseexpr->defresult, Expr *);
+				return (Node *) newnode;
+			}
+
+		case T_CaseWhen:
+			{
+				CaseWhen   *casewhen = (CaseWhen *) node;
+				CaseWhen   *newnode;
+
+				FLATCOPY(newnode, casewhen, CaseWhen);
+				MUTATE(newnode->expr, casewhen->expr, Expr *);
+				MUTATE(newnode->result, casewhen->result, Expr *);
+				return (Node *) newnode;
+			}
+
+		case T_CoalesceExpr:
+			{
+				CoalesceExpr *coalesceexpr = (CoalesceExpr *) node;
+				CoalesceExpr *newnode;
+
+				FLATCOPY(newnode, coalesceexpr, CoalesceExpr);
+				MUTATE(newnode->args, coalesceexpr->args, List *);
+				return (Node *) newnode;
+			}
+
 		case T_List:
 			{
 				/*
@@ -395,11 +1009,192 @@ mutate_plan_fields(Plan *newplan, Plan *oldplan, Node *(*mutator) (), void *cont
 	newplan->allParam = bms_copy(oldplan->allParam);
 }
 
+/*
+ * Check whether there is a Gather node in the plan tree.
+ */
+bool
+PlanTreeHasGather(Plan *plan)
+{
+	if (plan == NULL)
+		return false;
+
+	if (IsA(plan, Gather))
+		return true;
+
+	return PlanTreeHasGather(outerPlan(plan)) ||
+		   PlanTreeHasGather(innerPlan(plan));
+}
+
+/*
+ * Whether a plan returned by VectorizeMutator returns batches.  The nodes
+ * kept on the row engine, which are not CustomScans, and unbatch nodes
+ * return rows.
+ */
+static bool
+PlanReturnsBatches(Plan *plan)
+{
+	return IsA(plan, CustomScan) && !IsUnbatchNode(plan);
+}
+
+/*
+ * Convert the batches of a vectorized plan to rows, if it returns any.
+ */
+Plan *
+UnbatchPlan(Plan *plan)
+{
+	if (!PlanReturnsBatches(plan))
+		return plan;
+
+	return AddUnbatchNodeAtTop(plan);
+}
+
+/*
+ * Nodes above a Gather consume the rows coming out of the tuple queues, so
+ * they are kept on the row engine.  Subtrees without Gather below them are
+ * still vectorized and converted back to rows by an unbatch node.
+ */
+static Plan *
+ReplaceRowPlanNode(Plan *plan)
+{
+	Plan	   *newplan;
+
+	if (plan == NULL)
+		return NULL;
+
+	if (IsA(plan, Gather))
+		return (Plan *) plan_tree_mutator((Node *) plan, VectorizeMutator, NULL);
+
+	if (!PlanTreeHasGather(plan))
+		return UnbatchPlan((Plan *) plan_tree_mutator((Node *) plan,
+													  VectorizeMutator,
+													  NULL));
+
+	newplan = (Plan *) copyObject(plan);
+	outerPlan(newplan) = ReplaceRowPlanNode(outerPlan(plan));
+	innerPlan(newplan) = ReplaceRowPlanNode(innerPlan(plan));
+
+	return newplan;
+}
+
 /*
  * Replace the non-vectorirzed type to vectorized type
  */
 Plan* 
 ReplacePlanNodeWalker(Node *node)
 {
+	if (PlanTreeHasGather((Plan *) node))
+		return ReplaceRowPlanNode((Plan *) node);
+
 	return (Plan *)plan_tree_mutator(node, VectorizeMutator, NULL);
 }
+
+/*
+ * The batch size is picked so that the tuple slots, columns and
+ * intermediate results of one batch fit this much of L2 cache.
+ */
+#define BATCH_CACHE_BUDGET		(256 * 1024)
+#define MIN_BATCHSIZE			64
+
+typedef struct BatchSizeContext
+{
+	int			nvectors;		/* columns and intermediate results */
+	int			tuplewidth;		/* bytes of tuple data read per row */
+} BatchSizeContext;
+
+static bool
+CountVectorsWalker(Node *node, BatchSizeContext *ctx)
+{
+	if (node == NULL)
+		return false;
+
+	/* a scalar, see IsConstantSubexpr */
+	if (IsConstantSubexpr(node))
+		return false;
+
+	/* every one of these is a vtype of a batch */
+	if (IsA(node, Var) || IsA(node, OpExpr) || IsA(node, FuncExpr) ||
+		IsA(node, Aggref))
+		ctx->nvectors++;
+
+	return expression_tree_walker(node, CountVectorsWalker, (void *) ctx);
+}
+
+static void
+CountPlanVectors(Plan *plan, BatchSizeContext *ctx)
+{
+	ListCell   *lc;
+
+	if (plan == NULL)
+		return;
+
+	if (IsA(plan, CustomScan))
+	{
+		foreach(lc, ((CustomScan *) plan)->custom_plans)
+			CountPlanVectors((Plan *) lfirst(lc), ctx);
+	}
+	else
+	{
+		CountVectorsWalker((Node *) plan->targetlist, ctx);
+		CountVectorsWalker((Node *) plan->qual, ctx);
+		if (IsA(plan, SeqScan))
+			ctx->tuplewidth += plan->plan_width;
+	}
+
+	CountPlanVectors(outerPlan(plan), ctx);
+	CountPlanVectors(innerPlan(plan), ctx);
+}
+
+/*
+ * Pick the batch size of a vectorized plan from the number of vtypes its
+ * expressions produce and the width of the tuples it scans.  Narrow plans
+ * get large batches, wide plans with many intermediates small ones.
+ */
+int
+ChooseBatchSize(Plan *plan)
+{
+	BatchSizeContext ctx;
+	Size		rowbytes;
+	int			batchsize;
+
+	ctx.nvectors = 0;
+	ctx.tuplewidth = 0;
+	CountPlanVectors(plan, &ctx);
+
+	/* slot arrays, then one value and null flag per vtype, then the tuple */
+	rowbytes = sizeof(HeapTupleData) + sizeof(Buffer) + sizeof(bool);
+	rowbytes += ctx.nvectors * (sizeof(Datum) + sizeof(bool));
+	rowbytes += ctx.tuplewidth;
+
+	batchsize = MIN_BATCHSIZE;
+	while (batchsize * 2 <= MAX_BATCHSIZE &&
+		   batchsize * 2 * rowbytes <= BATCH_CACHE_BUDGET)
+		batchsize *= 2;
+
+	return batchsize;
+}
+
+/*
+ * Set the batch size of every vectorized node of the plan, as the first
+ * element of its custom_private.
+ */
+void
+SetPlanBatchSize(Plan *plan, int batchsize)
+{
+	ListCell   *lc;
+
+	if (plan == NULL)
+		return;
+
+	if (IsA(plan, CustomScan))
+	{
+		CustomScan *cscan = (CustomScan *) plan;
+
+		cscan->custom_private = lcons(makeInteger(batchsize),
+									  cscan->custom_private);
+		foreach(lc, cscan->custom_plans)
+			SetPlanBatchSize((Plan *) lfirst(lc), batchsize);
+	}
+
+	SetPlanBatchSize(outerPlan(plan), batchsize);
+	SetPlanBatchSize(innerPlan(plan), batchsize);
+}
@@ -7,5 +7,9 @@
 
 
 extern Plan* ReplacePlanNodeWalker(Node *node);
+extern bool PlanTreeHasGather(Plan *plan);
+extern Plan *UnbatchPlan(Plan *plan);
+extern int ChooseBatchSize(Plan *plan);
+extern void SetPlanBatchSize(Plan *plan, int batchsize);
 
 #endif /* VECTOR_ENGINE_PLAN_H_ */
@@ -12,6 +12,12 @@ INSERT INTO t1 SELECT generate_series(1,3), 2.3;
 INSERT INTO t1 SELECT generate_series(1,3), 3.3;
 INSERT INTO t1 SELECT generate_series(1,3), 4.3;
 VACUUM ANALYZE t1;
+CREATE TABLE t2 (k int, v int, pad text) WITH (autovacuum_enabled = false);
+INSERT INTO t2 SELECT i % 3000, i, repeat('x', 20) FROM generate_series(1, 9000) i;
+CREATE TABLE t4 (k int, x int, y double precision);
+INSERT INTO t4 VALUES (1, NULL, NULL), (2, 1, 1.5), (3, 2, 2.5),
+	(1, NULL, NULL), (2, NULL, NULL), (3, 3, 0.5);
+VACUUM ANALYZE t4;
 
 create extension vectorize_engine;
 SET enable_vectorize_engine TO on;
@@ -21,6 +27,89 @@ SELECT b+1 FROM t1;
 SELECT count(b) FROM t1;
 SELECT a, sum(b), avg(b)  FROM t1 group by a;
 SELECT a, sum(b), avg(b)  FROM t1 where a < 3 group by a;
+SELECT b, count(a) FROM t1 GROUP BY b;
+SET vectorize_batch_size TO 2;
+SELECT a, sum(a), count(b) FROM t1 GROUP BY a;
+RESET vectorize_batch_size;
+SELECT a > 1, count(b) FROM t1 GROUP BY 1;
+SET enable_sort TO off;
+SELECT k, count(x), sum(x), sum(y), avg(y) FROM t4 GROUP BY k;
+RESET enable_sort;
+SET enable_hashagg TO off;
+EXPLAIN (COSTS OFF) SELECT a, count(b), sum(a) FROM t1 GROUP BY a;
+SELECT a, count(b), sum(a) FROM t1 GROUP BY a;
+SET vectorize_batch_size TO 2;
+EXPLAIN (COSTS OFF) SELECT b, count(a), sum(a) FROM t1 GROUP BY b;
+SELECT b, count(a), sum(a) FROM t1 GROUP BY b;
+RESET vectorize_batch_size;
+SELECT k, count(x), sum(x), sum(y), avg(y) FROM t4 GROUP BY k;
+RESET enable_hashagg;
+EXPLAIN (COSTS OFF) SELECT a, b FROM t1 WHERE a = 2 ORDER BY b;
+SELECT a, b FROM t1 WHERE a = 2 ORDER BY b;
+SELECT b FROM t1 WHERE a = 2;
+SELECT a, b * 2 + 1 FROM t1 WHERE a = 2;
+SET vectorize_fuse_min_ops TO 0;
+SELECT a, b * 2 + 1 FROM t1 WHERE a = 2;
+RESET vectorize_fuse_min_ops;
+SELECT a, b * 2 + 1, (b * 2 + 1) * 2 FROM t1 WHERE a = 3;
+SELECT a FROM t1 WHERE a > 5;
+SELECT a, b FROM t1 WHERE b > to_number('4', '9')::float8;
+SET vectorize_batch_size TO 2;
+SELECT a, b FROM t1 WHERE b > 3;
+SELECT a, b FROM t1 WHERE b * 2 > 5 AND a + 0 < 3 AND b < 4;
+SELECT a, b FROM t1 WHERE a + 0 <> 2 AND 4 / (a - 2) > 0;
+RESET vectorize_batch_size;
+SELECT a, b FROM t1 WHERE a = 1 OR b > 4;
+SELECT a, b IS NULL, NOT (a > 1) FROM t1 WHERE a = 3 AND b IS NOT NULL;
+SELECT a, b FROM t1 WHERE (a > 2) IS TRUE AND NOT b < 3;
+SELECT a, CASE WHEN a < 2 THEN 'low' WHEN a < 3 THEN 'mid' ELSE 'high' END FROM t1 WHERE b < 3;
+SELECT a, CASE a WHEN 1 THEN b END, COALESCE(NULLIF(a, 2), 0) FROM t1 WHERE b > 4;
+SELECT a, b FROM t1 WHERE a IN (1, 3) AND b < 3;
+SELECT a, b FROM t1 WHERE a NOT IN (2, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20) AND b > 4;
+SET max_parallel_workers_per_gather TO 2;
+SET parallel_setup_cost TO 0;
+SET parallel_tuple_cost TO 0;
+SET min_parallel_relation_size TO 0;
+SELECT a, b FROM t1 WHERE a = 2 AND b < 3;
+EXPLAIN (COSTS OFF) SELECT avg(b) FROM t1;
+SELECT avg(b) FROM t1;
+RESET max_parallel_workers_per_gather;
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_relation_size;
+CREATE FUNCTION wait_for_spill(before bigint) RETURNS bool AS $$
+BEGIN
+  FOR i IN 1 .. 300 LOOP
+    PERFORM pg_sleep(0.1);
+    PERFORM pg_stat_clear_snapshot();
+    IF (SELECT temp_files FROM pg_stat_database
+        WHERE datname = current_database()) > before THEN
+      RETURN true;
+    END IF;
+  END LOOP;
+  RETURN false;
+END
+$$ LANGUAGE plpgsql;
+-- t2 is not analyzed: its groups are hashed, and spilled past work_mem
+-- to temporary files
+SET enable_sort TO off;
+SET work_mem = 64;
+EXPLAIN (COSTS OFF) SELECT k, count(v) AS c, sum(v) AS s FROM t2 GROUP BY k;
+CREATE TEMP TABLE spill_before AS
+  SELECT temp_files FROM pg_stat_database WHERE datname = current_database();
+CREATE TABLE t3 AS SELECT k, count(v) AS c, sum(v) AS s FROM t2 GROUP BY k;
+RESET work_mem;
+RESET enable_sort;
+SELECT wait_for_spill(temp_files) FROM spill_before;
+DROP FUNCTION wait_for_spill(bigint);
+DROP TABLE spill_before;
+SET enable_vectorize_engine TO off;
+SELECT count(*), sum(c), sum(s) FROM t3;
+SELECT count(*) FROM t3 WHERE c <> 3 OR s <> 3 * k + (CASE k WHEN 0 THEN 18000 ELSE 9000 END);
+SET enable_vectorize_engine TO on;
+DROP TABLE t3;
+DROP TABLE t2;
+DROP TABLE t4;
 
 
 drop extension vectorize_engine;
@@ -10,6 +10,8 @@
 
 #include "catalog/namespace.h"
 #include "executor/executor.h"
+#include "nodes/makefuncs.h"
+#include "nodes/value.h"
 #include "utils/lsyscache.h"
 #include "utils/syscache.h"
 #include "utils/hsearch.h"
@@ -54,6 +56,46 @@ ClearCustomScanState(CustomScanState *node)
 }
 
 
+/*
+ * Targetlist of Vars of the given varno referencing each entry of tlist,
+ * for a CustomScan that returns what its child or its custom_scan_tlist
+ * computes.  Only EXPLAIN reads it, the nodes building their result slot
+ * themselves.
+ */
+List *
+BuildVarTargetList(List *tlist, Index varno)
+{
+	List	   *vartlist = NIL;
+	ListCell   *lc;
+
+	foreach(lc, tlist)
+	{
+		TargetEntry *tle = (TargetEntry *) lfirst(lc);
+		Var		   *var = makeVarFromTargetEntry(varno, tle);
+
+		vartlist = lappend(vartlist,
+						   makeTargetEntry((Expr *) var, tle->resno,
+										   tle->resname, tle->resjunk));
+	}
+
+	return vartlist;
+}
+
+
+/*
+ * Batch size of a vectorized node, the planner puts it first in
+ * custom_private of every CustomScan it creates.
+ */
+int
+GetCustomScanBatchSize(CustomScan *cscan)
+{
+	if (cscan->custom_private == NIL)
+		elog(ERROR, "batch size of vectorized node is not set");
+
+	return intVal(linitial(cscan->custom_private));
+}
+
+
 /*
  * map non-vectorized type to vectorized type.
  * To scan the PG_TYPE is inefficient, so we create a hashtable to map
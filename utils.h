@@ -3,8 +3,11 @@
 
 #include "access/tupdesc.h"
 #include "nodes/execnodes.h"
+#include "nodes/plannodes.h"
 
 extern void ClearCustomScanState(CustomScanState *node);
+extern int GetCustomScanBatchSize(CustomScan *cscan);
+extern List *BuildVarTargetList(List *tlist, Index varno);
 extern Oid GetVtype(Oid ntype);
 extern Oid GetNtype(Oid vtype);
 extern Oid GetTupDescAttVType(TupleDesc tupdesc, int i);
@@ -15,15 +15,20 @@
 #include "utils/guc.h"
 
 #include "nodeUnbatch.h"
+#include "nodeBatch.h"
 #include "nodeSeqscan.h"
 #include "nodeAgg.h"
 #include "plan.h"
+#include "execProgram.h"
+#include "vtype/vtype.h"
+#include "vtype/vsimd.h"
 
 PG_MODULE_MAGIC;
 
 /* static variables */
 static bool					enable_vectorize_engine;
 static bool					enable_vectorize_notice;
+static int					vectorize_batch_size;
 static planner_hook_type    planner_hook_next;
 
 /* static functionss */
@@ -57,21 +62,34 @@ vector_post_planner(Query	*parse,
 	{
 		List		*subplans = NULL;
 		ListCell	*cell;
+		int			batchsize;
 
 		stmt->planTree = ReplacePlanNodeWalker((Node *) stmt->planTree);
 
 		foreach(cell, stmt->subplans)
 		{
 			Plan	*subplan = ReplacePlanNodeWalker((Node *)lfirst(cell));
-			subplans = lappend(subplans, subplan);
+
+			/* a subplan returns rows to the expression running it */
+			subplans = lappend(subplans, UnbatchPlan(subplan));
 		}
 		stmt->subplans = subplans;
 
 		/* 
 		 * vectorize executor exchange batch of tuples between plan nodes
 		 * add unbatch node at top to convert batch to row and send to client.
+		 * Plans with a Gather or a Sort at the top already return rows.
 		 */
-		stmt->planTree = AddUnbatchNodeAtTop(stmt->planTree);
+		stmt->planTree = UnbatchPlan(stmt->planTree);
+
+		/* all vectorized nodes of the statement use the same batch size */
+		batchsize = vectorize_batch_size;
+		if (batchsize == 0)
+			batchsize = ChooseBatchSize(stmt->planTree);
+
+		SetPlanBatchSize(stmt->planTree, batchsize);
+		foreach(cell, stmt->subplans)
+			SetPlanBatchSize((Plan *) lfirst(cell), batchsize);
 	}
 	PG_CATCH();
 	{
@@ -96,10 +114,14 @@ _PG_init(void)
 {
 	elog(LOG, "Initialize vectorized extension");
 
+	vsimd_init();
+	elog(DEBUG1, "vectorized kernels use %s", vsimd_level_name(vsimd_level));
+
 	/* Register customscan node for vectorized scan and agg */
 	InitVectorScan();
 	InitVectorAgg();
 	InitUnbatch();
+	InitBatch();
 
     /* planner hook registration */
     planner_hook_next = planner_hook;
@@ -122,4 +144,24 @@ _PG_init(void)
 							 PGC_USERSET,
 							 GUC_NOT_IN_SAMPLE,
 							 NULL, NULL, NULL);
+
+	DefineCustomIntVariable("vectorize_batch_size",
+							"Sets the number of rows in a batch of vectorize engine.",
+							"Zero lets the planner choose it from the columns the plan reads.",
+							&vectorize_batch_size,
+							0,
+							0, MAX_BATCHSIZE,
+							PGC_USERSET,
+							GUC_NOT_IN_SAMPLE,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("vectorize_fuse_min_ops",
+							"Sets the number of float8 arithmetic operators from which an expression is evaluated in one fused loop.",
+							"Zero disables fusion.",
+							&vectorize_fuse_min_ops,
+							2,
+							0, INT_MAX,
+							PGC_USERSET,
+							GUC_NOT_IN_SAMPLE,
+							NULL, NULL, NULL);
 }
@@ -11,21 +11,28 @@
 #include "access/sysattr.h"
 #include "access/tuptoaster.h"
 #include "executor/tuptable.h"
+#include "utils/datum.h"
 #include "utils/expandeddatum.h"
+#include "utils/lsyscache.h"
 
+#include "utils.h"
 #include "vectorTupleSlot.h"
+#include "vtype/vsimd.h"
 
 
-static void Vslot_deform_tuple(TupleTableSlot *slot, int natts);
+static int Vslot_fixed_natts(TupleDesc tupleDesc, int natts);
+static void Vslot_deform_tuple(TupleTableSlot *slot, int natts, bool *wanted);
+static int Vslot_lazy_natts(VectorTupleSlot *vslot, int natts, bool *wanted);
 
 /* --------------------------------
  *		VMakeTupleTableSlot
  *
- *		Basic routine to make an empty VectorTupleTableSlot.
+ *		Basic routine to make an empty VectorTupleTableSlot holding
+ *		batches of up to batchsize tuples.
  * --------------------------------
  */
 TupleTableSlot *
-VMakeTupleTableSlot(void)
+VMakeTupleTableSlot(int batchsize)
 {
 	TupleTableSlot		*slot;
 	VectorTupleSlot		*vslot;
@@ -49,10 +56,20 @@ VMakeTupleTableSlot(void)
 	vslot = (VectorTupleSlot*)slot;
 	vslot->dim = 0;
 	vslot->bufnum = 0;
-	memset(vslot->tts_buffers, InvalidBuffer, sizeof(vslot->tts_buffers));
-	memset(vslot->tts_tuples, 0, sizeof(vslot->tts_tuples));
+	vslot->batchsize = batchsize;
+	vslot->tts_lazy = NULL;
+	vslot->tts_tupdata = NULL;
+	vslot->tts_nfixed = 0;
+	vslot->tts_nfixednotnull = 0;
+	vslot->tts_tuples = palloc0(sizeof(HeapTupleData) * batchsize);
+	vslot->tts_buffers = palloc(sizeof(Buffer) * batchsize);
+	memset(vslot->tts_buffers, InvalidBuffer, sizeof(Buffer) * batchsize);
 	/* all tuples should be skipped in initialization */
-	memset(vslot->skip, true, sizeof(vslot->skip));
+	vslot->skip = palloc(sizeof(bool) * batchsize);
+	memset(vslot->skip, true, sizeof(bool) * batchsize);
+	vslot->sel.dense = false;
+	vslot->sel.nrows = 0;
+	vslot->sel.rows = palloc(sizeof(int) * batchsize);
 
 	return slot;
 }
@@ -64,9 +81,9 @@ VMakeTupleTableSlot(void)
  * --------------------------------
  */
 TupleTableSlot *
-VExecAllocTableSlot(List **tupleTable)
+VExecAllocTableSlot(List **tupleTable, int batchsize)
 {
-	TupleTableSlot *slot = VMakeTupleTableSlot();
+	TupleTableSlot *slot = VMakeTupleTableSlot(batchsize);
 
 	*tupleTable = lappend(*tupleTable, slot);
 
@@ -74,19 +91,90 @@ VExecAllocTableSlot(List **tupleTable)
 }
 
 
+/*
+ * Is column 'attnum' (0-based) to be extracted by this deform pass?
+ */
+#define VSLOT_DEFORM_COLUMN(vslot, wanted, attnum) \
+	((vslot)->tts_lazy[attnum] && ((wanted) == NULL || (wanted)[attnum]))
+
+/*
+ * How many tuples ahead of the one being deformed we prefetch.
+ */
+#define VSLOT_PREFETCH_DISTANCE		8
+
+#if defined(__GNUC__) || defined(__INTEL_COMPILER)
+#define vslot_prefetch(addr)	__builtin_prefetch(addr)
+#else
+#define vslot_prefetch(addr)	((void) 0)
+#endif
+
+/*
+ * Copy the values at offset off of the tuples on the fixed path into a
+ * column kept as an array of ctype, which has the on-disk layout.  The
+ * loop is built for each SIMD level, see vtype/vsimd.h.
+ */
+#define VSLOT_GATHER_FIXED(ctype) \
+VSIMD_FUNCTION(vslot_gather_##ctype, \
+			   (char **fixedtp, long off, int dim, ctype *values), \
+			   (fixedtp, off, dim, values), \
+			   int row; \
+			   for (row = 0; row < dim; row++) \
+			   { \
+				   if (fixedtp[row] != NULL) \
+					   values[row] = *(ctype *) (fixedtp[row] + off); \
+			   })
+
+VSLOT_GATHER_FIXED(uint8)
+VSLOT_GATHER_FIXED(int16)
+VSLOT_GATHER_FIXED(int32)
+VSLOT_GATHER_FIXED(int64)
+
+/*
+ * Vslot_fixed_natts
+ *		Return how many of the first natts attributes are fixed width with
+ *		no varlena before them.  In a tuple without nulls these are at the
+ *		same offset in every tuple, which we leave in attcacheoff.  This is
+ *		done once per slot, by InitializeVectorSlotColumn.
+ */
+static int
+Vslot_fixed_natts(TupleDesc tupleDesc, int natts)
+{
+	Form_pg_attribute *att = tupleDesc->attrs;
+	long		off = 0;
+	int			attnum;
+
+	for (attnum = 0; attnum < natts; attnum++)
+	{
+		Form_pg_attribute thisatt = att[attnum];
+
+		if (thisatt->attlen <= 0)
+			break;
+
+		off = att_align_nominal(off, thisatt->attalign);
+		thisatt->attcacheoff = off;
+		off += thisatt->attlen;
+	}
+
+	return attnum;
+}
+
 /*
  * slot_deform_tuple
- *		Given a TupleTableSlot, extract data from the slot's physical tuple
- *		into its Datum/isnull arrays.  Data is extracted up through the
- *		natts'th column (caller must ensure this is a legal column number).
+ *		Given a TupleTableSlot, extract data from the slot's physical tuples
+ *		into the vtype columns.  Data is extracted up through the natts'th
+ *		column (caller must ensure this is a legal column number).
  *
- *		This is essentially an incremental version of heap_deform_tuple:
- *		on each call we extract attributes up to the one needed, without
- *		re-computing information about previously extracted attributes.
- *		slot->tts_nvalid is the number of attributes already extracted.
+ *		Only the columns still marked lazy, and among those the ones in
+ *		'wanted' (NULL means all of them), are stored, the others are just
+ *		walked over to find the offsets.  Rows already skipped are not
+ *		looked at, their values are left undefined.
+ *
+ *		The leading fixed width columns of the tuples without nulls are
+ *		gathered a column at a time, since their offsets do not depend on
+ *		the row.  Everything else is deformed a row at a time.
  */
 static void
-Vslot_deform_tuple(TupleTableSlot *slot, int natts)
+Vslot_deform_tuple(TupleTableSlot *slot, int natts, bool *wanted)
 {
 	VectorTupleSlot	*vslot = (VectorTupleSlot *)slot;
 	TupleDesc	tupleDesc = slot->tts_tupleDescriptor;
@@ -95,46 +183,145 @@ Vslot_deform_tuple(TupleTableSlot *slot, int natts)
 	bool		hasnulls;
 	Form_pg_attribute *att = tupleDesc->attrs;
 	int			attnum;
+	int			tupnatts;
+	int			nfixed;
+	long		fixedoff;		/* offset just past the fixed columns */
 	char	   *tp;				/* ptr to tuple data */
 	long		off;			/* offset in tuple data */
 	bits8	   *bp;		/* ptr to null bitmap in tuple */
 	bool		slow;			/* can we use/set attcacheoff? */
+	bool		fixednotnull;	/* fixed columns are all NOT NULL */
 	int			row;
 	vtype		*column;
+	char	  **fixedtp = vslot->tts_tupdata;	/* data of tuples on the
+												 * fixed path */
+
+	nfixed = Min(vslot->tts_nfixed, natts);
+	fixedoff = 0;
+	if (nfixed > 0)
+		fixedoff = att[nfixed - 1]->attcacheoff + att[nfixed - 1]->attlen;
+
+	fixednotnull = (nfixed <= vslot->tts_nfixednotnull);
+
+	/* the rows of the columns we fill are not null unless found so */
+	for (attnum = 0; attnum < natts; attnum++)
+	{
+		if (VSLOT_DEFORM_COLUMN(vslot, wanted, attnum))
+			vtype_clearnulls((vtype *)slot->tts_values[attnum],
+							 vslot->batchsize);
+	}
+
+	/*
+	 * Find the tuples whose fixed columns can be gathered by offset: not
+	 * skipped, not older than the fixed columns, and without nulls in
+	 * them, which the NOT NULL constraints may tell for the whole table.
+	 */
+	for (row = 0; row < vslot->dim; row++)
+	{
+		fixedtp[row] = NULL;
+
+		if (row + VSLOT_PREFETCH_DISTANCE < vslot->dim)
+			vslot_prefetch(vslot->tts_tuples[row + VSLOT_PREFETCH_DISTANCE].t_data);
+
+		if (nfixed == 0 || vslot->skip[row])
+			continue;
+
+		tuple = &vslot->tts_tuples[row];
+		tup = tuple->t_data;
+		if (HeapTupleHeaderGetNatts(tup) < nfixed)
+			continue;
+		if (HeapTupleHasNulls(tuple) && !fixednotnull)
+			continue;
+
+		fixedtp[row] = (char *) tup + tup->t_hoff;
+	}
+
+	for (attnum = 0; attnum < nfixed; attnum++)
+	{
+		Form_pg_attribute thisatt = att[attnum];
+
+		if (!VSLOT_DEFORM_COLUMN(vslot, wanted, attnum))
+			continue;
+
+		column = (vtype *)slot->tts_values[attnum];
+		off = thisatt->attcacheoff;
+
+		/* native columns are copied as they are on disk */
+		switch (column->elemlen == thisatt->attlen ? column->elemlen : 0)
+		{
+			case 1:
+				vslot_gather_uint8(fixedtp, off, vslot->dim,
+								  VTYPE_VALUES(column, uint8));
+				break;
+			case 2:
+				vslot_gather_int16(fixedtp, off, vslot->dim,
+								  VTYPE_VALUES(column, int16));
+				break;
+			case 4:
+				vslot_gather_int32(fixedtp, off, vslot->dim,
+								  VTYPE_VALUES(column, int32));
+				break;
+			case 8:
+				vslot_gather_int64(fixedtp, off, vslot->dim,
+								  VTYPE_VALUES(column, int64));
+				break;
+			default:
+				for (row = 0; row < vslot->dim; row++)
+				{
+					if (fixedtp[row] == NULL)
+						continue;
+
+					vtype_setdatum(column, row,
+								   fetchatt(thisatt, fixedtp[row] + off));
+				}
+				break;
+		}
+	}
 
 	for (row = 0; row < vslot->dim; row++)
 	{
+		/* filtered out already, nobody will look at its values */
+		if (vslot->skip[row])
+			continue;
+
+		/* nothing left to do if all columns were fixed */
+		if (fixedtp[row] != NULL && nfixed == natts)
+			continue;
+
 		tuple = &vslot->tts_tuples[row];
 		tup = tuple->t_data;
 		bp = tup->t_bits;
 		hasnulls = HeapTupleHasNulls(tuple);
-
-		attnum = slot->tts_nvalid;
-		/*
-		 * Check whether the first call for this tuple, and initialize or restore
-		 * loop state.
-		 */
-		/* vectorize engine deform once for now */
-		off = 0;
-		slow = false;
+		tupnatts = Min(HeapTupleHeaderGetNatts(tup), natts);
 
 		tp = (char *) tup + tup->t_hoff;
 
-		for (; attnum < natts; attnum++)
+		if (fixedtp[row] != NULL)
+		{
+			/* fixed columns done above, continue right after them */
+			attnum = nfixed;
+			off = fixedoff;
+		}
+		else
+		{
+			attnum = 0;
+			off = 0;
+		}
+		slow = false;
+
+		for (; attnum < tupnatts; attnum++)
 		{
 			Form_pg_attribute thisatt = att[attnum];
 			column = (vtype *)slot->tts_values[attnum];
 
 			if (hasnulls && att_isnull(attnum, bp))
 			{
-				column->values[row] = (Datum) 0;
-				column->isnull[row] = true;
+				if (VSLOT_DEFORM_COLUMN(vslot, wanted, attnum))
+					VTYPE_SETNULL(column, row);
 				slow = true;		/* can't use attcacheoff anymore */
 				continue;
 			}
 
-			column->isnull[row] = false;
-
 			if (!slow && thisatt->attcacheoff >= 0)
 				off = thisatt->attcacheoff;
 			else if (thisatt->attlen == -1)
@@ -164,79 +351,94 @@ Vslot_deform_tuple(TupleTableSlot *slot, int natts)
 					thisatt->attcacheoff = off;
 			}
 
-			column->values[row] = fetchatt(thisatt, tp + off);
+			if (VSLOT_DEFORM_COLUMN(vslot, wanted, attnum))
+				vtype_setdatum(column, row, fetchatt(thisatt, tp + off));
 
 			off = att_addlength_pointer(off, thisatt->attlen, tp + off);
 
 			if (thisatt->attlen <= 0)
 				slow = true;		/* can't use attcacheoff anymore */
 		}
-	}
 
+		/*
+		 * If tuple doesn't have all the atts indicated by tupleDesc, read the
+		 * rest as null
+		 */
+		for (; attnum < natts; attnum++)
+		{
+			if (!VSLOT_DEFORM_COLUMN(vslot, wanted, attnum))
+				continue;
+			column = (vtype *)slot->tts_values[attnum];
+			VTYPE_SETNULL(column, row);
+		}
+	}
 
-	attnum = slot->tts_nvalid;
-	for (; attnum < natts; attnum++)
+	/* these columns are materialized now */
+	for (attnum = 0; attnum < natts; attnum++)
 	{
+		if (!VSLOT_DEFORM_COLUMN(vslot, wanted, attnum))
+			continue;
 		column = (vtype *)slot->tts_values[attnum];
 		column->dim = vslot->dim;
+		vslot->tts_lazy[attnum] = false;
 	}
-
-	/*
-	 * Save state for next execution
-	 */
-	slot->tts_nvalid = attnum;
 }
 
 
 /*
- * slot_getallattrs
- *		This function forces all the entries of the slot's Datum/isnull
- *		arrays to be valid.  The caller may then extract data directly
- *		from those arrays instead of using slot_getattr.
+ * Return the number of leading columns a deform pass has to walk to
+ * extract the lazy columns among the first natts ones that are in
+ * 'wanted' (NULL means all), or 0 if there is nothing to do.
  */
-void
-Vslot_getallattrs(TupleTableSlot *slot)
+static int
+Vslot_lazy_natts(VectorTupleSlot *vslot, int natts, bool *wanted)
 {
-	VectorTupleSlot	*vslot = (VectorTupleSlot *)slot;
-	int			tdesc_natts = slot->tts_tupleDescriptor->natts;
-	int			attnum;
-	HeapTuple	tuple;
 	int			i;
 
-	/* Quick out if we have 'em all already */
-	if (slot->tts_nvalid == tdesc_natts)
-		return;
+	if (vslot->tts_lazy == NULL || vslot->dim == 0)
+		return 0;
 
-	if (vslot->dim == 0)
-		return;
-	/*
-	 * otherwise we had better have a physical tuple (tts_nvalid should equal
-	 * natts in all virtual-tuple cases)
-	 */
-	for (i = 0; i < vslot->dim; i++)
+	for (i = natts; i > 0; i--)
 	{
-		tuple = &vslot->tts_tuples[i];
-		if (tuple == NULL)			/* internal error */
-			elog(ERROR, "cannot extract attribute from empty tuple slot");
+		if (VSLOT_DEFORM_COLUMN(vslot, wanted, i - 1))
+			break;
 	}
-	/*
-	 * load up any slots available from physical tuple
-	 */
-	attnum = HeapTupleHeaderGetNatts(vslot->tts_tuples[0].t_data);
-	attnum = Min(attnum, tdesc_natts);
 
-	Vslot_deform_tuple(slot, attnum);
-
-	/*
-	 * If tuple doesn't have all the atts indicated by tupleDesc, read the
-	 * rest as null
-	 */
-	for (; attnum < tdesc_natts; attnum++)
+	if (i > 0)
 	{
-		slot->tts_values[attnum] = (Datum) 0;
-		slot->tts_isnull[attnum] = true;
+		int			row;
+
+		/*
+		 * otherwise we had better have physical tuples (there is nothing
+		 * lazy in all virtual-tuple cases)
+		 */
+		for (row = 0; row < vslot->dim; row++)
+		{
+			if (vslot->tts_tuples[row].t_data == NULL)	/* internal error */
+				elog(ERROR, "cannot extract attribute from empty tuple slot");
+		}
 	}
-	slot->tts_nvalid = tdesc_natts;
+
+	return i;
+}
+
+
+/*
+ * Vslot_setlazy
+ *		Mark the columns in 'needed' of the batch just stored by
+ *		VExecStoreTuple as not extracted yet.  They are deformed from the
+ *		physical tuples only when some operator asks for them, by then
+ *		the rows filtered out in between are not deformed at all.
+ *
+ *		The other columns are left empty, nobody is supposed to read them.
+ */
+void
+Vslot_setlazy(TupleTableSlot *slot, bool *needed)
+{
+	VectorTupleSlot	*vslot = (VectorTupleSlot *)slot;
+
+	memcpy(vslot->tts_lazy, needed,
+		   sizeof(bool) * slot->tts_tupleDescriptor->natts);
 }
 
 
@@ -244,16 +446,50 @@ Vslot_getallattrs(TupleTableSlot *slot)
  * slot_getsomeattrs
  *		This function forces the entries of the slot's Datum/isnull
  *		arrays to be valid at least up through the attnum'th entry.
+ *
+ *		The vtype pointers in tts_values are always valid, what we make
+ *		sure here is that the lazy columns among them are materialized.
  */
 void
 Vslot_getsomeattrs(TupleTableSlot *slot, int attnum)
 {
-	/* Quick out if we have 'em all already */
-	if (slot->tts_nvalid >= attnum)
-		return;
+	VectorTupleSlot	*vslot = (VectorTupleSlot *)slot;
+	int			natts;
+
+	natts = Vslot_lazy_natts(vslot, attnum, NULL);
+	if (natts > 0)
+		Vslot_deform_tuple(slot, natts, NULL);
+}
 
-	elog(ERROR, "slot should be deformed in scan for vectorize engine");
 
+/*
+ * slot_getallattrs
+ *		This function forces all the entries of the slot's Datum/isnull
+ *		arrays to be valid.  The caller may then extract data directly
+ *		from those arrays instead of using slot_getattr.
+ */
+void
+Vslot_getallattrs(TupleTableSlot *slot)
+{
+	Vslot_getsomeattrs(slot, slot->tts_tupleDescriptor->natts);
+}
+
+
+/*
+ * Vslot_getattrs
+ *		Like Vslot_getallattrs, but only the columns marked in 'wanted'
+ *		are materialized.  Operators call this with the columns of the
+ *		expression they are about to evaluate.
+ */
+void
+Vslot_getattrs(TupleTableSlot *slot, bool *wanted)
+{
+	VectorTupleSlot	*vslot = (VectorTupleSlot *)slot;
+	int			natts;
+
+	natts = Vslot_lazy_natts(vslot, slot->tts_tupleDescriptor->natts, wanted);
+	if (natts > 0)
+		Vslot_deform_tuple(slot, natts, wanted);
 }
 
 
@@ -322,7 +558,13 @@ VExecClearTuple(TupleTableSlot *slot)	/* slot in which to store tuple */
 		column->dim = 0;
 	}
 
-	memset(vslot->skip, true, sizeof(vslot->skip));
+	if (vslot->tts_lazy)
+		memset(vslot->tts_lazy, false,
+			   sizeof(bool) * slot->tts_tupleDescriptor->natts);
+
+	memset(vslot->skip, true, sizeof(bool) * vslot->batchsize);
+	vslot->sel.dense = false;
+	vslot->sel.nrows = 0;
 
 	return slot;
 }
@@ -435,14 +677,327 @@ InitializeVectorSlotColumn(VectorTupleSlot *vslot)
 	int			i;
 
 	desc = vslot->tts.tts_tupleDescriptor;
+	vslot->tts_lazy = palloc0(sizeof(bool) * desc->natts);
+	vslot->tts_tupdata = palloc(sizeof(char *) * vslot->batchsize);
+
+	/* the offsets of the fixed columns are the same for every batch */
+	vslot->tts_nfixed = Vslot_fixed_natts(desc, desc->natts);
+	for (i = 0; i < vslot->tts_nfixed; i++)
+	{
+		if (!desc->attrs[i]->attnotnull)
+			break;
+	}
+	vslot->tts_nfixednotnull = i;
+
 	/* initailize column in vector slot */
 	for (i = 0; i < desc->natts; i++)
 	{
-		typid = desc->attrs[i]->atttypid;
-		column = buildvtype(typid, BATCHSIZE, vslot->skip);
+		/* the column holds values of the plain type of its vector type */
+		typid = GetNtype(desc->attrs[i]->atttypid);
+		if (typid == InvalidOid)
+			typid = desc->attrs[i]->atttypid;
+		column = buildvtype(typid, vslot->batchsize, &vslot->sel);
 		column->dim = 0;
 		vslot->tts.tts_values[i]  = PointerGetDatum(column);
 		/* tts_isnull not used yet */
 		vslot->tts.tts_isnull[i] = false;
 	}
 }
+
+/*
+ * Vslot_selectall
+ *		Mark all the dim rows of a freshly filled batch active.
+ */
+void
+Vslot_selectall(TupleTableSlot *slot)
+{
+	VectorTupleSlot *vslot = (VectorTupleSlot *)slot;
+
+	memset(vslot->skip, false, sizeof(bool) * vslot->dim);
+	vslot->sel.dense = true;
+	vslot->sel.nrows = vslot->dim;
+}
+
+/*
+ * Vslot_applyfilter
+ *		Drop from the batch the active rows where a qual result is false,
+ *		or null unless resultForNull.  Only the active rows are looked at,
+ *		and the selection is compacted in place.
+ *
+ *		Returns the number of rows left.
+ */
+int
+Vslot_applyfilter(TupleTableSlot *slot, vbool *result, bool resultForNull)
+{
+	VectorTupleSlot *vslot = (VectorTupleSlot *)slot;
+	vselection *sel = &vslot->sel;
+	int			nrows = 0;
+	int			row;
+
+	if (!result->hasnull)
+	{
+		VSEL_FOREACH(sel, vslot->dim, row,
+		{
+			if (VTYPE_VALUES(result, bool)[row])
+				sel->rows[nrows++] = row;
+			else
+				vslot->skip[row] = true;
+		});
+	}
+	else
+	{
+		VSEL_FOREACH(sel, vslot->dim, row,
+		{
+			if (VTYPE_ISNULL(result, row) ? resultForNull :
+				VTYPE_VALUES(result, bool)[row])
+				sel->rows[nrows++] = row;
+			else
+				vslot->skip[row] = true;
+		});
+	}
+
+	sel->nrows = nrows;
+	sel->dense = (nrows == vslot->dim);
+
+	return nrows;
+}
+
+/*
+ * Vslot_copyselection
+ *		Give dst, which holds values computed from the batch in src, the
+ *		same active rows.
+ */
+void
+Vslot_copyselection(TupleTableSlot *dst, TupleTableSlot *src)
+{
+	VectorTupleSlot *vdst = (VectorTupleSlot *)dst;
+	VectorTupleSlot *vsrc = (VectorTupleSlot *)src;
+
+	Assert(vsrc->dim <= vdst->batchsize);
+
+	vdst->dim = vsrc->dim;
+	memcpy(vdst->skip, vsrc->skip, sizeof(bool) * vsrc->dim);
+	vdst->sel.dense = vsrc->sel.dense;
+	vdst->sel.nrows = vsrc->sel.nrows;
+	if (!vsrc->sel.dense)
+		memcpy(vdst->sel.rows, vsrc->sel.rows, sizeof(int) * vsrc->sel.nrows);
+}
+
+
+static void
+Vslot_write(BufFile *file, void *ptr, size_t size)
+{
+	if (BufFileWrite(file, ptr, size) != size)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to vectorized batch temporary file: %m")));
+}
+
+static void
+Vslot_read(BufFile *file, void *ptr, size_t size)
+{
+	if (BufFileRead(file, ptr, size) != size)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read from vectorized batch temporary file: %m")));
+}
+
+/* pack the values of rows of a column kept as an array of ctype */
+#define VSLOT_PACK_FIXED(ctype, column, rows, nrows, packed) \
+	do { \
+		const ctype *_v = VTYPE_VALUES(column, ctype); \
+		int			_n; \
+		for (_n = 0; _n < (nrows); _n++) \
+			((ctype *) (packed))[_n] = _v[(rows)[_n]]; \
+	} while (0)
+
+/*
+ * Vslot_writerows
+ *		Append the given rows of the batch in slot to file, as a batch of
+ *		nrows rows that Vslot_readbatch reads back.  Only the columns
+ *		flagged in wanted are written, all of them if it is NULL; these
+ *		must have been extracted.
+ *
+ *		A column is written as a flag telling if any of the rows is null,
+ *		the null bitmap of the rows if so, then the values: the packed
+ *		array of the column for the fixed width types, Datums for the
+ *		other pass-by-value types, and the length and bytes of each value
+ *		that is not null for pass-by-reference ones.
+ */
+void
+Vslot_writerows(TupleTableSlot *slot, const int *rows, int nrows,
+				const bool *wanted, BufFile *file)
+{
+	TupleDesc	desc = slot->tts_tupleDescriptor;
+	int			nwords = VTYPE_NULLWORDS(nrows);
+	uint64	   *nulls;
+	char	   *packed;
+	int			attno;
+	int			n;
+
+	nulls = palloc(sizeof(uint64) * nwords);
+	packed = palloc(sizeof(Datum) * nrows);
+
+	Vslot_write(file, &nrows, sizeof(nrows));
+	for (attno = 0; attno < desc->natts; attno++)
+	{
+		vtype	   *column = (vtype *) DatumGetPointer(slot->tts_values[attno]);
+		bool		hasnull = false;
+		int16		typlen;
+		bool		typbyval;
+
+		if (wanted != NULL && !wanted[attno])
+			continue;
+
+		memset(nulls, 0, sizeof(uint64) * nwords);
+		if (column->hasnull)
+		{
+			for (n = 0; n < nrows; n++)
+			{
+				if (VTYPE_ISNULL(column, rows[n]))
+				{
+					nulls[n >> 6] |= UINT64CONST(1) << (n & 63);
+					hasnull = true;
+				}
+			}
+		}
+		Vslot_write(file, &hasnull, sizeof(hasnull));
+		if (hasnull)
+			Vslot_write(file, nulls, sizeof(uint64) * nwords);
+
+		switch (column->elemlen)
+		{
+			case 1:
+				VSLOT_PACK_FIXED(uint8, column, rows, nrows, packed);
+				Vslot_write(file, packed, sizeof(uint8) * nrows);
+				continue;
+			case 2:
+				VSLOT_PACK_FIXED(int16, column, rows, nrows, packed);
+				Vslot_write(file, packed, sizeof(int16) * nrows);
+				continue;
+			case 4:
+				VSLOT_PACK_FIXED(int32, column, rows, nrows, packed);
+				Vslot_write(file, packed, sizeof(int32) * nrows);
+				continue;
+			case 8:
+				VSLOT_PACK_FIXED(int64, column, rows, nrows, packed);
+				Vslot_write(file, packed, sizeof(int64) * nrows);
+				continue;
+		}
+
+		get_typlenbyval(column->elemtype, &typlen, &typbyval);
+		if (typbyval)
+		{
+			VSLOT_PACK_FIXED(Datum, column, rows, nrows, packed);
+			Vslot_write(file, packed, sizeof(Datum) * nrows);
+			continue;
+		}
+
+		for (n = 0; n < nrows; n++)
+		{
+			Datum		value;
+			uint32		len;
+
+			if (hasnull && (nulls[n >> 6] >> (n & 63)) & 1)
+				continue;
+			value = VTYPE_VALUES(column, Datum)[rows[n]];
+			len = datumGetSize(value, false, typlen);
+			Vslot_write(file, &len, sizeof(len));
+			Vslot_write(file, DatumGetPointer(value), len);
+		}
+	}
+
+	pfree(nulls);
+	pfree(packed);
+}
+
+/*
+ * Vslot_readbatch
+ *		Read the next batch written by Vslot_writerows from file into
+ *		slot, whose descriptor must be that of the slot it was written
+ *		from, with the same wanted columns.  The others are all null.  The
+ *		values of pass-by-reference columns are allocated in cxt.  Returns
+ *		false at the end of the file.
+ */
+bool
+Vslot_readbatch(TupleTableSlot *slot, BufFile *file, MemoryContext cxt,
+				const bool *wanted)
+{
+	VectorTupleSlot *vslot = (VectorTupleSlot *) slot;
+	TupleDesc	desc = slot->tts_tupleDescriptor;
+	int			nrows;
+	int			nwords;
+	size_t		nread;
+	int			attno;
+	int			n;
+
+	VExecClearTuple(slot);
+
+	nread = BufFileRead(file, &nrows, sizeof(nrows));
+	if (nread == 0)
+		return false;
+	if (nread != sizeof(nrows))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read from vectorized batch temporary file: %m")));
+	if (nrows > vslot->batchsize)
+		elog(ERROR, "vectorized batch of %d rows does not fit in a slot of %d",
+			 nrows, vslot->batchsize);
+	nwords = VTYPE_NULLWORDS(nrows);
+
+	for (attno = 0; attno < desc->natts; attno++)
+	{
+		vtype	   *column = (vtype *) DatumGetPointer(slot->tts_values[attno]);
+		bool		hasnull;
+		int16		typlen;
+		bool		typbyval;
+
+		column->dim = nrows;
+		if (wanted != NULL && !wanted[attno])
+		{
+			memset(column->nulls, 0xFF, sizeof(uint64) * nwords);
+			column->hasnull = true;
+			continue;
+		}
+
+		Vslot_read(file, &hasnull, sizeof(hasnull));
+		if (hasnull)
+			Vslot_read(file, column->nulls, sizeof(uint64) * nwords);
+		else
+			memset(column->nulls, 0, sizeof(uint64) * nwords);
+		column->hasnull = hasnull;
+
+		if (column->elemlen > 0)
+		{
+			Vslot_read(file, column->values, column->elemlen * nrows);
+			continue;
+		}
+
+		get_typlenbyval(column->elemtype, &typlen, &typbyval);
+		if (typbyval)
+		{
+			Vslot_read(file, column->values, sizeof(Datum) * nrows);
+			continue;
+		}
+
+		for (n = 0; n < nrows; n++)
+		{
+			uint32		len;
+			char	   *value;
+
+			if (hasnull && VTYPE_ISNULL(column, n))
+				continue;
+			Vslot_read(file, &len, sizeof(len));
+			value = MemoryContextAlloc(cxt, len);
+			Vslot_read(file, value, len);
+			VTYPE_VALUES(column, Datum)[n] = PointerGetDatum(value);
+		}
+	}
+
+	vslot->dim = nrows;
+	Vslot_selectall(slot);
+	slot->tts_isempty = false;
+	slot->tts_nvalid = desc->natts;
+
+	return true;
+}
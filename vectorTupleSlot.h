@@ -14,6 +14,7 @@
 #define VECTOR_TUPLE_SLOT_H
 
 #include "executor/tuptable.h"
+#include "storage/buffile.h"
 #include "storage/bufmgr.h"
 
 #include "vtype/vtype.h"
@@ -26,22 +27,43 @@ typedef struct VectorTupleSlot
 	/* how many tuples does this slot contain */ 
 	int32			dim;
 	int32			bufnum;
+	/* how many tuples can this slot contain */
+	int32			batchsize;
 
 	/* batch of physical tuples */
-	HeapTupleData	tts_tuples[BATCHSIZE];
+	HeapTupleData	*tts_tuples;
 	/*
 	 * tuples in slot would across many heap blocks,
 	 * we need pin these buffers if needed.
 	 */
-	Buffer			tts_buffers[BATCHSIZE];
+	Buffer			*tts_buffers;
 	/* skip array to represent filtered tuples */
-	bool			skip[BATCHSIZE];
+	bool			*skip;
+	/*
+	 * the rows not skipped, kept in step with skip[] so that operators
+	 * only visit the rows left by the quals.  Columns point to it.
+	 */
+	vselection		sel;
+	/*
+	 * per column, true if not extracted from tts_tuples yet.  NULL if
+	 * the columns were not set up by InitializeVectorSlotColumn.
+	 */
+	bool		   *tts_lazy;
+	/* scratch space of Vslot_deform_tuple, batchsize entries */
+	char		  **tts_tupdata;
+	/*
+	 * layout of the descriptor worked out once for Vslot_deform_tuple:
+	 * the leading columns at a fixed offset, and how many of them are
+	 * NOT NULL from the first one on.
+	 */
+	int				tts_nfixed;
+	int				tts_nfixednotnull;
 } VectorTupleSlot;
 
 /* vector tuple slot related interface */
 
-extern TupleTableSlot *VMakeTupleTableSlot(void);
-extern TupleTableSlot *VExecAllocTableSlot(List **tupleTable);
+extern TupleTableSlot *VMakeTupleTableSlot(int batchsize);
+extern TupleTableSlot *VExecAllocTableSlot(List **tupleTable, int batchsize);
 extern void InitializeVectorSlotColumn(VectorTupleSlot *vslot);
 
 extern TupleTableSlot *VExecStoreTuple(HeapTuple tuple,
@@ -50,7 +72,19 @@ extern TupleTableSlot *VExecStoreTuple(HeapTuple tuple,
 			   bool shouldFree);
 extern TupleTableSlot *VExecClearTuple(TupleTableSlot *slot);
 
+extern void Vslot_setlazy(TupleTableSlot *slot, bool *needed);
 extern void Vslot_getsomeattrs(TupleTableSlot *slot, int attnum);
 extern void Vslot_getallattrs(TupleTableSlot *slot);
+extern void Vslot_getattrs(TupleTableSlot *slot, bool *wanted);
+
+extern void Vslot_selectall(TupleTableSlot *slot);
+extern int Vslot_applyfilter(TupleTableSlot *slot, vbool *result,
+				  bool resultForNull);
+extern void Vslot_copyselection(TupleTableSlot *dst, TupleTableSlot *src);
+
+extern void Vslot_writerows(TupleTableSlot *slot, const int *rows, int nrows,
+				const bool *wanted, BufFile *file);
+extern bool Vslot_readbatch(TupleTableSlot *slot, BufFile *file,
+				MemoryContext cxt, const bool *wanted);
 
 #endif
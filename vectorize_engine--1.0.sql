@@ -1014,6 +1014,29 @@ CREATE OPERATOR - ( leftarg = vdate, rightarg = interval, procedure = vdate_mi_i
 CREATE FUNCTION vdate_le(vdate, date) RETURNS vdate AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE STRICT;
 CREATE OPERATOR <= ( leftarg = vdate, rightarg = date, procedure = vdate_le, commutator = <= );
 
+-- boolean logic and tests, called for BoolExpr, BooleanTest and NullTest
+
+CREATE FUNCTION vbool_and(vbool, vbool) RETURNS vbool AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION vbool_or(vbool, vbool) RETURNS vbool AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION vbool_not(vbool) RETURNS vbool AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION vbool_is_true(vbool) RETURNS vbool AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION vbool_is_not_true(vbool) RETURNS vbool AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION vbool_is_false(vbool) RETURNS vbool AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION vbool_is_not_false(vbool) RETURNS vbool AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION vbool_is_unknown(vbool) RETURNS vbool AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION vbool_is_not_unknown(vbool) RETURNS vbool AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION vtype_is_null(vany) RETURNS vbool AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION vtype_is_not_null(vany) RETURNS vbool AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE STRICT;
+
+-- CASE, COALESCE and NULLIF, whose scalar arguments may be null
+
+CREATE FUNCTION vtype_case(vbool, vany, vany) RETURNS vany AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE;
+CREATE FUNCTION vtype_coalesce(vany, vany) RETURNS vany AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE;
+
+-- x IN (...), called for ScalarArrayOpExpr on a constant array
+
+CREATE FUNCTION vtype_in_array(vany, anyarray) RETURNS vbool AS '$libdir/vectorize_engine' LANGUAGE C IMMUTABLE STRICT;
+
 
 --create count aggregate functions
 
@@ -0,0 +1,28 @@
+#ifndef VECTOR_ENGINE_VTYPE_VAGG_H
+#define VECTOR_ENGINE_VTYPE_VAGG_H
+#include "postgres.h"
+#include "fmgr.h"
+
+/*
+ * The batch transition functions of the vectorized aggregates are called
+ * as transfn(state, mode, batch...), mode telling what state is.
+ *
+ * VAGG_PLAIN: state is the transition value, and the new one is returned.
+ *
+ * VAGG_GROUPED: state points to a VAggGroups, holding the transition
+ * values of the aggregate for all the groups, by group number, and the
+ * group of each row of the batch.  They are updated in place.  The null
+ * flag of a group, set while its transition value is the missing initial
+ * value, is cleared by the first row that gives it a value.
+ */
+#define VAGG_PLAIN		(-1)
+#define VAGG_GROUPED	(-2)
+
+typedef struct VAggGroups
+{
+	Datum	   *transValues;	/* by group number */
+	bool	   *transNulls;		/* by group number */
+	const int  *groups;			/* by row of the batch */
+} VAggGroups;
+
+#endif
@@ -0,0 +1,212 @@
+#include "vbool.h"
+#include "vtype.h"
+
+PG_FUNCTION_INFO_V1(vbool_and);
+PG_FUNCTION_INFO_V1(vbool_or);
+PG_FUNCTION_INFO_V1(vbool_not);
+PG_FUNCTION_INFO_V1(vbool_is_true);
+PG_FUNCTION_INFO_V1(vbool_is_not_true);
+PG_FUNCTION_INFO_V1(vbool_is_false);
+PG_FUNCTION_INFO_V1(vbool_is_not_false);
+PG_FUNCTION_INFO_V1(vbool_is_unknown);
+PG_FUNCTION_INFO_V1(vbool_is_not_unknown);
+PG_FUNCTION_INFO_V1(vtype_is_null);
+PG_FUNCTION_INFO_V1(vtype_is_not_null);
+
+typedef enum VBoolOp
+{
+	VBOOL_AND,
+	VBOOL_OR,
+	VBOOL_NOT,
+	VBOOL_IS_TRUE,
+	VBOOL_IS_NOT_TRUE,
+	VBOOL_IS_FALSE,
+	VBOOL_IS_NOT_FALSE,
+	VBOOL_IS_NULL,
+	VBOOL_IS_NOT_NULL
+} VBoolOp;
+
+/*
+ * The kernels below work on 8 rows at a time: the bool values of the rows
+ * are loaded as one word, a byte per row, and their null bits are spread
+ * into a word of the same shape, so that the three valued logic is a few
+ * bitwise operations on words.  All the rows of the batch are computed,
+ * the active ones or not, without looking at the selection; values of
+ * rows that are not active may be garbage, so every byte loaded is masked
+ * down to its low bit.
+ */
+
+/* a 1 in every byte, the word of 8 true rows */
+#define VBOOL_ONES		UINT64CONST(0x0101010101010101)
+
+/* the 8 null bits of a bitmap byte, as a word of a byte per row */
+static inline uint64
+vbool_spreadbits(uint64 bits)
+{
+	uint64		y = ((bits & 0xFF) * VBOOL_ONES) & UINT64CONST(0x8040201008040201);
+
+	return ((y + UINT64CONST(0x7F7F7F7F7F7F7F7F)) >> 7) & VBOOL_ONES;
+}
+
+#ifdef WORDS_BIGENDIAN
+static inline uint64
+vbool_bswap(uint64 x)
+{
+	int			i;
+	uint64		r = 0;
+
+	for (i = 0; i < 8; i++)
+		r |= ((x >> (8 * i)) & 0xFF) << (8 * (7 - i));
+	return r;
+}
+#endif
+
+/* the other way round, a word of a byte per row as 8 bits */
+static inline uint64
+vbool_packbits(uint64 word)
+{
+	return (word * UINT64CONST(0x0102040810204080)) >> 56;
+}
+
+/*
+ * Compute 8 rows of op from the values a and b and the nulls na and nb of
+ * the arguments, as words of a byte per row.  Returns the values and sets
+ * *nres to the nulls of the result.  The values of null results are false.
+ */
+static inline uint64
+vbool_word(VBoolOp op, uint64 a, uint64 na, uint64 b, uint64 nb,
+		   uint64 *nres)
+{
+	uint64		v;
+
+	*nres = 0;
+	switch (op)
+	{
+		case VBOOL_AND:
+			/* a null is true as far as the other side is concerned */
+			v = (a | na) & (b | nb);
+			*nres = v & (na | nb);
+			return v & ~*nres;
+		case VBOOL_OR:
+			/* and false here */
+			v = (a & ~na) | (b & ~nb);
+			*nres = ~v & (na | nb);
+			return v;
+		case VBOOL_NOT:
+			*nres = na;
+			return (a ^ VBOOL_ONES) & ~na;
+		case VBOOL_IS_TRUE:
+			return a & ~na;
+		case VBOOL_IS_NOT_TRUE:
+			return (a & ~na) ^ VBOOL_ONES;
+		case VBOOL_IS_FALSE:
+			return (a ^ VBOOL_ONES) & ~na;
+		case VBOOL_IS_NOT_FALSE:
+			return ((a ^ VBOOL_ONES) & ~na) ^ VBOOL_ONES;
+		case VBOOL_IS_NULL:
+			return na;
+		case VBOOL_IS_NOT_NULL:
+			return na ^ VBOOL_ONES;
+	}
+	return 0;
+}
+
+/* the 8 null bits of the rows from base on, which is a multiple of 8 */
+#define VBOOL_NULLBITS(vt, base) \
+	((vt) != NULL && (vt)->hasnull ? \
+	 ((vt)->nulls[(base) >> 6] >> ((base) & 63)) & 0xFF : 0)
+
+/*
+ * Run op over a batch.  arg2 is NULL for the unary ones; the values of
+ * arg1 are not read by the null tests, where it may be of any type.
+ */
+static vbool *
+vbool_logic(FunctionCallInfo fcinfo, VBoolOp op, vtype *arg1, vtype *arg2)
+{
+	vbool	   *res;
+	int			dim = arg1->dim;
+	bool		readvalues = (op != VBOOL_IS_NULL && op != VBOOL_IS_NOT_NULL);
+	int			base;
+
+	res = buildvbool_result(fcinfo, dim, arg1->selref);
+
+	for (base = 0; base < dim; base += 8)
+	{
+		uint64		a = 0;
+		uint64		b = 0;
+		uint64		na;
+		uint64		nb = 0;
+		uint64		v;
+		uint64		nres;
+		int			n = Min(8, dim - base);
+
+		/* the values arrays are padded well past a word, see buildvtype */
+		if (readvalues)
+		{
+			memcpy(&a, VTYPE_VALUES(arg1, bool) + base, sizeof(uint64));
+			if (arg2 != NULL)
+				memcpy(&b, VTYPE_VALUES(arg2, bool) + base, sizeof(uint64));
+		}
+#ifdef WORDS_BIGENDIAN
+		/* row base is the first byte in memory, make it the low one */
+		a = vbool_bswap(a);
+		b = vbool_bswap(b);
+#endif
+		a &= VBOOL_ONES;
+		b &= VBOOL_ONES;
+		na = vbool_spreadbits(VBOOL_NULLBITS(arg1, base));
+		if (arg2 != NULL)
+			nb = vbool_spreadbits(VBOOL_NULLBITS(arg2, base));
+
+		v = vbool_word(op, a, na, b, nb, &nres);
+
+		/* rows past the end of the batch are never null */
+		if (n < 8)
+			nres &= (UINT64CONST(1) << (8 * n)) - 1;
+		if (nres != 0)
+		{
+			res->nulls[base >> 6] |= vbool_packbits(nres) << (base & 63);
+			res->hasnull = true;
+		}
+#ifdef WORDS_BIGENDIAN
+		v = vbool_bswap(v);
+#endif
+		memcpy(VTYPE_VALUES(res, bool) + base, &v, sizeof(uint64));
+	}
+
+	return res;
+}
+
+Datum
+vbool_and(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_POINTER(vbool_logic(fcinfo, VBOOL_AND,
+								  (vtype *) PG_GETARG_POINTER(0),
+								  (vtype *) PG_GETARG_POINTER(1)));
+}
+
+Datum
+vbool_or(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_POINTER(vbool_logic(fcinfo, VBOOL_OR,
+								  (vtype *) PG_GETARG_POINTER(0),
+								  (vtype *) PG_GETARG_POINTER(1)));
+}
+
+#define VBOOL_UNARY(fname, op) \
+Datum \
+fname(PG_FUNCTION_ARGS) \
+{ \
+	PG_RETURN_POINTER(vbool_logic(fcinfo, op, \
+								  (vtype *) PG_GETARG_POINTER(0), NULL)); \
+}
+
+VBOOL_UNARY(vbool_not, VBOOL_NOT)
+VBOOL_UNARY(vbool_is_true, VBOOL_IS_TRUE)
+VBOOL_UNARY(vbool_is_not_true, VBOOL_IS_NOT_TRUE)
+VBOOL_UNARY(vbool_is_false, VBOOL_IS_FALSE)
+VBOOL_UNARY(vbool_is_not_false, VBOOL_IS_NOT_FALSE)
+VBOOL_UNARY(vbool_is_unknown, VBOOL_IS_NULL)
+VBOOL_UNARY(vbool_is_not_unknown, VBOOL_IS_NOT_NULL)
+VBOOL_UNARY(vtype_is_null, VBOOL_IS_NULL)
+VBOOL_UNARY(vtype_is_not_null, VBOOL_IS_NOT_NULL)
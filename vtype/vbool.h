@@ -0,0 +1,23 @@
+#ifndef VECTOR_ENGINE_VTYPE_VBOOL_H
+#define VECTOR_ENGINE_VTYPE_VBOOL_H
+#include "postgres.h"
+#include "fmgr.h"
+
+/* AND, OR and NOT, in three valued logic */
+extern Datum vbool_and(PG_FUNCTION_ARGS);
+extern Datum vbool_or(PG_FUNCTION_ARGS);
+extern Datum vbool_not(PG_FUNCTION_ARGS);
+
+/* BooleanTest */
+extern Datum vbool_is_true(PG_FUNCTION_ARGS);
+extern Datum vbool_is_not_true(PG_FUNCTION_ARGS);
+extern Datum vbool_is_false(PG_FUNCTION_ARGS);
+extern Datum vbool_is_not_false(PG_FUNCTION_ARGS);
+extern Datum vbool_is_unknown(PG_FUNCTION_ARGS);
+extern Datum vbool_is_not_unknown(PG_FUNCTION_ARGS);
+
+/* NullTest, on a vtype of any type */
+extern Datum vtype_is_null(PG_FUNCTION_ARGS);
+extern Datum vtype_is_not_null(PG_FUNCTION_ARGS);
+
+#endif
@@ -0,0 +1,166 @@
+#include "vcase.h"
+#include "vtype.h"
+#include "utils.h"
+
+PG_FUNCTION_INFO_V1(vtype_case);
+PG_FUNCTION_INFO_V1(vtype_coalesce);
+
+/*
+ * The kernels of CaseExpr, CoalesceExpr and NullIfExpr, see plan.c.  They
+ * take their value arguments either as vtypes of the result type or as
+ * scalars of its element type, which stand for the same value in every
+ * row, and tell the two apart by the types of the expressions they are
+ * called on.  A scalar may be null, so the functions are not strict.
+ *
+ * They only pick rows: in a compiled program the arguments have been
+ * computed for the rows they are picked for and no others, and values of
+ * the other rows must not be read.
+ */
+
+/* a value argument */
+typedef struct VCaseArg
+{
+	vtype	   *vt;				/* NULL if a scalar */
+	bool		isnull;			/* of the scalar */
+	uint64		value;			/* the scalar, as stored in a vtype */
+} VCaseArg;
+
+static void
+vcase_getarg(FunctionCallInfo fcinfo, int argno, Oid elemtype, VCaseArg *arg)
+{
+	Oid			type = get_fn_expr_argtype(fcinfo->flinfo, argno);
+	vtype		tmp;
+
+	if (type == InvalidOid)
+		elog(ERROR, "could not determine the argument types of a vectorized CASE");
+
+	arg->value = 0;
+	if (GetNtype(type) != InvalidOid)
+	{
+		arg->vt = (vtype *) PG_GETARG_POINTER(argno);
+		arg->isnull = false;
+		return;
+	}
+
+	arg->vt = NULL;
+	arg->isnull = PG_ARGISNULL(argno);
+	if (!arg->isnull)
+	{
+		/* store it the way vtype_setdatum would, so rows copy it bitwise */
+		tmp.elemtype = elemtype;
+		tmp.values = &arg->value;
+		vtype_setdatum(&tmp, 0, PG_GETARG_DATUM(argno));
+	}
+}
+
+#define VCASE_ISNULL(arg, i) \
+	((arg)->vt == NULL ? (arg)->isnull : \
+	 ((arg)->vt->hasnull && VTYPE_ISNULL((arg)->vt, (i))))
+
+#define VCASE_VALUE(arg, ctype, i) \
+	((arg)->vt == NULL ? *(const ctype *) &(arg)->value : \
+	 VTYPE_VALUES((arg)->vt, ctype)[(i)])
+
+/* whether row i is taken from first, by cond or else by first not null */
+#define VCASE_FIRST(i) \
+	(cond != NULL ? \
+	 (!(cond->hasnull && VTYPE_ISNULL(cond, (i))) && \
+	  VTYPE_VALUES(cond, bool)[(i)]) : \
+	 !VCASE_ISNULL(first, (i)))
+
+#define VCASE_BLEND(ctype) \
+	VSEL_FOREACH(res->selref, res->dim, i, \
+	{ \
+		const VCaseArg *src = VCASE_FIRST(i) ? first : second; \
+		if (VCASE_ISNULL(src, i)) \
+			VTYPE_SETNULL(res, i); \
+		else \
+			VTYPE_VALUES(res, ctype)[i] = VCASE_VALUE(src, ctype, i); \
+	})
+
+/*
+ * Fill the active rows of res from first or second.  Values are copied as
+ * the bits of their width, whatever their type.
+ */
+static void
+vcase_blend(vtype *res, const vtype *cond, const VCaseArg *first,
+			const VCaseArg *second)
+{
+	int			i;
+
+	switch (res->elemlen)
+	{
+		case 1:
+			VCASE_BLEND(uint8);
+			break;
+		case 2:
+			VCASE_BLEND(uint16);
+			break;
+		case 4:
+			VCASE_BLEND(uint32);
+			break;
+		case 8:
+			VCASE_BLEND(uint64);
+			break;
+		default:
+			VCASE_BLEND(Datum);
+			break;
+	}
+}
+
+/* the element type of the result, from the expression called */
+static Oid
+vcase_elemtype(FunctionCallInfo fcinfo)
+{
+	Oid			elemtype = GetNtype(get_fn_expr_rettype(fcinfo->flinfo));
+
+	if (elemtype == InvalidOid)
+		elog(ERROR, "could not determine the result type of a vectorized CASE");
+	return elemtype;
+}
+
+/*
+ * vtype_case(cond, then, else) is CASE WHEN cond THEN then ELSE else END
+ * row by row; plan.c nests it for more WHEN clauses.
+ */
+Datum
+vtype_case(PG_FUNCTION_ARGS)
+{
+	vtype	   *cond = (vtype *) PG_GETARG_POINTER(0);
+	Oid			elemtype = vcase_elemtype(fcinfo);
+	VCaseArg	first;
+	VCaseArg	second;
+	vtype	   *res;
+
+	vcase_getarg(fcinfo, 1, elemtype, &first);
+	vcase_getarg(fcinfo, 2, elemtype, &second);
+
+	res = buildvtype_result(fcinfo, elemtype, cond->dim, cond->selref);
+	vcase_blend(res, cond, &first, &second);
+	PG_RETURN_POINTER(res);
+}
+
+/*
+ * vtype_coalesce(first, second) is COALESCE(first, second) row by row;
+ * plan.c nests it for more arguments.
+ */
+Datum
+vtype_coalesce(PG_FUNCTION_ARGS)
+{
+	Oid			elemtype = vcase_elemtype(fcinfo);
+	VCaseArg	first;
+	VCaseArg	second;
+	vtype	   *batch;
+	vtype	   *res;
+
+	vcase_getarg(fcinfo, 0, elemtype, &first);
+	vcase_getarg(fcinfo, 1, elemtype, &second);
+
+	/* plan.c leaves COALESCE of scalars only to the scalar executor */
+	batch = first.vt != NULL ? first.vt : second.vt;
+	Assert(batch != NULL);
+
+	res = buildvtype_result(fcinfo, elemtype, batch->dim, batch->selref);
+	vcase_blend(res, NULL, &first, &second);
+	PG_RETURN_POINTER(res);
+}
@@ -0,0 +1,12 @@
+#ifndef VECTOR_ENGINE_VTYPE_VCASE_H
+#define VECTOR_ENGINE_VTYPE_VCASE_H
+#include "postgres.h"
+#include "fmgr.h"
+
+/* the row of the second or third argument, depending on the first */
+extern Datum vtype_case(PG_FUNCTION_ARGS);
+
+/* the row of the first argument, or of the second where it is null */
+extern Datum vtype_coalesce(PG_FUNCTION_ARGS);
+
+#endif
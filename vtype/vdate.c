@@ -17,9 +17,9 @@ static vtimestamp* vdate2vtimestamp(vdate* vdateVal);
  * time zone
  */
 
-vdate* buildvdate(int dim, bool *skip)
+vdate* buildvdate(int dim, vselection *sel)
 {
-	return (vdate *)buildvtype(DATEOID, dim, skip);	
+	return (vdate *)buildvtype(DATEOID, dim, sel);	
 }
 
 
@@ -28,15 +28,18 @@ vdate2vtimestamp(vdate* vdateVal)
 {
 	vtimestamp	*result;
 	int 		i;
+	int			n;
+	int			nrows;
 	DateADT		dateVal;
 	Timestamp	tmp;	
 	
-	result = buildvtimestamp(vdateVal->dim, vdateVal->skipref);
-	for (i = 0; i < BATCHSIZE; i++)
+	result = buildvtimestamp(vdateVal->dim, vdateVal->selref);
+	vtype_copynulls(result, vdateVal, NULL);
+	nrows = VSEL_NROWS(vdateVal->selref, vdateVal->dim);
+	for (n = 0; n < nrows; n++)
 	{
-		if (vdateVal->skipref[i])
-			continue;
-		dateVal = DatumGetDateADT(vdateVal->values[i]);	
+		i = VSEL_ROW(vdateVal->selref, n);
+		dateVal = VTYPE_VALUES(vdateVal, DateADT)[i];	
 #ifdef HAVE_INT64_TIMESTAMP
 		/* date is days since 2000, timestamp is microseconds since same... */
 		tmp = dateVal * USECS_PER_DAY;
@@ -47,10 +50,10 @@ vdate2vtimestamp(vdate* vdateVal)
 					(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
 					 errmsg("date out of range for timestamp")));
 
-		result->values[i] = TimestampGetDatum(tmp);
+		VTYPE_VALUES(result, Timestamp)[i] = tmp;
 #else
 		/* date is days since 2000, timestamp is seconds since same... */
-		result->values[i] = TimestampGetDatum(dateVal * (double) SECS_PER_DAY);
+		VTYPE_VALUES(result, Timestamp)[i] = dateVal * (double) SECS_PER_DAY;
 #endif
 	}
 	return result;
@@ -67,15 +70,14 @@ vdate_le_timestamp(PG_FUNCTION_ARGS)
 	
 	vdt1 = vdate2vtimestamp(vdateVal);
 
-	result = buildvbool(vdt1->dim, vdt1->skipref);
+	result = buildvbool_result(fcinfo, vdt1->dim, vdt1->selref);
+	vtype_copynulls(result, vdt1, NULL);
 #ifdef HAVE_INT64_TIMESTAMP
-	for (i = 0; i < BATCHSIZE; i++ )
+	VSEL_FOREACH(vdt1->selref, vdt1->dim, i,
 	{
-		if (vdt1->skipref[i])
-			continue;
-		dt1 = DatumGetTimestamp(vdt1->values[i]);
-		result->values[i] = BoolGetDatum((dt1 <= dt2) ? true :false);
-	}
+		dt1 = VTYPE_VALUES(vdt1, Timestamp)[i];
+		VTYPE_VALUES(result, bool)[i] = (dt1 <= dt2) ? true :false;
+	});
 	return PointerGetDatum(result);
 #else
 	elog(ERROR, "HAVE_INT64_TIMESTAMP must be enabled in vectorize executor.");
@@ -104,13 +106,12 @@ vdate_le(PG_FUNCTION_ARGS)
 	vbool		*result;
 	int			i;
 	
-	result = buildvbool(vdt1->dim, vdt1->skipref);
-	for (i = 0; i < BATCHSIZE; i++ )
+	result = buildvbool_result(fcinfo, vdt1->dim, vdt1->selref);
+	vtype_copynulls(result, vdt1, NULL);
+	VSEL_FOREACH(vdt1->selref, vdt1->dim, i,
 	{
-		if (vdt1->skipref[i])
-			continue;
-		result->values[i] = BoolGetDatum(DatumGetDateADT(vdt1->values[i]) <= dateVal2);
-	}
+		VTYPE_VALUES(result, bool)[i] = (VTYPE_VALUES(vdt1, DateADT)[i] <= dateVal2);
+	});
 	PG_RETURN_POINTER(result);
 }
 
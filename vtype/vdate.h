@@ -2,8 +2,9 @@
 #define VECTOR_ENGINE_VTYPE_VDATE_H
 #include "postgres.h"
 #include "fmgr.h"
+struct vselection;
 typedef struct vtype vdate;
-extern vdate* buildvdate(int dim, bool *skip);
+extern vdate* buildvdate(int dim, struct vselection *sel);
 
 /* vdate oper op const */
 extern Datum vdate_mi_interval(PG_FUNCTION_ARGS);
@@ -1,5 +1,6 @@
 #include "vfloat.h"
 #include "vtype.h"
+#include "vagg.h"
 #include "math.h"
 #include "utils/array.h"
 #include "catalog/pg_type.h"
@@ -34,15 +35,14 @@ Datum vfloat8vfloat8mul2(PG_FUNCTION_ARGS)
 	float8		mul;
 	int			i;
 
-	result = buildvtype(FLOAT8OID, BATCHSIZE, arg1->skipref);
+	result = buildvtype_result(fcinfo, FLOAT8OID, arg1->dim, arg1->selref);
+	vtype_copynulls(result, arg1, arg2);
 
-	for (i = 0; i < BATCHSIZE; i++ )
+	VSEL_FOREACH(arg1->selref, arg1->dim, i,
 	{
-		if (arg1->skipref[i])
-			continue;
-		mul = DatumGetFloat8(arg1->values[i]) * DatumGetFloat8(arg2->values[i]);
-		result->values[i] = Float8GetDatum(mul);
-	}
+		mul = VTYPE_VALUES(arg1, float8)[i] * VTYPE_VALUES(arg2, float8)[i];
+		VTYPE_VALUES(result, float8)[i] = mul;
+	});
 
 	PG_RETURN_POINTER(result);
 }
@@ -53,29 +53,31 @@ Datum vfloat8pl(PG_FUNCTION_ARGS)
 	float8		arg1;
 	float8		arg2;
 	int			i;
-	char		**entries;
+	VAggGroups	*groups;
+	Datum		*transVal;
 	vtype		*batch;
-	Datum *transVal;
-	int32 groupOffset = PG_GETARG_INT32(1);
+	int32 mode = PG_GETARG_INT32(1);
 
-	if (groupOffset < 0)
+	if (mode == VAGG_PLAIN)
 		elog(ERROR, "Not implemented");
 
-	entries = (char **)PG_GETARG_POINTER(0);
+	Assert(mode == VAGG_GROUPED);
+	groups = (VAggGroups *) PG_GETARG_POINTER(0);
 	batch = (vtype *) PG_GETARG_POINTER(2);
-	for (i = 0; i < BATCHSIZE; i++)
+	VSEL_FOREACH(batch->selref, batch->dim, i,
 	{
-		if (batch->skipref[i])
+		if (batch->hasnull && VTYPE_ISNULL(batch, i))
 			continue;
 		
-		transVal = (Datum *)(entries[i] + groupOffset);	
+		transVal = &groups->transValues[groups->groups[i]];
 		arg1 = DatumGetFloat8(*transVal);
-		arg2 = DatumGetFloat8(batch->values[i]);
+		arg2 = VTYPE_VALUES(batch, float8)[i];
 		result = arg1 + arg2;
 
 		CHECKFLOATVAL(result, isinf(arg1) || isinf(arg2), true);
 		*transVal = Float8GetDatum(result);
-	}
+		groups->transNulls[groups->groups[i]] = false;
+	});
 
 	PG_RETURN_INT64(0);
 }
@@ -91,29 +93,35 @@ vfloat8_accum(PG_FUNCTION_ARGS)
 				sumX,
 				sumX2;
 
-	Datum		*transDatum;
 	int			i;
-	char		**entries;
+	VAggGroups	*groups;
 	vtype		*batch;
-	int32		groupOffset = PG_GETARG_INT32(1);
+	int32		mode = PG_GETARG_INT32(1);
 
-	if (groupOffset < 0)
+	if (mode == VAGG_PLAIN)
 		elog(ERROR, "Not implemented");
 
-	entries = (char **)PG_GETARG_POINTER(0);
+	/*
+	 * The transition arrays of the groups are modified in place, which
+	 * only an aggregate may do.
+	 */
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "vfloat8_accum called in non-aggregate context");
+
+	Assert(mode == VAGG_GROUPED);
+	groups = (VAggGroups *) PG_GETARG_POINTER(0);
 	batch = (vtype *) PG_GETARG_POINTER(2);
 
-	for (i = 0; i < BATCHSIZE; i++)
+	VSEL_FOREACH(batch->selref, batch->dim, i,
 	{
-		if (batch->skipref[i])
+		if (batch->hasnull && VTYPE_ISNULL(batch, i))
 			continue;
-		transDatum = (Datum *)(entries[i] + groupOffset);
-		transarray = DatumGetArrayTypeP(*transDatum);
+		transarray = DatumGetArrayTypeP(groups->transValues[groups->groups[i]]);
 		transvalues = check_float8_array(transarray, "float8_accum", 3);
 		N = transvalues[0];
 		sumX = transvalues[1];
 		sumX2 = transvalues[2];
-		newval = DatumGetFloat8(batch->values[i]);
+		newval = VTYPE_VALUES(batch, float8)[i];
 
 		N += 1.0;
 		sumX += newval;
@@ -121,33 +129,11 @@ vfloat8_accum(PG_FUNCTION_ARGS)
 		sumX2 += newval * newval;
 		CHECKFLOATVAL(sumX2, isinf(transvalues[2]) || isinf(newval), true);
 
-		/*
-		 * If we're invoked as an aggregate, we can cheat and modify our first
-		 * parameter in-place to reduce palloc overhead. Otherwise we construct a
-		 * new array with the updated transition data and return it.
-		 */
-		if (AggCheckCallContext(fcinfo, NULL))
-		{
-			transvalues[0] = N;
-			transvalues[1] = sumX;
-			transvalues[2] = sumX2;
-		}
-#if 0
-		else
-		{
-			Datum		transdatums[3];
-			ArrayType  *result;
-
-			transdatums[0] = Float8GetDatumFast(N);
-			transdatums[1] = Float8GetDatumFast(sumX);
-			transdatums[2] = Float8GetDatumFast(sumX2);
-
-			result = construct_array(transdatums, 3,
-					FLOAT8OID,
-					sizeof(float8), FLOAT8PASSBYVAL, 'd');
-		}
-#endif
-	}
+		transvalues[0] = N;
+		transvalues[1] = sumX;
+		transvalues[2] = sumX2;
+		groups->transNulls[groups->groups[i]] = false;
+	});
 	PG_RETURN_ARRAYTYPE_P(0);
 }
 
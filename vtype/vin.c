@@ -0,0 +1,238 @@
+#include "vin.h"
+#include "vtype.h"
+#include "utils/array.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+PG_FUNCTION_INFO_V1(vtype_in_array);
+
+/*
+ * x IN (...) of a vtype of an integer type, dates or timestamps, whose
+ * equality is that of their values as integers.  The elements of the
+ * array are turned once into a set of int64 keys, kept in fn_extra with
+ * the result.  Lists of up to VIN_LINEAR_MAX keys are compared with every
+ * row, a key at a time, in loops without branches; longer ones are put in
+ * an open addressing hash table that each row probes.
+ */
+#define VIN_LINEAR_MAX	16
+
+typedef struct VInSet
+{
+	vtype	   *result;
+	MemoryContext cxt;
+	Oid			elemtype;
+	bool		hasnull;		/* the array has a null element */
+	int			nkeys;
+	int64	   *keys;			/* the other elements */
+	uint32		mask;			/* slots of the hash table less one, or 0 */
+	int64	   *slots;
+	bool	   *used;
+} VInSet;
+
+/* the finalizer of MurmurHash3, as good as the keys need */
+static inline uint32
+vin_hash(int64 key)
+{
+	uint64		h = (uint64) key;
+
+	h ^= h >> 33;
+	h *= UINT64CONST(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	h *= UINT64CONST(0xc4ceb9fe1a85ec53);
+	h ^= h >> 33;
+	return (uint32) h;
+}
+
+static int64
+vin_key(Datum value, Oid elemtype)
+{
+	switch (elemtype)
+	{
+		case INT2OID:
+			return DatumGetInt16(value);
+		case INT4OID:
+			return DatumGetInt32(value);
+		case DATEOID:
+			return DatumGetDateADT(value);
+		case INT8OID:
+			return DatumGetInt64(value);
+		case TIMESTAMPOID:
+			return DatumGetTimestamp(value);
+		default:
+			elog(ERROR, "vectorized IN of type %u not supported", elemtype);
+	}
+	return 0;					/* keep compiler quiet */
+}
+
+static VInSet *
+vin_build(ArrayType *array, Oid elemtype, MemoryContext cxt)
+{
+	MemoryContext oldcontext;
+	VInSet	   *set;
+	Datum	   *elems;
+	bool	   *nulls;
+	int			nelems;
+	int16		typlen;
+	bool		typbyval;
+	char		typalign;
+	uint32		nslots;
+	int			i;
+
+	if (ARR_ELEMTYPE(array) != elemtype)
+		elog(ERROR, "vectorized IN of type %u on an array of type %u",
+			 elemtype, ARR_ELEMTYPE(array));
+
+	oldcontext = MemoryContextSwitchTo(cxt);
+
+	get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+	deconstruct_array(array, elemtype, typlen, typbyval, typalign,
+					  &elems, &nulls, &nelems);
+
+	set = palloc0(sizeof(VInSet));
+	set->cxt = cxt;
+	set->elemtype = elemtype;
+	set->keys = palloc(sizeof(int64) * Max(nelems, 1));
+	for (i = 0; i < nelems; i++)
+	{
+		if (nulls[i])
+			set->hasnull = true;
+		else
+			set->keys[set->nkeys++] = vin_key(elems[i], elemtype);
+	}
+
+	if (set->nkeys > VIN_LINEAR_MAX)
+	{
+		/* at most half full, so that a probe ends at an empty slot soon */
+		nslots = 1;
+		while (nslots < 2 * (uint32) set->nkeys)
+			nslots <<= 1;
+		set->mask = nslots - 1;
+		set->slots = palloc(sizeof(int64) * nslots);
+		set->used = palloc0(sizeof(bool) * nslots);
+
+		for (i = 0; i < set->nkeys; i++)
+		{
+			int64		key = set->keys[i];
+			uint32		slot = vin_hash(key) & set->mask;
+
+			while (set->used[slot] && set->slots[slot] != key)
+				slot = (slot + 1) & set->mask;
+			set->slots[slot] = key;
+			set->used[slot] = true;
+		}
+	}
+
+	pfree(elems);
+	pfree(nulls);
+	MemoryContextSwitchTo(oldcontext);
+
+	return set;
+}
+
+/*
+ * Every row against every key, active or not: the values of rows that are
+ * not active may be garbage, but comparing them does no harm, and the
+ * loop over the rows vectorizes.
+ */
+#define VIN_LINEAR(ctype) \
+	do { \
+		const ctype *v = VTYPE_VALUES(arg, ctype); \
+		int			k; \
+		\
+		memset(rv, 0, sizeof(bool) * arg->dim); \
+		for (k = 0; k < set->nkeys; k++) \
+		{ \
+			ctype		key = (ctype) set->keys[k]; \
+			\
+			for (i = 0; i < arg->dim; i++) \
+				rv[i] |= (v[i] == key); \
+		} \
+	} while (0)
+
+#define VIN_PROBE(ctype) \
+	do { \
+		const ctype *v = VTYPE_VALUES(arg, ctype); \
+		\
+		VSEL_FOREACH(arg->selref, arg->dim, i, \
+		{ \
+			int64		key = (int64) v[i]; \
+			uint32		slot = vin_hash(key) & set->mask; \
+			\
+			rv[i] = false; \
+			while (set->used[slot]) \
+			{ \
+				if (set->slots[slot] == key) \
+				{ \
+					rv[i] = true; \
+					break; \
+				} \
+				slot = (slot + 1) & set->mask; \
+			} \
+		}); \
+	} while (0)
+
+/*
+ * vtype_in_array(x, array) is x = ANY(array), row by row: null where x is,
+ * true where it is found, and where not, null if the array has a null and
+ * false otherwise.
+ */
+Datum
+vtype_in_array(PG_FUNCTION_ARGS)
+{
+	vtype	   *arg = (vtype *) PG_GETARG_POINTER(0);
+	FmgrInfo   *flinfo = fcinfo->flinfo;
+	VInSet	   *set = NULL;
+	vtype	   *res;
+	bool	   *rv;
+	int			i;
+
+	/* plan.c only passes a Const as the array, so it is built once */
+	if (flinfo != NULL)
+		set = (VInSet *) flinfo->fn_extra;
+	if (set == NULL)
+	{
+		set = vin_build(PG_GETARG_ARRAYTYPE_P(1), arg->elemtype,
+						flinfo != NULL ? flinfo->fn_mcxt : CurrentMemoryContext);
+		if (flinfo != NULL)
+			flinfo->fn_extra = set;
+	}
+
+	res = buildvtype_cached(&set->result, set->cxt, BOOLOID, arg->dim,
+							arg->selref);
+	rv = VTYPE_VALUES(res, bool);
+
+	switch (arg->elemtype)
+	{
+		case INT2OID:
+			if (set->mask == 0)
+				VIN_LINEAR(int16);
+			else
+				VIN_PROBE(int16);
+			break;
+		case INT4OID:
+		case DATEOID:
+			if (set->mask == 0)
+				VIN_LINEAR(int32);
+			else
+				VIN_PROBE(int32);
+			break;
+		default:
+			if (set->mask == 0)
+				VIN_LINEAR(int64);
+			else
+				VIN_PROBE(int64);
+			break;
+	}
+
+	vtype_copynulls(res, arg, NULL);
+	if (set->hasnull)
+	{
+		VSEL_FOREACH(res->selref, res->dim, i,
+		{
+			if (!rv[i])
+				VTYPE_SETNULL(res, i);
+		});
+	}
+
+	PG_RETURN_POINTER(res);
+}
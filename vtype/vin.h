@@ -0,0 +1,9 @@
+#ifndef VECTOR_ENGINE_VTYPE_VIN_H
+#define VECTOR_ENGINE_VTYPE_VIN_H
+#include "postgres.h"
+#include "fmgr.h"
+
+/* x = ANY(array) of a vtype and a constant array, see plan.c */
+extern Datum vtype_in_array(PG_FUNCTION_ARGS);
+
+#endif
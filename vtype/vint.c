@@ -1,35 +1,72 @@
 #include "vint.h"
 #include "vtype.h"
+#include "vsimd.h"
+#include "vagg.h"
 
 PG_FUNCTION_INFO_V1(vint8inc_any);
 PG_FUNCTION_INFO_V1(vint4_sum);
 PG_FUNCTION_INFO_V1(vint8inc);
 
+/*
+ * The loops of plain aggregates over a dense batch.  A null bitmap is
+ * counted a word at a time; bits past dim in its last word are masked.
+ */
+VSIMD_FUNCTION(vint_count_nulls, (int nwords, const uint64 *nulls, int64 *count),
+			   (nwords, nulls, count),
+			   int i;
+			   for (i = 0; i < nwords; i++)
+				   *count += __builtin_popcountll(nulls[i]);)
+
+VSIMD_FUNCTION(vint4_sum_loop, (int n, const int32 *values, int64 *sum),
+			   (n, values, sum),
+			   int i;
+			   int64 s = 0;
+			   for (i = 0; i < n; i++)
+				   s += values[i];
+			   *sum += s;)
+
+/* add to an int8 transition value of VAGG_GROUPED */
+#define VINT8_ADD(transVal, val) \
+	((transVal) = Int64GetDatum(DatumGetInt64(transVal) + (val)))
+
 Datum vint8inc_any(PG_FUNCTION_ARGS)
 {
 	int64		result;
 	int64		arg;
 	int			i;
-	char		**entries;
+	VAggGroups	*groups;
+	Datum		*transVals;
 	vtype		*batch;
-	Datum *transVal;
 	
-	int32 groupOffset = PG_GETARG_INT32(1);
+	int32 mode = PG_GETARG_INT32(1);
 
-	if (groupOffset < 0)
+	if (mode == VAGG_PLAIN)
 	{
 		/* Not called as an aggregate, so just do it the dumb way */
 		arg = PG_GETARG_INT64(0);
 		batch = (vtype *) PG_GETARG_POINTER(2);
 		
 		result = arg;
-
-		for (i = 0; i < BATCHSIZE; i++)
+		if (!batch->hasnull)
+			result += VSEL_NROWS(batch->selref, batch->dim);
+		else if (batch->selref == NULL || batch->selref->dense)
 		{
-			if (batch->skipref[i])
-				continue;
-			result++;
+			int			nwords = VTYPE_NULLWORDS(batch->dim);
+			uint64		last = batch->nulls[nwords - 1];
+			int64		nnulls = 0;
+
+			if (batch->dim % 64 != 0)
+				last &= (UINT64CONST(1) << (batch->dim % 64)) - 1;
+			vint_count_nulls(nwords - 1, batch->nulls, &nnulls);
+			nnulls += __builtin_popcountll(last);
+			result += batch->dim - nnulls;
 		}
+		else
+			VSEL_FOREACH(batch->selref, batch->dim, i,
+			{
+				if (!VTYPE_ISNULL(batch, i))
+					result++;
+			});
 
 		/* Overflow check */
 		if (result < 0 && arg > 0)
@@ -40,26 +77,29 @@ Datum vint8inc_any(PG_FUNCTION_ARGS)
 		PG_RETURN_INT64(result);
 	}
 
-	entries = (char **)PG_GETARG_POINTER(0);
+	Assert(mode == VAGG_GROUPED);
+	groups = (VAggGroups *) PG_GETARG_POINTER(0);
+	transVals = groups->transValues;
 	batch = (vtype *) PG_GETARG_POINTER(2);
 
-	for (i = 0; i < BATCHSIZE; i++)
-	{
-		if (batch->skipref[i])
-			continue;
-
-		transVal = (Datum *)(entries[i] + groupOffset);	
-
-		arg = DatumGetInt64(*transVal);
-		result = arg + 1;
-		/* Overflow check */
-		if (result < 0 && arg > 0)
-			ereport(ERROR,
-					(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
-					 errmsg("bigint out of range")));
-
-		*transVal = Int64GetDatum(result);
-	}
+	/*
+	 * A batch adds at most MAX_BATCHSIZE to a count, which cannot overflow
+	 * before 2^63 - MAX_BATCHSIZE rows have been counted: not checked.
+	 */
+	if (!batch->hasnull)
+		VSEL_FOREACH(batch->selref, batch->dim, i,
+		{
+			VINT8_ADD(transVals[groups->groups[i]], 1);
+			groups->transNulls[groups->groups[i]] = false;
+		});
+	else
+		VSEL_FOREACH(batch->selref, batch->dim, i,
+		{
+			/* a count is not null once it has seen a row */
+			if (!VTYPE_ISNULL(batch, i))
+				VINT8_ADD(transVals[groups->groups[i]], 1);
+			groups->transNulls[groups->groups[i]] = false;
+		});
 
 	PG_RETURN_INT64(0);
 }
@@ -67,12 +107,12 @@ Datum vint8inc_any(PG_FUNCTION_ARGS)
 Datum
 vint4_sum(PG_FUNCTION_ARGS)
 {
-	char	**entries;
+	VAggGroups *groups;
+	Datum	*transVals;
 	vtype	*batch;
 	int		i;
 	int64	result;
-	Datum *transVal;
-	int32	groupOffset = PG_GETARG_INT32(1);
+	int32	mode = PG_GETARG_INT32(1);
 
 #if 0
 	if (PG_ARGISNULL(0))
@@ -87,37 +127,47 @@ vint4_sum(PG_FUNCTION_ARGS)
 #endif
 
 
-	if (groupOffset < 0)
+	if (mode == VAGG_PLAIN)
 	{
 		/* Not called as an aggregate, so just do it the dumb way */
 		result = PG_GETARG_INT64(0);
 		batch = (vtype *) PG_GETARG_POINTER(2);
 
-		for (i = 0; i < BATCHSIZE; i++)
-		{
-			if (batch->skipref[i])
-				continue;
-
-			result += DatumGetInt32(batch->values[i]);
-		}
+		if (!batch->hasnull &&
+			(batch->selref == NULL || batch->selref->dense))
+			vint4_sum_loop(batch->dim, VTYPE_VALUES(batch, int32), &result);
+		else
+			VSEL_FOREACH(batch->selref, batch->dim, i,
+			{
+				if (!batch->hasnull || !VTYPE_ISNULL(batch, i))
+					result += VTYPE_VALUES(batch, int32)[i];
+			});
 
 		PG_RETURN_INT64(result);
 	}
 
-	entries = (char **)PG_GETARG_POINTER(0);
+	Assert(mode == VAGG_GROUPED);
+	groups = (VAggGroups *) PG_GETARG_POINTER(0);
+	transVals = groups->transValues;
 	batch = (vtype *) PG_GETARG_POINTER(2);
-	for (i = 0; i < BATCHSIZE; i++)
-	{
-		if (batch->skipref[i])
-			continue;
 
-		transVal = (Datum *)(entries[i] + groupOffset);	
-
-		result = DatumGetInt64(*transVal);
-		result += DatumGetInt32(batch->values[i]);
-
-		*transVal = Int64GetDatum(result);
-	}
+	if (!batch->hasnull)
+		VSEL_FOREACH(batch->selref, batch->dim, i,
+		{
+			VINT8_ADD(transVals[groups->groups[i]],
+					  VTYPE_VALUES(batch, int32)[i]);
+			groups->transNulls[groups->groups[i]] = false;
+		});
+	else
+		VSEL_FOREACH(batch->selref, batch->dim, i,
+		{
+			if (!VTYPE_ISNULL(batch, i))
+			{
+				VINT8_ADD(transVals[groups->groups[i]],
+						  VTYPE_VALUES(batch, int32)[i]);
+				groups->transNulls[groups->groups[i]] = false;
+			}
+		});
 
 	PG_RETURN_INT64(0);
 }
@@ -127,23 +177,18 @@ Datum vint8inc(PG_FUNCTION_ARGS)
 	int64		result;
 	int64		arg;
 	int			i;
-	char		**entries;
+	VAggGroups	*groups;
+	Datum		*transVals;
 	vtype		*batch;
-	Datum *transVal;
-	int32 groupOffset = PG_GETARG_INT32(1);
+	int32 mode = PG_GETARG_INT32(1);
 
-	if (groupOffset < 0)
+	if (mode == VAGG_PLAIN)
 	{
 		/* Not called as an aggregate, so just do it the dumb way */
-		result = arg = PG_GETARG_INT64(0);
+		arg = PG_GETARG_INT64(0);
 		batch = (vtype *) PG_GETARG_POINTER(2);
 
-		for (i = 0; i < BATCHSIZE; i++)
-		{
-			if (batch->skipref[i])
-				continue;
-			result++;
-		}
+		result = arg + VSEL_NROWS(batch->selref, batch->dim);
 		/* Overflow check */
 		if (result < 0 && arg > 0)
 			ereport(ERROR,
@@ -153,24 +198,17 @@ Datum vint8inc(PG_FUNCTION_ARGS)
 		PG_RETURN_INT64(result);
 	}
 
-	entries = (char **)PG_GETARG_POINTER(0);
+	Assert(mode == VAGG_GROUPED);
+	groups = (VAggGroups *) PG_GETARG_POINTER(0);
+	transVals = groups->transValues;
 	batch = (vtype *) PG_GETARG_POINTER(2);
-	for (i = 0; i < BATCHSIZE; i++)
-	{
-		if (batch->skipref[i])
-			continue;
 
-		transVal = (Datum *)(entries[i] + groupOffset);	
-		arg = DatumGetInt64(*transVal);
-		result = arg + 1;
-		/* Overflow check */
-		if (result < 0 && arg > 0)
-			ereport(ERROR,
-					(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
-					 errmsg("bigint out of range")));
-
-		*transVal = Int64GetDatum(result);
-	}
+	/* as in vint8inc_any, the counts cannot overflow */
+	VSEL_FOREACH(batch->selref, batch->dim, i,
+	{
+		VINT8_ADD(transVals[groups->groups[i]], 1);
+		groups->transNulls[groups->groups[i]] = false;
+	});
 
 	PG_RETURN_INT64(0);
 }
@@ -7,9 +7,9 @@ PG_FUNCTION_INFO_V1(vany_in);
 PG_FUNCTION_INFO_V1(vany_out);
 
 
-vany* buildvany(int dim, bool *skip)
+vany* buildvany(int dim, vselection *sel)
 {
-	return (vany *)buildvtype(ANYOID, dim, skip);	
+	return (vany *)buildvtype(ANYOID, dim, sel);	
 }
 
 Datum vany_in(PG_FUNCTION_ARGS)
@@ -2,8 +2,9 @@
 #define VECTOR_ENGINE_VTYPE_VPSEUDO_H
 #include "postgres.h"
 #include "fmgr.h"
+struct vselection;
 typedef struct vtype vany;
-extern vany *buildvany(int dim, bool *skip);
+extern vany *buildvany(int dim, struct vselection *sel);
 
 extern Datum vany_in(PG_FUNCTION_ARGS);
 extern Datum vany_out(PG_FUNCTION_ARGS);
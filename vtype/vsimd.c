@@ -0,0 +1,40 @@
+#include "vsimd.h"
+
+VSimdLevel	vsimd_level = VSIMD_DEFAULT;
+
+/*
+ * Pick the widest level of the CPU.  __builtin_cpu_supports() also checks
+ * that the OS saves the wider registers.
+ */
+void
+vsimd_init(void)
+{
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		vsimd_level = VSIMD_AVX512;
+	else if (__builtin_cpu_supports("avx2"))
+		vsimd_level = VSIMD_AVX2;
+	else if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+		vsimd_level = VSIMD_SSE42;
+	else
+		vsimd_level = VSIMD_DEFAULT;
+#endif
+}
+
+const char *
+vsimd_level_name(VSimdLevel level)
+{
+	switch (level)
+	{
+		case VSIMD_SSE42:
+			return "SSE4.2";
+		case VSIMD_AVX2:
+			return "AVX2";
+		case VSIMD_AVX512:
+			return "AVX-512";
+		default:
+			return "default";
+	}
+}
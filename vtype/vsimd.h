@@ -0,0 +1,85 @@
+#ifndef VECTOR_ENGINE_VTYPE_VSIMD_H
+#define VECTOR_ENGINE_VTYPE_VSIMD_H
+#include "postgres.h"
+
+/*
+ * The instruction sets the hot loops are compiled for, in order.  Which
+ * one the CPU has is found once, by vsimd_init() at _PG_init, so that a
+ * server built for any x86-64 still runs them at the full SIMD width of
+ * the machine.
+ */
+typedef enum VSimdLevel
+{
+	VSIMD_DEFAULT,				/* what the server was compiled for */
+	VSIMD_SSE42,
+	VSIMD_AVX2,
+	VSIMD_AVX512
+} VSimdLevel;
+
+extern VSimdLevel vsimd_level;
+
+extern void vsimd_init(void);
+extern const char *vsimd_level_name(VSimdLevel level);
+
+/*
+ * VSIMD_FUNCTION(name, params, args, body...) defines static void name
+ * params, whose body is compiled once per level and run at vsimd_level.
+ * args passes params on, e.g.
+ *
+ *   VSIMD_FUNCTION(sum_int4, (int n, const int32 *v, int64 *sum), (n, v, sum),
+ *                  int i; for (i = 0; i < n; i++) *sum += v[i];)
+ *
+ * The body should be a plain loop over arrays the compiler vectorizes;
+ * the choice is made once per call, so per batch, not per row.
+ */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define VSIMD_FUNCTION(name, params, args, ...) \
+static inline __attribute__((always_inline)) void \
+name##_body params \
+{ \
+	__VA_ARGS__ \
+} \
+static __attribute__((target("sse4.2,popcnt"))) void \
+name##_sse42 params \
+{ \
+	name##_body args; \
+} \
+static __attribute__((target("avx2"))) void \
+name##_avx2 params \
+{ \
+	name##_body args; \
+} \
+static __attribute__((target("avx512f,avx512bw"))) void \
+name##_avx512 params \
+{ \
+	name##_body args; \
+} \
+static void \
+name params \
+{ \
+	switch (vsimd_level) \
+	{ \
+		case VSIMD_AVX512: \
+			name##_avx512 args; \
+			break; \
+		case VSIMD_AVX2: \
+			name##_avx2 args; \
+			break; \
+		case VSIMD_SSE42: \
+			name##_sse42 args; \
+			break; \
+		default: \
+			name##_body args; \
+			break; \
+	} \
+}
+#else
+#define VSIMD_FUNCTION(name, params, args, ...) \
+static void \
+name params \
+{ \
+	__VA_ARGS__ \
+}
+#endif
+
+#endif
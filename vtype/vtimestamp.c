@@ -9,9 +9,9 @@ PG_FUNCTION_INFO_V1(vtimestamp_pl_interval);
 PG_FUNCTION_INFO_V1(vtimestamp_in);
 PG_FUNCTION_INFO_V1(vtimestamp_out);
 
-vtimestamp* buildvtimestamp(int dim, bool *skip)
+vtimestamp* buildvtimestamp(int dim, vselection *sel)
 {
-	return (vtimestamp*)buildvtype(TIMESTAMPOID, dim, skip);
+	return (vtimestamp*)buildvtype(TIMESTAMPOID, dim, sel);
 }
 /*
  * We are currently sharing some code between timestamp and timestamptz.
@@ -28,15 +28,14 @@ vtimestamp_timestamp_cmp_internal(vtimestamp *vdt1, Timestamp dt2)
 	vint4	*result;
 	Timestamp dt1;	
 
-	result = buildvtype(INT4OID,vdt1->dim, vdt1->skipref);
+	result = buildvtype(INT4OID,vdt1->dim, vdt1->selref);
+	vtype_copynulls(result, vdt1, NULL);
 #ifdef HAVE_INT64_TIMESTAMP
-	for (i = 0; i < BATCHSIZE; i++ )
+	VSEL_FOREACH(vdt1->selref, vdt1->dim, i,
 	{
-		if (vdt1->skipref[i])
-			continue;
-		dt1 = DatumGetTimestamp(vdt1->values[i]);
-		result->values[i] = Int32GetDatum((dt1 < dt2) ? -1 : ((dt1 > dt2) ? 1 : 0));
-	}
+		dt1 = VTYPE_VALUES(vdt1, Timestamp)[i];
+		VTYPE_VALUES(result, int32)[i] = (dt1 < dt2) ? -1 : ((dt1 > dt2) ? 1 : 0);
+	});
 	return PointerGetDatum(result);
 #else
 	elog(ERROR, "HAVE_INT64_TIMESTAMP must be enabled in vectorize executor.");
@@ -62,16 +61,19 @@ vtimestamp_pl_interval(PG_FUNCTION_ARGS)
 	Timestamp	timestamp;
 	vtimestamp	*result;
 	int i;
+	int n;
+	int nrows;
 
-	result = buildvtimestamp(vts->dim, vts->skipref);
+	result = buildvtype_result(fcinfo, TIMESTAMPOID, vts->dim, vts->selref);
+	vtype_copynulls(result, vts, NULL);
 
-	for(i = 0; i< vts->dim; i++)
+	nrows = VSEL_NROWS(vts->selref, vts->dim);
+	for(n = 0; n < nrows; n++)
 	{
-		if (vts->skipref[i])
-			continue;
-		timestamp = DatumGetTimestamp(vts->values[i]);
+		i = VSEL_ROW(vts->selref, n);
+		timestamp = VTYPE_VALUES(vts, Timestamp)[i];
 		if (TIMESTAMP_NOT_FINITE(timestamp))
-			result->values[i] = TimestampGetDatum(timestamp);
+			VTYPE_VALUES(result, Timestamp)[i] = timestamp;
 		else
 		{
 			if (span->month != 0)
@@ -136,7 +138,7 @@ vtimestamp_pl_interval(PG_FUNCTION_ARGS)
 						(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
 						 errmsg("timestamp out of range")));
 
-			result->values[i] = TimestampGetDatum(timestamp);
+			VTYPE_VALUES(result, Timestamp)[i] = timestamp;
 		}
 	}
 	PG_RETURN_POINTER(result);
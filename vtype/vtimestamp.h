@@ -11,7 +11,7 @@
 
 typedef vtype vtimestamp;
 
-extern vtimestamp* buildvtimestamp(int dim, bool *skip);
+extern vtimestamp* buildvtimestamp(int dim, vselection *sel);
 
 extern Datum vtimestamp_timestamp_cmp_internal(vtimestamp *vdt1, Timestamp dt2);
 
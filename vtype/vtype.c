@@ -23,33 +23,194 @@
 #include "utils/int8.h"
 #include "utils/date.h"
 #include "vtype.h"
+#include "vsimd.h"
 
 
 #define MAX_NUM_LEN 64
 
 const char canary = 0xe7;
 
-vtype* buildvtype(Oid elemtype,int dim,bool *skip)
+/*
+ * Width of the native values of a vtype of elemtype, 0 if it keeps Datums.
+ */
+int
+vtype_elemlen(Oid elemtype)
+{
+	switch (elemtype)
+	{
+		case BOOLOID:
+			return sizeof(bool);
+		case INT2OID:
+			return sizeof(int16);
+		case INT4OID:
+			return sizeof(int32);
+		case DATEOID:
+			return sizeof(DateADT);
+		case FLOAT4OID:
+			return sizeof(float4);
+		case INT8OID:
+			return sizeof(int64);
+		case FLOAT8OID:
+			return sizeof(float8);
+		case TIMESTAMPOID:
+			return sizeof(Timestamp);
+		default:
+			return 0;
+	}
+}
+
+vtype* buildvtype(Oid elemtype,int dim,vselection *sel)
 {
     vtype *res;
-	res = palloc0(sizeof(vtype));
+	char  *data;
+	int    elemlen = vtype_elemlen(elemtype);
+	Size   valuessz;
+
+	valuessz = TYPEALIGN(VTYPE_ALIGN,
+						 (elemlen > 0 ? elemlen : sizeof(Datum)) * dim);
+
+	data = palloc0(MAXALIGN(sizeof(vtype)) + (VTYPE_ALIGN - 1) +
+				   valuessz + sizeof(uint64) * VTYPE_NULLWORDS(dim));
+	res = (vtype *) data;
+	res->values = (void *) TYPEALIGN(VTYPE_ALIGN,
+									 data + MAXALIGN(sizeof(vtype)));
+	res->nulls = (uint64 *) ((char *) res->values + valuessz);
+	res->hasnull = false;
     res->dim = dim;
+    res->maxdim = dim;
     res->elemtype = elemtype;
-    res->skipref = skip;
+    res->elemlen = elemlen;
+    res->selref = sel;
 
     return res;
 }
 
+/*
+ * The result of a kernel called through fcinfo.  It is kept in fn_extra
+ * of the calling expression and handed out again for every batch, so an
+ * expression allocates its result once instead of once per batch.  This
+ * overwrites the previous result, which is fine since a batch is done
+ * with before the next one is computed.  The values are left as they
+ * were; the kernel writes each active row that is not null.  Without an
+ * FmgrInfo, as under DirectFunctionCall, a new vtype is built.
+ */
+vtype *
+buildvtype_result(FunctionCallInfo fcinfo, Oid elemtype, int dim, vselection *sel)
+{
+	FmgrInfo   *flinfo = fcinfo->flinfo;
+
+	if (flinfo == NULL)
+		return buildvtype(elemtype, dim, sel);
+
+	return buildvtype_cached((vtype **) &flinfo->fn_extra, flinfo->fn_mcxt,
+							 elemtype, dim, sel);
+}
+
+/*
+ * buildvtype_result with the result kept in *cache, allocated in cxt, for
+ * kernels that keep more than their result in fn_extra.
+ */
+vtype *
+buildvtype_cached(vtype **cache, MemoryContext cxt, Oid elemtype, int dim,
+				  vselection *sel)
+{
+	vtype	   *res = *cache;
+	MemoryContext oldcontext;
+
+	if (res == NULL || res->elemtype != elemtype || res->maxdim < dim)
+	{
+		if (res != NULL)
+			pfree(res);
+		oldcontext = MemoryContextSwitchTo(cxt);
+		res = buildvtype(elemtype, dim, sel);
+		MemoryContextSwitchTo(oldcontext);
+		*cache = res;
+		return res;
+	}
+
+	vtype_clearnulls(res, res->maxdim);
+	res->dim = dim;
+	res->selref = sel;
+	return res;
+}
+
 void destroyvtype(vtype** vt)
 {
     pfree((*vt));
     *vt = NULL;
 }
 
+/*
+ * Mark the first dim rows of vt not null.
+ */
+void
+vtype_clearnulls(vtype *vt, int dim)
+{
+	if (!vt->hasnull)
+		return;
+
+	memset(vt->nulls, 0, sizeof(uint64) * VTYPE_NULLWORDS(dim));
+	vt->hasnull = false;
+}
+
+/*
+ * Make res null where arg1 or arg2 is, a word of rows at a time.  arg2 may
+ * be NULL.  Nothing is done unless an input has nulls.
+ */
+void
+vtype_copynulls(vtype *res, const vtype *arg1, const vtype *arg2)
+{
+	int			nwords = VTYPE_NULLWORDS(res->dim);
+	int			w;
+
+	if (arg2 == NULL || !arg2->hasnull)
+	{
+		if (!arg1->hasnull)
+			return;
+		memcpy(res->nulls, arg1->nulls, sizeof(uint64) * nwords);
+	}
+	else if (!arg1->hasnull)
+		memcpy(res->nulls, arg2->nulls, sizeof(uint64) * nwords);
+	else
+	{
+		for (w = 0; w < nwords; w++)
+			res->nulls[w] = arg1->nulls[w] | arg2->nulls[w];
+	}
+	res->hasnull = true;
+}
+
+/*
+ * Run stmt for each active row i of res that is not null.  The null
+ * bitmap is only looked at if res has nulls.
+ */
+#define VTYPE_FOREACH_NOTNULL(res, i, stmt) \
+do { \
+    if (!(res)->hasnull) \
+        VSEL_FOREACH((res)->selref, (res)->dim, i, { stmt; }); \
+    else \
+        VSEL_FOREACH((res)->selref, (res)->dim, i, \
+        { \
+            if (!VTYPE_ISNULL(res, i)) \
+                stmt; \
+        }); \
+} while (0)
+
+/*
+ * Whether every row of res below its dim is active and not null.  The
+ * kernels then run a VSIMD_FUNCTION loop over all of them, built for the
+ * SIMD instructions of the CPU.
+ */
+#define VTYPE_DENSE(res) \
+    (!(res)->hasnull && ((res)->selref == NULL || (res)->selref->dense))
+
 #define _FUNCTION_BUILD(type, typeoid) \
-v##type* buildv##type(int dim, bool *skip) \
+v##type* buildv##type(int dim, vselection *sel) \
+{ \
+    return buildvtype(typeoid, dim, sel); \
+} \
+v##type* buildv##type##_result(FunctionCallInfo fcinfo, int dim, vselection *sel) \
 { \
-    return buildvtype(typeoid, dim, skip); \
+    return buildvtype_result(fcinfo, typeoid, dim, sel); \
 }
 
 /*
@@ -65,8 +226,8 @@ v##fname##in(PG_FUNCTION_ARGS) \
     vtype *res = NULL; \
     char tempstr[MAX_NUM_LEN] = {0}; \
     int n = 0; \
-    res = buildvtype(typeoid,BATCHSIZE,NULL);\
-    for (n = 0; *intString && n < BATCHSIZE; n++) \
+    res = buildvtype(typeoid,MAX_BATCHSIZE,NULL);\
+    for (n = 0; *intString && n < MAX_BATCHSIZE; n++) \
     { \
     	    char *start = NULL;\
         while (*intString && isspace((unsigned char) *intString)) \
@@ -79,7 +240,7 @@ v##fname##in(PG_FUNCTION_ARGS) \
         Assert(intString - start < MAX_NUM_LEN); \
         strncpy(tempstr, start, intString - start); \
         tempstr[intString - start] = 0; \
-        res->values[n] = DirectFunctionCall1(fname##in, CStringGetDatum(tempstr)); \
+        vtype_setdatum(res, n, DirectFunctionCall1(fname##in, CStringGetDatum(tempstr))); \
         while (*intString && !isspace((unsigned char) *intString)) \
             intString++; \
     } \
@@ -114,7 +275,7 @@ v##fname##out(PG_FUNCTION_ARGS) \
 	{ \
 		if (i != 0) \
 			*rp++ = ' '; \
-		strcat(rp, DatumGetCString(DirectFunctionCall1(fname##out, arg1->values[i])));\
+		strcat(rp, DatumGetCString(DirectFunctionCall1(fname##out, vtype_getdatum(arg1, i))));\
 		while (*++rp != '\0'); \
 	} \
 	*rp = '\0'; \
@@ -129,29 +290,27 @@ v##fname##out(PG_FUNCTION_ARGS) \
  * we have not processed the overflow so far.
  */
 #define __FUNCTION_OP(type1, XTYPE1, type2, XTYPE2, opsym, opstr) \
+VSIMD_FUNCTION(v##type1##v##type2##opstr##_loop, \
+               (int n, const VCTYPE_##type1 *v1, const VCTYPE_##type2 *v2, VCTYPE_##type1 *rv), \
+               (n, v1, v2, rv), \
+               int i; for (i = 0; i < n; i++) rv[i] = v1[i] opsym v2[i];) \
 PG_FUNCTION_INFO_V1(v##type1##v##type2##opstr); \
 Datum \
 v##type1##v##type2##opstr(PG_FUNCTION_ARGS) \
 { \
-    int size = 0; \
-    int i = 0; \
+    int i; \
     v##type1 *arg1 = (v##type1*)PG_GETARG_POINTER(0); \
     v##type2 *arg2 = (v##type2*)PG_GETARG_POINTER(1); \
-    v##type1 *res = buildv##type1(BATCHSIZE, arg1->skipref); \
+    v##type1 *res = buildv##type1##_result(fcinfo, arg1->dim, arg1->selref); \
+    VCTYPE_##type1 *v1 = VTYPE_VALUES(arg1, VCTYPE_##type1); \
+    VCTYPE_##type2 *v2 = VTYPE_VALUES(arg2, VCTYPE_##type2); \
+    VCTYPE_##type1 *rv = VTYPE_VALUES(res, VCTYPE_##type1); \
     Assert(arg1->dim == arg2->dim); \
-    size = arg1->dim; \
-    while(i < size) \
-    { \
-        res->isnull[i] = arg1->isnull[i] || arg2->isnull[i]; \
-        i++; \
-    } \
-	i=0; \
-    while(i < size) \
-    { \
-        if(!res->isnull[i]) \
-            res->values[i] = XTYPE1##GetDatum((DatumGet##XTYPE1(arg1->values[i])) opsym (DatumGet##XTYPE2(arg2->values[i]))); \
-        i++; \
-    } \
+    vtype_copynulls(res, arg1, arg2); \
+    if (VTYPE_DENSE(res)) \
+        v##type1##v##type2##opstr##_loop(res->dim, v1, v2, rv); \
+    else \
+        VTYPE_FOREACH_NOTNULL(res, i, rv[i] = v1[i] opsym v2[i]); \
     res->dim = arg1->dim; \
     PG_RETURN_POINTER(res); \
 }
@@ -162,23 +321,25 @@ v##type1##v##type2##opstr(PG_FUNCTION_ARGS) \
  * e.g. extern Datum vint2int2pl(PG_FUNCTION_ARGS);
  */
 #define __FUNCTION_OP_RCONST(type, XTYPE, const_type, CONST_ARG_MACRO, opsym, opstr) \
+VSIMD_FUNCTION(v##type##const_type##opstr##_loop, \
+               (int n, const VCTYPE_##type *v1, type c, VCTYPE_##type *rv), \
+               (n, v1, c, rv), \
+               int i; for (i = 0; i < n; i++) rv[i] = v1[i] opsym c;) \
 PG_FUNCTION_INFO_V1(v##type##const_type##opstr); \
 Datum \
 v##type##const_type##opstr(PG_FUNCTION_ARGS) \
 { \
-    int size = 0; \
-    int i = 0; \
+    int i; \
     v##type *arg1 = (v##type*)PG_GETARG_POINTER(0); \
     const_type arg2 = CONST_ARG_MACRO(1); \
-    v##type *res = buildv##type(BATCHSIZE, arg1->skipref); \
-    size = arg1->dim;\
-    while(i < size) \
-    { \
-        res->isnull[i] = arg1->isnull[i]; \
-        if(!res->isnull[i]) \
-            res->values[i] = XTYPE##GetDatum((DatumGet##XTYPE(arg1->values[i])) opsym ((type)arg2)); \
-        i ++ ;\
-    } \
+    v##type *res = buildv##type##_result(fcinfo, arg1->dim, arg1->selref); \
+    VCTYPE_##type *v1 = VTYPE_VALUES(arg1, VCTYPE_##type); \
+    VCTYPE_##type *rv = VTYPE_VALUES(res, VCTYPE_##type); \
+    vtype_copynulls(res, arg1, NULL); \
+    if (VTYPE_DENSE(res)) \
+        v##type##const_type##opstr##_loop(res->dim, v1, (type) arg2, rv); \
+    else \
+        VTYPE_FOREACH_NOTNULL(res, i, rv[i] = v1[i] opsym ((type)arg2)); \
     res->dim = arg1->dim; \
     PG_RETURN_POINTER(res); \
 }
@@ -189,28 +350,25 @@ v##type##const_type##opstr(PG_FUNCTION_ARGS) \
  * e.g. extern Datum int2vint2pl(PG_FUNCTION_ARGS);
  */
 #define __FUNCTION_OP_LCONST(type, XTYPE, const_type, CONST_ARG_MACRO, opsym, opstr) \
+VSIMD_FUNCTION(const_type##v##type##opstr##_loop, \
+               (int n, type c, const VCTYPE_##type *v2, VCTYPE_##type *rv), \
+               (n, c, v2, rv), \
+               int i; for (i = 0; i < n; i++) rv[i] = c opsym v2[i];) \
 PG_FUNCTION_INFO_V1(const_type##v##type##opstr); \
 Datum \
 const_type##v##type##opstr(PG_FUNCTION_ARGS) \
 { \
-    int size = 0; \
-    int i = 0; \
+    int i; \
     const_type arg1 = CONST_ARG_MACRO(0); \
     v##type *arg2 = (v##type*)PG_GETARG_POINTER(1); \
-    v##type *res = buildv##type(BATCHSIZE, arg2->skipref); \
-    size = arg2->dim;\
-    while(i < size) \
-    { \
-        res->isnull[i] = arg2->isnull[i]; \
-		i++; \
-	} \
-	i=0; \
-    while(i < size) \
-    { \
-        if(!res->isnull[i]) \
-            res->values[i] = XTYPE##GetDatum(((type)arg1) opsym (DatumGet##XTYPE(arg2->values[i]))); \
-        i ++ ;\
-    } \
+    v##type *res = buildv##type##_result(fcinfo, arg2->dim, arg2->selref); \
+    VCTYPE_##type *v2 = VTYPE_VALUES(arg2, VCTYPE_##type); \
+    VCTYPE_##type *rv = VTYPE_VALUES(res, VCTYPE_##type); \
+    vtype_copynulls(res, arg2, NULL); \
+    if (VTYPE_DENSE(res)) \
+        const_type##v##type##opstr##_loop(res->dim, (type) arg1, v2, rv); \
+    else \
+        VTYPE_FOREACH_NOTNULL(res, i, rv[i] = ((type)arg1) opsym v2[i]); \
     res->dim = arg2->dim; \
     PG_RETURN_POINTER(res); \
 }
@@ -222,30 +380,29 @@ const_type##v##type##opstr(PG_FUNCTION_ARGS) \
  * e.g. extern Datum vint2vint2eq(PG_FUNCTION_ARGS);
  */
 #define __FUNCTION_CMP(type1, XTYPE1, type2, XTYPE2, cmpsym, cmpstr) \
+VSIMD_FUNCTION(v##type1##v##type2##cmpstr##_loop, \
+               (int n, const VCTYPE_##type1 *v1, const VCTYPE_##type2 *v2, bool *rv), \
+               (n, v1, v2, rv), \
+               int i; for (i = 0; i < n; i++) rv[i] = (v1[i] cmpsym v2[i]);) \
 PG_FUNCTION_INFO_V1(v##type1##v##type2##cmpstr); \
 Datum \
 v##type1##v##type2##cmpstr(PG_FUNCTION_ARGS) \
 { \
 	vbool *res; \
-    int size = 0; \
-    int i = 0; \
+    int i; \
     v##type1 *arg1 = (v##type1*)PG_GETARG_POINTER(0); \
     v##type2 *arg2 = (v##type2*)PG_GETARG_POINTER(1); \
+    VCTYPE_##type1 *v1 = VTYPE_VALUES(arg1, VCTYPE_##type1); \
+    VCTYPE_##type2 *v2 = VTYPE_VALUES(arg2, VCTYPE_##type2); \
+    bool *rv; \
     Assert(arg1->dim == arg2->dim); \
-    res = buildvtype(BOOLOID, BATCHSIZE, arg1->skipref); \
-    size = arg1->dim; \
-    while(i < size) \
-    { \
-        res->isnull[i] = arg1->isnull[i] || arg2->isnull[i]; \
-		i++; \
-    } \
-	i=0; \
-    while(i < size) \
-    { \
-		if(!res->isnull[i]) \
-            res->values[i] = BoolGetDatum(DatumGet##XTYPE1(arg1->values[i]) cmpsym (DatumGet##XTYPE2(arg2->values[i]))); \
-        i++; \
-    } \
+    res = buildvtype_result(fcinfo, BOOLOID, arg1->dim, arg1->selref); \
+    rv = VTYPE_VALUES(res, bool); \
+    vtype_copynulls(res, arg1, arg2); \
+    if (VTYPE_DENSE(res)) \
+        v##type1##v##type2##cmpstr##_loop(res->dim, v1, v2, rv); \
+    else \
+        VTYPE_FOREACH_NOTNULL(res, i, rv[i] = (v1[i] cmpsym v2[i])); \
     res->dim = arg1->dim; \
     PG_RETURN_POINTER(res); \
 }
@@ -256,28 +413,25 @@ v##type1##v##type2##cmpstr(PG_FUNCTION_ARGS) \
  * e.g. extern Datum vint2int2eq(PG_FUNCTION_ARGS);
  */
 #define __FUNCTION_CMP_RCONST(type, XTYPE, const_type, CONST_ARG_MACRO, cmpsym, cmpstr) \
+VSIMD_FUNCTION(v##type##const_type##cmpstr##_loop, \
+               (int n, const VCTYPE_##type *v1, const_type c, bool *rv), \
+               (n, v1, c, rv), \
+               int i; for (i = 0; i < n; i++) rv[i] = (v1[i] cmpsym c);) \
 PG_FUNCTION_INFO_V1(v##type##const_type##cmpstr); \
 Datum \
 v##type##const_type##cmpstr(PG_FUNCTION_ARGS) \
 { \
-    int size = 0; \
-    int i = 0; \
+    int i; \
     v##type *arg1 = (v##type*)PG_GETARG_POINTER(0); \
     const_type arg2 = CONST_ARG_MACRO(1); \
-    vbool *res = buildvtype(BOOLOID, BATCHSIZE, arg1->skipref); \
-    size = arg1->dim; \
-    while(i < size) \
-    { \
-        res->isnull[i] = arg1->isnull[i]; \
-        i++; \
-    } \
-	i=0; \
-    while(i < size) \
-    { \
-        if(!res->isnull[i]) \
-            res->values[i] = BoolGetDatum((DatumGet##XTYPE(arg1->values[i])) cmpsym arg2); \
-        i++; \
-    } \
+    vbool *res = buildvtype_result(fcinfo, BOOLOID, arg1->dim, arg1->selref); \
+    VCTYPE_##type *v1 = VTYPE_VALUES(arg1, VCTYPE_##type); \
+    bool *rv = VTYPE_VALUES(res, bool); \
+    vtype_copynulls(res, arg1, NULL); \
+    if (VTYPE_DENSE(res)) \
+        v##type##const_type##cmpstr##_loop(res->dim, v1, arg2, rv); \
+    else \
+        VTYPE_FOREACH_NOTNULL(res, i, rv[i] = (v1[i] cmpsym arg2)); \
     res->dim = arg1->dim; \
     PG_RETURN_POINTER(res); \
 }
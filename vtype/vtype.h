@@ -22,19 +22,114 @@
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "catalog/pg_type.h"
+#include "datatype/timestamp.h"
+#include "utils/date.h"
 
 typedef int16 int2;
 typedef int32 int4;
 
-#define BATCHSIZE 1024
+/*
+ * Upper bound of the number of rows in a batch.  The planner picks the
+ * batch size per plan, unless the vectorize_batch_size GUC sets it.
+ */
+#define MAX_BATCHSIZE 16384
+
+/*
+ * Rows of a batch that are still alive.  When dense, all the rows below
+ * the dim of the batch are, and rows is not maintained; otherwise rows
+ * holds the nrows active row numbers in ascending order.
+ */
+typedef struct vselection {
+	bool    dense;
+	int     nrows;
+	int     *rows;
+}vselection;
+
+/*
+ * nulls and values are allocated together with the vtype by buildvtype,
+ * for maxdim rows, the dim it is built with.  A vtype reused for another
+ * batch keeps its buffers and only dim changes.  selref is the selection
+ * of the slot the batch belongs to, NULL if every row is active.
+ *
+ * nulls has a bit per row, set if the row is null.  hasnull is false when
+ * no bit is set, which is the common case and lets kernels skip nulls
+ * altogether.
+ *
+ * The fixed width types listed in vtype_elemlen() keep values as a plain
+ * array of their C type, VTYPE_ALIGN aligned, which the kernels walk
+ * directly; elemlen is the width of an entry.  Other types keep an array
+ * of Datums and elemlen is 0.  Code that does not know the type reads and
+ * writes single values with vtype_getdatum() and vtype_setdatum().
+ */
 typedef struct vtype {
 	Oid     elemtype;
 	int     dim;
-	bool    isnull[BATCHSIZE];
-	Datum   values[BATCHSIZE];
-	bool    *skipref;
+	int     maxdim;
+	int     elemlen;
+	bool    hasnull;
+	uint64  *nulls;
+	void    *values;
+	vselection *selref;
 }vtype;
 
+/* alignment of values and nulls, a cache line */
+#define VTYPE_ALIGN 64
+
+/* null bitmap access */
+#define VTYPE_NULLWORDS(dim)   (((dim) + 63) / 64)
+#define VTYPE_ISNULL(vt, row) \
+    ((((vt)->nulls[(row) >> 6] >> ((row) & 63)) & 1) != 0)
+#define VTYPE_SETNULL(vt, row) \
+    ((vt)->nulls[(row) >> 6] |= UINT64CONST(1) << ((row) & 63), \
+     (vt)->hasnull = true)
+
+/* values of a vtype as an array of ctype */
+#define VTYPE_VALUES(vt, ctype) ((ctype *) (vt)->values)
+
+/* C type of the values of v<type>, e.g. VCTYPE_int4 for vint4 */
+#define VCTYPE_int2         int16
+#define VCTYPE_int4         int32
+#define VCTYPE_int8         int64
+#define VCTYPE_float4       float4
+#define VCTYPE_float8       float8
+#define VCTYPE_bool         bool
+#define VCTYPE_date         DateADT
+#define VCTYPE_timestamp    Timestamp
+
+/*
+ * Run body with i set to each active row of a batch of dim rows, given
+ * its selection.  Without filtered rows this is a plain loop over the
+ * batch, which the compiler can vectorize.
+ */
+#define VSEL_FOREACH(sel, dim, i, body) \
+do { \
+    const vselection *_sel = (sel); \
+    if (_sel == NULL || _sel->dense) \
+    { \
+        for ((i) = 0; (i) < (dim); (i)++) \
+        { body } \
+    } \
+    else \
+    { \
+        int _n; \
+        for (_n = 0; _n < _sel->nrows; _n++) \
+        { \
+            (i) = _sel->rows[_n]; \
+            { body } \
+        } \
+    } \
+} while (0)
+
+/*
+ * The same walk spelled out, for bodies that cannot be a macro argument:
+ *   for (n = 0; n < VSEL_NROWS(sel, dim); n++) { i = VSEL_ROW(sel, n); ... }
+ */
+#define VSEL_NROWS(sel, dim) \
+    (((sel) == NULL || (sel)->dense) ? (dim) : (sel)->nrows)
+#define VSEL_ROW(sel, n) \
+    (((sel) == NULL || (sel)->dense) ? (n) : (sel)->rows[(n)])
+
 
 #define CANARYSIZE  sizeof(char)
 #define VTYPEHEADERSZ (sizeof(vtype))
@@ -46,7 +141,8 @@ typedef struct vtype {
 #define VTYPE_STURCTURE(type) typedef struct vtype v##type;
 
 #define FUNCTION_BUILD_HEADER(type) \
-v##type* buildv##type(int dim, bool *skip);
+v##type* buildv##type(int dim, vselection *sel); \
+v##type* buildv##type##_result(FunctionCallInfo fcinfo, int dim, vselection *sel);
 
 /*
  * Operator function for the abstract data types, this MACRO is used for the 
@@ -179,6 +275,72 @@ TYPE_HEADER(text, TEXTOID)
 TYPE_HEADER(date, DATEOID)
 TYPE_HEADER(bpchar, BPCHAROID)
 
-extern vtype* buildvtype(Oid elemtype,int dim,bool *skip);
+extern vtype* buildvtype(Oid elemtype,int dim,vselection *sel);
+extern vtype* buildvtype_result(FunctionCallInfo fcinfo, Oid elemtype, int dim, vselection *sel);
+extern vtype* buildvtype_cached(vtype **cache, MemoryContext cxt, Oid elemtype, int dim, vselection *sel);
 extern void destroyvtype(vtype** vt);
+extern int vtype_elemlen(Oid elemtype);
+extern void vtype_clearnulls(vtype *vt, int dim);
+extern void vtype_copynulls(vtype *res, const vtype *arg1, const vtype *arg2);
+
+static inline Datum
+vtype_getdatum(const vtype *vt, int row)
+{
+	switch (vt->elemtype)
+	{
+		case BOOLOID:
+			return BoolGetDatum(VTYPE_VALUES(vt, bool)[row]);
+		case INT2OID:
+			return Int16GetDatum(VTYPE_VALUES(vt, int16)[row]);
+		case INT4OID:
+			return Int32GetDatum(VTYPE_VALUES(vt, int32)[row]);
+		case DATEOID:
+			return DateADTGetDatum(VTYPE_VALUES(vt, DateADT)[row]);
+		case FLOAT4OID:
+			return Float4GetDatum(VTYPE_VALUES(vt, float4)[row]);
+		case INT8OID:
+			return Int64GetDatum(VTYPE_VALUES(vt, int64)[row]);
+		case FLOAT8OID:
+			return Float8GetDatum(VTYPE_VALUES(vt, float8)[row]);
+		case TIMESTAMPOID:
+			return TimestampGetDatum(VTYPE_VALUES(vt, Timestamp)[row]);
+		default:
+			return VTYPE_VALUES(vt, Datum)[row];
+	}
+}
+
+static inline void
+vtype_setdatum(vtype *vt, int row, Datum value)
+{
+	switch (vt->elemtype)
+	{
+		case BOOLOID:
+			VTYPE_VALUES(vt, bool)[row] = DatumGetBool(value);
+			break;
+		case INT2OID:
+			VTYPE_VALUES(vt, int16)[row] = DatumGetInt16(value);
+			break;
+		case INT4OID:
+			VTYPE_VALUES(vt, int32)[row] = DatumGetInt32(value);
+			break;
+		case DATEOID:
+			VTYPE_VALUES(vt, DateADT)[row] = DatumGetDateADT(value);
+			break;
+		case FLOAT4OID:
+			VTYPE_VALUES(vt, float4)[row] = DatumGetFloat4(value);
+			break;
+		case INT8OID:
+			VTYPE_VALUES(vt, int64)[row] = DatumGetInt64(value);
+			break;
+		case FLOAT8OID:
+			VTYPE_VALUES(vt, float8)[row] = DatumGetFloat8(value);
+			break;
+		case TIMESTAMPOID:
+			VTYPE_VALUES(vt, Timestamp)[row] = DatumGetTimestamp(value);
+			break;
+		default:
+			VTYPE_VALUES(vt, Datum)[row] = value;
+			break;
+	}
+}
 #endif
@@ -2,8 +2,9 @@
 #define VECTOR_ENGINE_VTYPE_VVARCHAR_H
 #include "postgres.h"
 #include "fmgr.h"
+struct vselection;
 typedef struct vtype vvarchar;
-extern vvarchar *buildvvarchar(int dim, bool *skip);
+extern vvarchar *buildvvarchar(int dim, struct vselection *sel);
 
 
 extern Datum vvarcharin(PG_FUNCTION_ARGS);